@@ -82,6 +82,70 @@
 // GP Player - Sequence playback support
 // #define OPT_GPPLAYER         // Enable if you want to play sequences
 
+// Gait Store - Gaits edited from the terminal monitor and saved in ESP32 flash (NVS)
+#define OPT_GAIT_STORE       // Adds the N command, stored gaits follow the built in ones
+
+// Stride limiter - Scale the travel length so all feet stay reachable by LegIK
+#define OPT_STRIDE_LIMIT     // Adds the L command to show the stride envelope
+
+// Stability margin - Support polygon of the grounded feet, computed each frame
+#define OPT_STABILITY_MARGIN // Adds the M command, BALANCE_DELAY only used when close to tipping
+
+// Free gait - Lift the leg that is running out of stroke when the margin allows (needs OPT_STABILITY_MARGIN)
+#define OPT_FREE_GAIT        // Adds the F command to toggle it
+
+// Quick start/stop - Start walking on the trailing leg and step straight back home on stop
+#define OPT_QUICK_START_STOP // Also drops the bExtraCycle padding to one timed move
+
+// Gait cache - Keep the joint angles of each gait step while walking steadily and skip the IK
+#define OPT_GAIT_CACHE       // Adds the C command, hits while the travel stays the same
+
+// Odometry - Dead reckoning of the body position and heading from the stance legs
+#define OPT_ODOMETRY         // Adds the P command
+
+// Gait trace - Record every frame of the gait in RAM, decode with tools/gait_trace.cpp
+#define OPT_GAIT_TRACE       // Adds the R command
+
+// Travel blending - Spread travel changes of the body over TravelBlendDiv steps, set per gait
+#define OPT_TRAVEL_BLEND
+
+// Body pose limiter - Scale the translate/rotate mode stick command back so all feet stay reachable
+#define OPT_BODY_POSE_LIMIT
+
+// Control tick - Start every loop() frame on an esp_timer tick of CTRL_TICK_US, servo moves last whole ticks
+#define OPT_CTRL_TICK        // Adds the J command to show the tick jitter
+
+// Pipeline - Input, kinematics and servo transport in their own FreeRTOS tasks (needs OPT_CTRL_TICK)
+#define OPT_PIPELINE         // Adds the T command to show the stage times
+
+// Tone engine - MSound queues notes for the LEDC and an esp_timer instead of bit banging SOUND_PIN
+#define OPT_TONE_ENGINE
+
+// Input feedback - Rumble and light bar effects are queued and stepped once a frame instead of delay()
+#define OPT_INPUT_FEEDBACK
+
+// Background jobs - Registered jobs with a period and time budget run in the slack before each tick (needs OPT_CTRL_TICK)
+#define OPT_BG_JOBS          // Adds the K command to show the job times
+
+// Frame deadline - Count walking frames that miss the end of the previous move, shed debug, trace and balance while they do
+#define OPT_FRAME_DEADLINE   // Adds the W command to show the misses
+
+// Emergency stop - The PS button, a controller drop or cEStopPin frees the servos from a high priority task
+#define OPT_ESTOP            // Adds the X command to show the stop latency
+// #define cEStopPin 27      // GPIO pin for an e-stop button to ground
+
+// Jitter benchmark - Control tick lateness percentiles, controller connected and disconnected (needs OPT_CTRL_TICK)
+#define OPT_JITTER_BENCH     // Shown by the J command
+
+// CPU governor - Run the CPU at 80/160/240MHz to fit the control loop load and what the robot does (needs OPT_CTRL_TICK)
+#define OPT_CPU_GOVERNOR     // Adds the V command, tools/gov_replay.cpp replays its load lines
+
+// Fast boot - SSC-32 link first, Bluetooth started in a task, no boot delays, a boot profile with the first frame
+#define OPT_FAST_BOOT
+
+// SSC frame assembler - All servo commands and the commit of a frame encoded into one buffer and sent with one UART write
+#define OPT_SSC_FRAME_ASM    // Adds the A command to show the bytes per frame and encode time
+
 //=============================================================================
 //[Botboarduino Pin Numbers]
 // Not used on ESP32, but kept for compatibility
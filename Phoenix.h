@@ -22,6 +22,19 @@
 #include "diyxbee.h"
 #endif
 
+//=============================================================================
+//[CLOCK] The one time base for all the timing: a 64 bit monotonic count of
+//      us since boot, so deadlines are compared directly and never wrap.  It
+//      is esp_timer on the ESP32.  On the host the tools/host esp_timer is a
+//      simulated clock that delay() and the timers move forward, so the
+//      whole controller can run faster than real time.
+//=============================================================================
+#include <esp_timer.h>
+#define ClockUs()           ((int64_t)esp_timer_get_time())
+#define ClockMs()           (ClockUs() / 1000)
+#define ClockDelayMs(ms)    delay(ms)
+#define ClockDelayUs(us)    delayMicroseconds(us)
+
 //=============================================================================
 //[CONSTANTS]
 //=============================================================================
@@ -79,7 +92,10 @@ extern boolean g_fDBGHandleError;
 extern const byte cTarsLength[] PROGMEM;
 #endif
 
-#ifdef OPT_BACKGROUND_PROCESS
+#ifdef OPT_BG_JOBS
+// No DoBackgroundProcess(), jobs only run in the slack before a tick, see BGJobsRun
+extern byte BGJobAdd(const char *pszName, void (*pfnJob)(void), word wPeriodMs, word wBudgetUs);
+#elif defined(OPT_BACKGROUND_PROCESS)
 #define DoBackgroundProcess()   g_ServoDriver.BackgroundProcess()
 #else
 #define DoBackgroundProcess()   
@@ -121,6 +137,18 @@ public:
     virtual void     Init(void);
     virtual void     ControlInput(void);
     virtual void     AllowControllerInterrupts(boolean fAllow);
+#ifdef OPT_PIPELINE
+    void             AcquireInput(void);     // Called by the input task, ControlInput uses what it got
+#endif
+#ifdef OPT_INPUT_FEEDBACK
+    void             UpdateFeedback(void);   // Once a frame, steps the rumble and light bar effects
+#endif
+#ifdef OPT_JITTER_BENCH
+    boolean          FIsConnected(void);     // Controller connected, the jitter benchmark splits on it
+#endif
+#ifdef OPT_FAST_BOOT
+    void             BeginAsync(void);       // Start the controller stack in a task, Init leaves it alone
+#endif
 
 #ifdef OPT_TERMINAL_MONITOR_IC  // Allow Input controller to define stuff as well
   void            ShowTerminalCommandList(void);
@@ -167,6 +195,9 @@ typedef struct _PhoenixGait {
 #ifdef DISPLAY_GAIT_NAMES
     PGM_P           pszName;             // The gait name
 #endif
+#ifdef OPT_TRAVEL_BLEND
+    byte            TravelBlendDiv;      // Steps a travel change is spread over, 0 = at once
+#endif
 } 
 PHOENIXGAIT;
 
@@ -175,6 +206,11 @@ PHOENIXGAIT;
 #else
 #define GAITNAME(name)
 #endif
+#ifdef OPT_TRAVEL_BLEND
+#define GAITBLEND(div)  ,div
+#else
+#define GAITBLEND(div)
+#endif
 
 //==============================================================================
 // class ControlState: This is the main structure of data that the Control 
@@ -219,6 +255,9 @@ typedef struct _InControlState {
   byte			InputTimeDelay;	//Delay that depends on the input to get the "sneaking" effect
   word			SpeedControl;	//Adjustible Delay
   byte       ForceGaitStepCnt;          // new to allow us to force a step even when not moving
+#ifdef OPT_FREE_GAIT
+  boolean       fFreeGait;                 // Lift legs when they run out of stroke instead of on the gait schedule
+#endif
 
 #ifdef OPT_DYNAMIC_ADJUST_LEGS
   short         aCoxaInitAngle1[CNT_LEGS]; 
@@ -229,6 +268,41 @@ typedef struct _InControlState {
 } 
 INCONTROLSTATE;
 
+//==============================================================================
+// Size of one frame of servo commands with its commit, used by the pipeline
+//      frame and the frame assembler.  Every servo of every leg must fit or
+//      the end of the frame, with the commit, would be lost.
+//==============================================================================
+#ifdef c4DOF
+#define SERVO_FRAME_LEG_SERVOS  4
+#else
+#define SERVO_FRAME_LEG_SERVOS  3
+#endif
+#define SERVO_FRAME_SERVO_MAX   8       // "#31P2500", binary is 3 bytes
+#define SERVO_FRAME_COMMIT_MAX  8       // "T65535\r\n", or the ESC that cancels
+#define SERVO_FRAME_LEG_MAX     (SERVO_FRAME_LEG_SERVOS*SERVO_FRAME_SERVO_MAX)
+#ifndef SERVO_FRAME_MAX
+#define SERVO_FRAME_MAX         (CNT_LEGS*SERVO_FRAME_LEG_MAX + SERVO_FRAME_COMMIT_MAX)
+#endif
+static_assert(SERVO_FRAME_MAX >= CNT_LEGS*SERVO_FRAME_LEG_MAX + SERVO_FRAME_COMMIT_MAX,
+    "SERVO_FRAME_MAX does not hold all of the legs and the commit");
+
+#ifdef OPT_PIPELINE
+//==============================================================================
+// SERVOFRAME: one frame of servo commands, including the commit, as the
+//      kinematics built it and the transport task writes it to the servo driver.
+//==============================================================================
+typedef struct _ServoFrame {
+  unsigned long ulDueTick;          // Control tick to write it on, 0 = right away
+  int64_t       llInputTime;        // esp_timer time the input of the frame was taken
+  int64_t       llStartTime;        // the kinematics started
+  int64_t       llReadyTime;        // and the frame was handed to the transport
+  word          cb;
+  byte          ab[SERVO_FRAME_MAX];
+} 
+SERVOFRAME;
+#endif
+
 //==============================================================================
 //==============================================================================
 // Define the class(s) for Servo Drivers.
@@ -237,6 +311,9 @@ INCONTROLSTATE;
 class ServoDriver {
 public:
   void Init(void);
+#ifdef OPT_FAST_BOOT
+  void InitFinish(void);                 // End of setup, what Init left waiting on the SSC-32
+#endif
 
     uint16_t GetBatteryVoltage(void);
 
@@ -262,9 +339,18 @@ public:
 #endif    
 #ifdef cTurretRotPin
   void            OutputServoInfoForTurret(short sRotateAngle1, short sTiltAngle1);
+#endif
+#ifdef OPT_SSC_FRAME_ASM
+  void            EndServoUpdate(void);      // The legs are all in the frame
 #endif
   void            CommitServoDriver(word wMoveTime);
   void            FreeServos(void);
+#ifdef OPT_ESTOP
+  void            EStop(void);           // E-stop task, free the leg servos right now
+#endif
+#ifdef OPT_PIPELINE
+  void            WriteFrame(SERVOFRAME *pframe);   // Transport task, put a frame on the wire
+#endif
 
   void            IdleTime(void);        // called when the main loop when the robot is not on
 
@@ -281,6 +367,7 @@ public:
 private:
 
 #ifdef OPT_GPPLAYER    
+  void    InitGPCheck(word wTimeout);
   boolean _fGPEnabled;     // IS GP defined for this servo driver?
   boolean _fGPActive;      // Is a sequence currently active - May change later when we integrate in sequence timing adjustment code
   uint8_t    _iSeq;        // current sequence we are running
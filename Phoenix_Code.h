@@ -172,6 +172,11 @@ static const word GetSin[] PROGMEM = {
 #ifndef BALANCE_DELAY
 #define BALANCE_DELAY 100
 #endif
+// With OPT_STABILITY_MARGIN the balance delay is only added while the body
+// center is closer than this to the edge of the support polygon (mm)
+#ifndef cStabilityMinMargin
+#define cStabilityMinMargin 30
+#endif
 
 
 #ifndef QUADMODE
@@ -462,10 +467,12 @@ long            IKFeetPosZ;        //Input Position of the Feet Z
 boolean         IKSolution;        //Output true if the solution is possible
 boolean         IKSolutionWarning;    //Output true if the solution is NEARLY possible
 boolean         IKSolutionError;    //Output true if the solution is NOT possible
+byte            g_abLegIKFlags[CNT_LEGS];  //Output of LegIK per leg, 1 solution, 2 warning, 4 error
+byte            g_bClampedLegs;     //Output of CheckAngles, bit per leg that had an angle clamped
 //--------------------------------------------------------------------
 //[TIMING]
-unsigned long   lTimerStart;    //Start time of the calculation cycles
-unsigned long   lTimerEnd;        //End time of the calculation cycles
+int64_t         llTimerStart;   //Start time of the calculation cycles, ms
+int64_t         llTimerEnd;       //End time of the calculation cycles, ms
 byte            CycleTime;        //Total Cycle time
 
 word            ServoMoveTime;        //Time for servo updates
@@ -495,6 +502,13 @@ long            TotalTransY;
 long            TotalYBal1;
 long            TotalXBal1;
 long            TotalZBal1;
+#ifdef OPT_STABILITY_MARGIN
+//[Stability]
+short           g_asFootX[CNT_LEGS];    // Foot positions relative to the body center
+short           g_asFootZ[CNT_LEGS];
+byte            g_bGroundedLegs;        // Bit per leg that has its foot on the ground
+short           g_sStabilityMargin;     // Distance from body center to the support polygon edge, mm
+#endif
 //[Single Leg Control]
 byte            PrevSelectedLeg;
 boolean         AllDown;
@@ -507,6 +521,12 @@ long            GaitPosX[CNT_LEGS];         //Array containing Relative X positi
 long            GaitPosY[CNT_LEGS];         //Array containing Relative Y position corresponding to the Gait
 long            GaitPosZ[CNT_LEGS];         //Array containing Relative Z position corresponding to the Gait
 long            GaitRotY[CNT_LEGS];         //Array containing Relative Y rotation corresponding to the Gait
+#ifdef OPT_TRAVEL_BLEND
+short           g_sBlendTravelX;            // Travel the body moves with, follows TravelLength
+short           g_sBlendTravelZ;
+short           g_sBlendTravelY;
+boolean         g_fTravelBlending;          // The body travel has not caught up with TravelLength yet
+#endif
 
 //boolean			GaitLegInAir[CNT_LEGS];		// True if leg is in the air
 //byte			GaitNextLeg;				// The next leg which will be lifted
@@ -531,7 +551,7 @@ boolean        fRobotUpsideDownPrev;
 #ifndef QUADMODE
 //  Speed, Steps, Lifted, Front Down, Lifted Factor, Half Height, On Ground, 
 //     Quad extra: COGAngleStart, COGAngleStep, CogRadius, COGCCW
-//                      { RR, <RM> RF, LR, <LM>, LF}
+//                      { RR, <RM> RF, LR, <LM>, LF}, <name>, <travel blend steps>
 #ifdef DISPLAY_GAIT_NAMES
 extern "C" {
   // Move the Gait Names to program space...
@@ -545,12 +565,12 @@ extern "C" {
 #endif
 
 PHOENIXGAIT APG[] = { 
-    {DEFAULT_SLOW_GAIT, 12, 3, 2, 2, 8, 3, {7, 11, 3, 1, 5, 9} GAITNAME(s_szGN1)},        // Ripple 12
-    {DEFAULT_SLOW_GAIT, 8, 3, 2, 2, 4, 3, {1, 5, 1, 5, 1, 5} GAITNAME(s_szGN2)},           //Tripod 8 steps
-    {DEFAULT_GAIT_SPEED, 12, 3, 2, 2, 8, 3, {5, 10, 3, 11, 4, 9} GAITNAME(s_szGN3) },      //Triple Tripod 12 step
-    {DEFAULT_GAIT_SPEED, 16, 5, 3, 4, 10, 1, {6, 13, 4, 14, 5, 12} GAITNAME(s_szGN4)},    // Triple Tripod 16 steps, use 5 lifted positions
-    {DEFAULT_SLOW_GAIT, 24, 3, 2, 2, 20, 3, {13, 17, 21, 1, 5, 9} GAITNAME(s_szGN5)},     //Wave 24 steps
-    {DEFAULT_GAIT_SPEED, 6, 2, 1, 2, 4, 1, {1, 4, 1, 4, 1, 4} GAITNAME(s_szGN6)}          //Tripod 6 steps
+    {DEFAULT_SLOW_GAIT, 12, 3, 2, 2, 8, 3, {7, 11, 3, 1, 5, 9} GAITNAME(s_szGN1) GAITBLEND(4)},        // Ripple 12
+    {DEFAULT_SLOW_GAIT, 8, 3, 2, 2, 4, 3, {1, 5, 1, 5, 1, 5} GAITNAME(s_szGN2) GAITBLEND(2)},           //Tripod 8 steps
+    {DEFAULT_GAIT_SPEED, 12, 3, 2, 2, 8, 3, {5, 10, 3, 11, 4, 9} GAITNAME(s_szGN3) GAITBLEND(4)},      //Triple Tripod 12 step
+    {DEFAULT_GAIT_SPEED, 16, 5, 3, 4, 10, 1, {6, 13, 4, 14, 5, 12} GAITNAME(s_szGN4) GAITBLEND(5)},    // Triple Tripod 16 steps, use 5 lifted positions
+    {DEFAULT_SLOW_GAIT, 24, 3, 2, 2, 20, 3, {13, 17, 21, 1, 5, 9} GAITNAME(s_szGN5) GAITBLEND(10)},     //Wave 24 steps
+    {DEFAULT_GAIT_SPEED, 6, 2, 1, 2, 4, 1, {1, 4, 1, 4, 1, 4} GAITNAME(s_szGN6) GAITBLEND(2)}          //Tripod 6 steps
 };    
 
 #else
@@ -571,10 +591,11 @@ PHOENIXGAIT APG[] = {
 //--------------------------------------------------------------------
 
 #ifdef ADD_GAITS
-byte NUM_GAITS = sizeof(APG)/sizeof(APG[0]) + sizeof(APG_EXTRA)/sizeof(APG_EXTRA[0]);
+#define CNT_BUILTIN_GAITS   (sizeof(APG)/sizeof(APG[0]) + sizeof(APG_EXTRA)/sizeof(APG_EXTRA[0]))
 #else
-byte NUM_GAITS = sizeof(APG)/sizeof(APG[0]);
+#define CNT_BUILTIN_GAITS   (sizeof(APG)/sizeof(APG[0]))
 #endif
+byte NUM_GAITS = CNT_BUILTIN_GAITS;     // Stored gaits (OPT_GAIT_STORE) are added to this at startup
 
 
 
@@ -587,6 +608,107 @@ extern void SingleLegControl(void);
 extern void GaitSeq(void);
 extern void BalanceBody(void);
 extern void CheckAngles();
+extern void CalcLegsIK(void);
+extern void PrintGait(PHOENIXGAIT *pgait);
+extern boolean FootInReach(byte LegNr, long lX, long lY, long lZ);
+#ifdef OPT_STRIDE_LIMIT
+extern void StrideLimit(void);
+#endif
+#ifdef OPT_STABILITY_MARGIN
+extern void CalcStabilityMargin(void);
+extern short SupportMargin(byte bLegMask);
+#endif
+#ifdef OPT_QUICK_START_STOP
+extern void WalkStartStep(void);
+extern boolean WalkStopStep(void);
+#endif
+#ifdef OPT_ODOMETRY
+extern void OdometryReset(void);
+extern void OdometryUpdate(void);
+extern void OdometryStance(byte LegNr, long lDX, long lDZ, long lDRot);
+extern void PrintOdometry(void);
+extern byte g_bOdoStanceLegs;
+#endif
+#ifdef OPT_GAIT_TRACE
+extern void TraceRecord(void);
+#endif
+#ifdef OPT_TRAVEL_BLEND
+extern void TravelBlend(void);
+extern short TravelBlendOne(short sBody, short sCmd, short sDiv);
+#endif
+#ifdef OPT_BODY_POSE_LIMIT
+extern byte BodyPoseLimit(boolean fRotate, short sBaseY);
+#endif
+#ifdef OPT_CTRL_TICK
+extern void CtrlTickInit(void);
+extern void CtrlTickFrame(void);
+extern unsigned long CtrlTickMoveDue(word wMoveTime);
+extern void CtrlTickWaitMove(word wMoveTime);
+extern word CtrlTickRoundMs(word wMoveTime);
+extern void PrintCtrlTick(void);
+#endif
+#ifdef OPT_PIPELINE
+extern void PipelineInit(void);
+extern void PipelineFrameStart(void);
+extern void PipelineInputTaken(int64_t llTime);
+extern void PipelineSend(void);
+extern void PrintPipeline(void);
+extern SERVOFRAME *g_pServoFrame;
+extern void PipelineFlush(void);
+extern TaskHandle_t g_htaskPipeTransport;
+#endif
+#ifdef OPT_BG_JOBS
+extern void BGJobsInit(void);
+extern void BGJobsRun(long lSlackUs);
+extern void PrintBGJobs(void);
+extern void BGJobsResetStats(void);
+#endif
+#ifdef OPT_FRAME_DEADLINE
+extern void FrameShedStart(void);
+extern void FrameDeadlineCheck(word wMoveTime);
+extern void FrameDeadlineResetStats(void);
+extern void PrintFrameDeadline(void);
+#endif
+#ifdef OPT_ESTOP
+extern void EStopInit(void);
+extern void EStopTrigger(void);
+extern void EStopLock(void);
+extern void EStopUnlock(void);
+extern void EStopLatch(void);
+extern void EStopResetStats(void);
+extern void PrintEStop(void);
+extern volatile boolean g_fEStopped;
+#endif
+#ifdef OPT_CPU_GOVERNOR
+extern void GovernorInit(void);
+extern void GovernorFrame(void);
+extern void GovernorResetStats(void);
+extern void PrintGovernor(void);
+extern int64_t g_llGovIdleUs;
+extern boolean g_fGovLog;
+#endif
+#ifdef OPT_FAST_BOOT
+extern void BootMark(const char *pszName);
+extern void BootFirstFrame(void);
+extern void PrintBootProfile(void);
+extern volatile int64_t g_llBootBTReady;
+#endif
+#ifdef OPT_GAIT_CACHE
+extern boolean GaitCacheLookup(void);
+extern void GaitCacheStore(void);
+#endif
+#ifdef OPT_FREE_GAIT
+extern void FreeGaitReset(void);
+extern void FreeGaitPlan(void);
+extern void FreeGaitAdvance(void);
+extern short g_asFreeGaitStep[];
+extern boolean g_fFreeGaitHold;
+#endif
+extern boolean ValidateGait(PHOENIXGAIT *pgait, boolean fReport);
+#ifdef OPT_GAIT_STORE
+extern void GaitStoreInit(void);
+extern boolean GaitStoreGet(byte iStored, PHOENIXGAIT *pgait);
+#endif
 
 extern void    PrintSystemStuff(void);            // Try to see why we fault...
 
@@ -607,6 +729,9 @@ extern boolean TerminalMonitor(void);
 // SETUP: the main arduino setup function.
 //--------------------------------------------------------------------------
 void setup(){
+#ifdef OPT_FAST_BOOT
+  BootMark("core");                         // Bootloader and the Arduino core
+#endif
 #ifdef OPT_SKETCHSETUP
   SketchSetup();
 #endif  
@@ -614,14 +739,22 @@ void setup(){
   g_fDebugOutput = false;
 #ifdef DBGSerial    
   DBGSerial.begin(DBG_SERIAL_BAUD);
+#endif
+#ifdef OPT_FAST_BOOT
+  BootMark("sketch");
 #endif
   // Init our ServoDriver
   g_ServoDriver.Init();
+#ifdef OPT_FAST_BOOT
+  BootMark("ssc link");
+  g_InputController.BeginAsync();           // Bluetooth comes up while we do the rest
+#else
 
   //Checks to see if our Servo Driver support a GP Player
   //    DBGSerial.write("Program Start\n\r");
   // debug stuff
-  delay(10);
+  ClockDelayMs(10);
+#endif
 
 
   //Turning off all the leds
@@ -665,14 +798,30 @@ void setup(){
   g_InControlState.LegLiftHeight = 50;
   g_InControlState.ForceGaitStepCnt = 0;    // added to try to adjust starting positions depending on height...
   g_InControlState.GaitStep = 1;
+#ifdef OPT_FREE_GAIT
+  g_InControlState.fFreeGait = false;
+  FreeGaitReset();
+#endif
+#ifdef OPT_ODOMETRY
+  OdometryReset();
+#endif
+#ifdef OPT_GAIT_STORE
+  GaitStoreInit();                          // Add any gaits saved in flash to the end of the list
+#endif
   GaitSelect();
 
 #ifdef cTurretRotPin
   g_InControlState.TurretRotAngle1 = cTurretRotInit;      // Rotation of turrent in 10ths of degree
   g_InControlState.TurretTiltAngle1 = cTurretTiltInit;    // the tile for the turret
 #endif
+#ifdef OPT_FAST_BOOT
+  BootMark("stance and gaits");
+#endif
 
   g_InputController.Init();
+#ifdef OPT_FAST_BOOT
+  BootMark("input");
+#endif
 
   // Servo Driver
   ServoMoveTime = 150;
@@ -691,615 +840,3517 @@ void setup(){
   DBGSerial.println(IsRobotUpsideDown, DEC);
 #endif  
 #endif
+#ifdef OPT_PIPELINE
+  PipelineInit();                           // Input and servo transport tasks
+#endif
+#ifdef OPT_ESTOP
+  EStopInit();                              // After the servo driver opened the SSC-32 port
+#endif
+#ifdef OPT_BG_JOBS
+  BGJobsInit();
+#endif
+#ifdef OPT_CPU_GOVERNOR
+  GovernorInit();
+#endif
+#ifdef OPT_FAST_BOOT
+  BootMark("tasks");
+  g_ServoDriver.InitFinish();
+  BootMark("ssc answer");
+#endif
+#ifdef OPT_CTRL_TICK
+  CtrlTickInit();                           // Last, so the first frame is not late already
+#endif
 
 }
 
-
 //=============================================================================
-// Loop: the main arduino main Loop function
+//[CONTROL TICK] esp_timer based time base for the main loop.  Every frame,
+//      input, gait, IK and the servo commit, starts on a tick of
+//      CTRL_TICK_US and a servo move lasts a whole number of ticks, so the
+//      next frame starts on the tick the move ends on.  Waits are done on
+//      the 64 bit esp_timer clock, so no millis() wraparound and no 1ms
+//      steps.  The J command shows how late after their tick frames started.
+//      The kinematics (loop()) and the servo transport run on CTRL_CORE,
+//      the Bluetooth stack and the controller input on the other core.
+//      With OPT_JITTER_BENCH, J also gives the lateness percentiles with
+//      the controller connected and disconnected.
 //=============================================================================
+#ifdef OPT_CTRL_TICK
+#include <esp_timer.h>
 
-
-void loop(void)
-{
-  //Start time
-  unsigned long lTimeWaitEnd;
-  lTimerStart = millis(); 
-  DoBackgroundProcess();
-  //Read input
-  CheckVoltage();        // check our voltages...
-  if (!g_fLowVoltageShutdown) {
-    //    DebugWrite(A0, HIGH);
-    g_InputController.ControlInput();
-    //    DebugWrite(A0, LOW);
-  }
-  WriteOutputs();        // Write Outputs
-
-#ifdef IsRobotUpsideDown
-    if (!fWalking){// dont do this while walking
-    g_fRobotUpsideDown = IsRobotUpsideDown;    // Grab the current state of the robot... 
-    if (g_fRobotUpsideDown != fRobotUpsideDownPrev) {
-      // Double check to make sure that it was not a one shot error
-      g_fRobotUpsideDown = IsRobotUpsideDown;    // Grab the current state of the robot... 
-      if (g_fRobotUpsideDown != fRobotUpsideDownPrev) {
-        fRobotUpsideDownPrev = g_fRobotUpsideDown;
-#ifdef DGBSerial        
-        DBGSerial.println(fRobotUpsideDownPrev, DEC);
-#endif        
-      }
-    }
-  }
-  //  DBGSerial.println(analogRead(0), DEC);
+#ifndef CTRL_TICK_US
+#define CTRL_TICK_US        20000   // 50Hz, what the old delay(20) gave us when idle
 #endif
-#ifdef OPT_WALK_UPSIDE_DOWN
-  if (g_fRobotUpsideDown){
-    g_InControlState.TravelLength.x = -g_InControlState.TravelLength.x;
-    g_InControlState.BodyPos.x = -g_InControlState.BodyPos.x;
-    g_InControlState.SLLeg.x = -g_InControlState.SLLeg.x;
-    g_InControlState.BodyRot1.z = -g_InControlState.BodyRot1.z;
-  }
+#ifndef CTRL_CORE
+#define CTRL_CORE           1       // loop(), the servo transport and the e-stop
+#endif
+#ifndef CTRL_LOOP_PRIO
+#define CTRL_LOOP_PRIO      1       // loop() task, the Arduino default
+#endif
+// Where the Bluetooth host stack runs is fixed when the ESP32 core is built
+#if defined(CONFIG_BT_BLUEDROID_PINNED_TO_CORE)
+#define CTRL_BT_CORE        CONFIG_BT_BLUEDROID_PINNED_TO_CORE
+#else
+#define CTRL_BT_CORE        0
+#endif
+#if CTRL_BT_CORE == CTRL_CORE
+#warning The Bluetooth stack shares CTRL_CORE with the kinematics
 #endif
 
-#ifdef OPT_GPPLAYER
-    //GP Player
-  g_ServoDriver.GPPlayer();
-  if (g_ServoDriver.FIsGPSeqActive())
-    return;  // go back to process the next message
+esp_timer_handle_t      g_hCtrlTick;
+TaskHandle_t            g_htaskCtrlLoop;        // loop(), woken by each tick
+volatile unsigned long  g_ulCtrlTicks;          // Ticks since CtrlTickInit, counted by the timer
+int64_t                 g_llCtrlTickBase;       // esp_timer time of tick 0
+unsigned long           g_ulCtrlFrameTick;      // Tick the current frame started on
+unsigned long           g_ulCtrlTickDue;        // Tick the next frame starts on
+unsigned long           g_ulCtrlFrames;         // Jitter statistics since the last J command
+unsigned long           g_ulCtrlLateSum;        // us
+unsigned long           g_ulCtrlLateMin;
+unsigned long           g_ulCtrlLateMax;
+unsigned long           g_ulCtrlOverruns;       // Frames that missed their tick completely
+
+//--------------------------------------------------------------------
+// CtrlTickCallback - Runs in the esp_timer task, counts and wakes the
+//      tasks that wait for a tick.
+//--------------------------------------------------------------------
+void CtrlTickCallback(void *pvArg)
+{
+  g_ulCtrlTicks++;
+  if (g_htaskCtrlLoop)
+    xTaskNotifyGive(g_htaskCtrlLoop);
+#ifdef OPT_PIPELINE
+  if (g_htaskPipeTransport)
+    xTaskNotifyGive(g_htaskPipeTransport);   // It may be waiting for this tick
 #endif
+}
 
-  //Single leg control
-  SingleLegControl ();
-  DoBackgroundProcess();
+#ifdef OPT_JITTER_BENCH
+//--------------------------------------------------------------------
+// Lateness histograms, [0] with the controller disconnected and [1]
+//      connected.  Frames that missed their tick go in the last bucket.
+//--------------------------------------------------------------------
+#define JITTER_BUCKET_US    10
+#define JITTER_BUCKETS      200     // 2ms in 10us steps, plus one for the rest
 
-  //Gait
-  GaitSeq();
+typedef struct _JitterHist {
+  unsigned long aulCount[JITTER_BUCKETS + 1];
+  unsigned long ulFrames;
+  unsigned long ulMax;              // us, of the frames that made their tick
+} JITTERHIST;
 
-  DoBackgroundProcess();
+JITTERHIST              g_ajhCtrl[2];
 
-  //Balance calculations
-  TotalTransX = 0;     //reset values used for calculation of balance
-  TotalTransZ = 0;
-  TotalTransY = 0;
-  TotalXBal1 = 0;
-  TotalYBal1 = 0;
-  TotalZBal1 = 0;
-  
-  if (g_InControlState.BalanceMode) {
-#ifdef DEBUG
-      if (g_fDebugOutput) {
-  TravelRequest = (abs(g_InControlState.TravelLength.x)>cTravelDeadZone) || (abs(g_InControlState.TravelLength.z)>cTravelDeadZone) 
-    || (abs(g_InControlState.TravelLength.y)>cTravelDeadZone) || (g_InControlState.ForceGaitStepCnt != 0) || fWalking;
+void JitterBenchAdd(long lLate)
+{
+  JITTERHIST *pjh = &g_ajhCtrl[g_InputController.FIsConnected() ? 1 : 0];
+  unsigned long ulBucket = (unsigned long)lLate / JITTER_BUCKET_US;
+
+  if ((lLate >= CTRL_TICK_US) || (ulBucket > JITTER_BUCKETS))
+    ulBucket = JITTER_BUCKETS;
+  else if ((unsigned long)lLate > pjh->ulMax)
+    pjh->ulMax = lLate;
+  pjh->aulCount[ulBucket]++;
+  pjh->ulFrames++;
+}
 
-        DBGSerial.print("T("); 
-		DBGSerial.print(fWalking, DEC);
-		DBGSerial.print(" ");
-        DBGSerial.print(g_InControlState.TravelLength.x,DEC); 
-        DBGSerial.print(","); 
-        DBGSerial.print(g_InControlState.TravelLength.y,DEC); 
-        DBGSerial.print(","); 
-        DBGSerial.print(g_InControlState.TravelLength.z,DEC); 
-        DBGSerial.print(")"); 
-      }
-#endif
-    for (LegIndex = 0; LegIndex < (CNT_LEGS/2); LegIndex++) {    // balance calculations for all Right legs
+//--------------------------------------------------------------------
+// JitterPercentile - Lateness, us, that wPerMille of the frames were
+//      not later than.  Returns 0xffffffff if that is past the buckets.
+//--------------------------------------------------------------------
+unsigned long JitterPercentile(JITTERHIST *pjh, word wPerMille)
+{
+  unsigned long ulNeed = (pjh->ulFrames * wPerMille + 999) / 1000;
+  unsigned long ulSeen = 0;
 
-      DoBackgroundProcess();
-      BalCalcOneLeg (-LegPosX[LegIndex]+GaitPosX[LegIndex], LegPosZ[LegIndex]+GaitPosZ[LegIndex], 
-          (LegPosY[LegIndex]-(short)pgm_read_word(&cInitPosY[LegIndex]))+GaitPosY[LegIndex], LegIndex);
-    }
+  for (word iBucket = 0; iBucket < JITTER_BUCKETS; iBucket++) {
+    ulSeen += pjh->aulCount[iBucket];
+    if (ulSeen >= ulNeed)
+      return min((unsigned long)(iBucket + 1) * JITTER_BUCKET_US, pjh->ulMax);
+  }
+  return 0xffffffff;
+}
 
-    for (LegIndex = (CNT_LEGS/2); LegIndex < CNT_LEGS; LegIndex++) {    // balance calculations for all Right legs
-      DoBackgroundProcess();
-      BalCalcOneLeg(LegPosX[LegIndex]+GaitPosX[LegIndex], LegPosZ[LegIndex]+GaitPosZ[LegIndex], 
-          (LegPosY[LegIndex]-(short)pgm_read_word(&cInitPosY[LegIndex]))+GaitPosY[LegIndex], LegIndex);
+void PrintJitterBench(void)
+{
+  static const word c_awPerMille[] = {500, 900, 990, 999};
+
+  for (byte iConnected = 0; iConnected < 2; iConnected++) {
+    JITTERHIST *pjh = &g_ajhCtrl[iConnected];
+    DBGSerial.print(iConnected ? F("Connected    ") : F("Disconnected "));
+    DBGSerial.print(pjh->ulFrames, DEC);
+    DBGSerial.print(F(" frames"));
+    if (pjh->ulFrames) {
+      DBGSerial.print(F(" Late us p50/p90/p99/p99.9/max: "));
+      for (byte i = 0; i < 4; i++) {
+        unsigned long ul = JitterPercentile(pjh, c_awPerMille[i]);
+        if (ul == 0xffffffff)
+          DBGSerial.print(F(">2000"));
+        else
+          DBGSerial.print(ul, DEC);
+        DBGSerial.print(F("/"));
+      }
+      DBGSerial.print(pjh->ulMax, DEC);
+      DBGSerial.print(F(" Missed: "));
+      DBGSerial.print(pjh->aulCount[JITTER_BUCKETS], DEC);
     }
-    BalanceBody();
+    DBGSerial.println();
   }
+}
+#endif // OPT_JITTER_BENCH
 
-
-  //Reset IKsolution indicators 
-  IKSolution = 0 ;
-  IKSolutionWarning = 0; 
-  IKSolutionError = 0 ;
-
-  //Do IK for all Right legs
-#ifdef DEBUG
-    if (g_fDebugOutput && g_InControlState.fRobotOn) {
-        DBGSerial.print(g_InControlState.GaitStep,DEC);
-        DBGSerial.print(":");
-    }
+void CtrlTickResetStats(void)
+{
+  g_ulCtrlFrames = 0;
+  g_ulCtrlLateSum = 0;
+  g_ulCtrlLateMin = 0xffffffff;
+  g_ulCtrlLateMax = 0;
+  g_ulCtrlOverruns = 0;
+#ifdef OPT_JITTER_BENCH
+  memset(g_ajhCtrl, 0, sizeof(g_ajhCtrl));
 #endif
+}
 
-  for (LegIndex = 0; LegIndex < (CNT_LEGS/2); LegIndex++) {    
-    DoBackgroundProcess();
-    BodyFK(-LegPosX[LegIndex]+g_InControlState.BodyPos.x+GaitPosX[LegIndex] - TotalTransX,
-    LegPosZ[LegIndex]+g_InControlState.BodyPos.z+GaitPosZ[LegIndex] - TotalTransZ,
-    LegPosY[LegIndex]+g_InControlState.BodyPos.y+GaitPosY[LegIndex] - TotalTransY,
-    GaitRotY[LegIndex], LegIndex);
+void CtrlTickInit(void)
+{
+  esp_timer_create_args_t args = {};
+
+  // The Arduino core starts loop() on ARDUINO_RUNNING_CORE, we can only check it
+  vTaskPrioritySet(NULL, CTRL_LOOP_PRIO);
+  g_htaskCtrlLoop = xTaskGetCurrentTaskHandle();
+  if (xPortGetCoreID() != CTRL_CORE)
+    DBGSerial.println(F("loop() is not running on CTRL_CORE"));
+
+  args.callback = &CtrlTickCallback;
+  args.name = "phxtick";
+  esp_timer_create(&args, &g_hCtrlTick);
+  g_ulCtrlTicks = 0;
+  g_ulCtrlFrameTick = 0;
+  g_ulCtrlTickDue = 1;
+  CtrlTickResetStats();
+  g_llCtrlTickBase = ClockUs();
+  esp_timer_start_periodic(g_hCtrlTick, CTRL_TICK_US);
+}
 
-    LegIK (LegPosX[LegIndex]-g_InControlState.BodyPos.x+BodyFKPosX-(GaitPosX[LegIndex] - TotalTransX), 
-    LegPosY[LegIndex]+g_InControlState.BodyPos.y-BodyFKPosY+GaitPosY[LegIndex] - TotalTransY,
-    LegPosZ[LegIndex]+g_InControlState.BodyPos.z-BodyFKPosZ+GaitPosZ[LegIndex] - TotalTransZ, LegIndex);
+//--------------------------------------------------------------------
+// CtrlTickWait - Wait for tick ulTick, running the background process
+//      or jobs meanwhile.  On each tick the jobs that fit run first, then
+//      the task sleeps until the timer wakes it, so the core is free for
+//      the lower priority tasks and the idle task.  Returns how long after
+//      that tick we are, us.
+//--------------------------------------------------------------------
+long CtrlTickWait(unsigned long ulTick)
+{
+  while ((long)(g_ulCtrlTicks - ulTick) < 0) {
+#ifdef OPT_BG_JOBS
+    BGJobsRun((long)(g_llCtrlTickBase + (int64_t)ulTick * CTRL_TICK_US - ClockUs()));
+#else
+    DoBackgroundProcess();
+#endif
+    if ((long)(g_ulCtrlTicks - ulTick) < 0) {
+#ifdef OPT_CPU_GOVERNOR
+      int64_t llSleepStart = ClockUs();
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      g_llGovIdleUs += ClockUs() - llSleepStart;    // Only the sleep, the jobs are load
+#else
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+#endif
+    }
   }
+  return (long)(ClockUs() - (g_llCtrlTickBase + (int64_t)ulTick * CTRL_TICK_US));
+}
 
-  //Do IK for all Left legs  
-  for (LegIndex = (CNT_LEGS/2); LegIndex < CNT_LEGS; LegIndex++) {
-    DoBackgroundProcess();
-    BodyFK(LegPosX[LegIndex]-g_InControlState.BodyPos.x+GaitPosX[LegIndex] - TotalTransX,
-    LegPosZ[LegIndex]+g_InControlState.BodyPos.z+GaitPosZ[LegIndex] - TotalTransZ,
-    LegPosY[LegIndex]+g_InControlState.BodyPos.y+GaitPosY[LegIndex] - TotalTransY,
-    GaitRotY[LegIndex], LegIndex);
-    LegIK (LegPosX[LegIndex]+g_InControlState.BodyPos.x-BodyFKPosX+GaitPosX[LegIndex] - TotalTransX,
-    LegPosY[LegIndex]+g_InControlState.BodyPos.y-BodyFKPosY+GaitPosY[LegIndex] - TotalTransY,
-    LegPosZ[LegIndex]+g_InControlState.BodyPos.z-BodyFKPosZ+GaitPosZ[LegIndex] - TotalTransZ, LegIndex);
+//--------------------------------------------------------------------
+// CtrlTickFrame - Called at the start of loop(), waits for the tick the
+//      frame is due on.  If we missed it by a whole tick or more, the
+//      schedule starts again from the tick we are in.
+//--------------------------------------------------------------------
+void CtrlTickFrame(void)
+{
+  long lLate = CtrlTickWait(g_ulCtrlTickDue);
+#ifdef OPT_JITTER_BENCH
+  JitterBenchAdd(lLate);
+#endif
+
+  g_ulCtrlFrameTick = g_ulCtrlTickDue;
+  if (lLate >= CTRL_TICK_US) {
+    g_ulCtrlOverruns++;
+    g_ulCtrlFrameTick = g_ulCtrlTicks;
   }
-#ifdef OPT_WALK_UPSIDE_DOWN
-  if (g_fRobotUpsideDown){ //Need to set them back for not messing with the SmoothControl
-    g_InControlState.BodyPos.x = -g_InControlState.BodyPos.x;
-    g_InControlState.SLLeg.x = -g_InControlState.SLLeg.x;
-    g_InControlState.BodyRot1.z = -g_InControlState.BodyRot1.z;
+  else {
+    g_ulCtrlFrames++;
+    g_ulCtrlLateSum += lLate;
+    if ((unsigned long)lLate < g_ulCtrlLateMin)
+      g_ulCtrlLateMin = lLate;
+    if ((unsigned long)lLate > g_ulCtrlLateMax)
+      g_ulCtrlLateMax = lLate;
   }
+  g_ulCtrlTickDue = g_ulCtrlFrameTick + 1;
+#ifdef OPT_CPU_GOVERNOR
+  GovernorFrame();
 #endif
-  //Check mechanical limits
-  CheckAngles();
-
-  //Write IK errors to leds
-  LedC = IKSolutionWarning;
-  LedA = IKSolutionError;
+}
 
-  //Drive Servos
-  if (g_InControlState.fRobotOn) {
-    if (g_InControlState.fRobotOn && !g_InControlState.fPrev_RobotOn) {
-      MSound(3, 60, 2000, 80, 2250, 100, 2500);
-#ifdef USEXBEE
-      XBeePlaySounds(3, 60, 2000, 80, 2250, 100, 2500);
-#endif            
+//--------------------------------------------------------------------
+// CtrlTickRoundMs - Move time rounded up to whole ticks, at least one.
+//--------------------------------------------------------------------
+word CtrlTickRoundMs(word wMoveTime)
+{
+  unsigned long ulTicks = ((unsigned long)wMoveTime * 1000 + CTRL_TICK_US - 1) / CTRL_TICK_US;
+  if (!ulTicks)
+    ulTicks = 1;
+  return (word)((ulTicks * CTRL_TICK_US) / 1000);
+}
 
-      Eyes = 1;
-    }
+//--------------------------------------------------------------------
+// CtrlTickMoveDue - The next frame is due wMoveTime ms after the tick this
+//      frame started on.  Returns that tick.
+//--------------------------------------------------------------------
+unsigned long CtrlTickMoveDue(word wMoveTime)
+{
+  g_ulCtrlTickDue = g_ulCtrlFrameTick + ((unsigned long)CtrlTickRoundMs(wMoveTime) * 1000) / CTRL_TICK_US;
+  return g_ulCtrlTickDue;
+}
 
-    //Calculate Servo Move time
-    if ((abs(g_InControlState.TravelLength.x)>cTravelDeadZone) || (abs(g_InControlState.TravelLength.z)>cTravelDeadZone) ||
-      (abs(g_InControlState.TravelLength.y*2)>cTravelDeadZone)) {         
-      ServoMoveTime = g_InControlState.gaitCur.NomGaitSpeed + (g_InControlState.InputTimeDelay*2) + g_InControlState.SpeedControl;
+//--------------------------------------------------------------------
+// CtrlTickWaitMove - Wait for the tick wMoveTime ms after the one this
+//      frame started on, the next frame is due on that same tick.
+//--------------------------------------------------------------------
+void CtrlTickWaitMove(word wMoveTime)
+{
+  CtrlTickWait(CtrlTickMoveDue(wMoveTime));
+}
 
-      //Add aditional delay when Balance mode is on
-      if (g_InControlState.BalanceMode)
-        ServoMoveTime = ServoMoveTime + BALANCE_DELAY;
-    } 
-    else //Movement speed excl. Walking
-    ServoMoveTime = 200 + g_InControlState.SpeedControl;
+void PrintCtrlTick(void)
+{
+  DBGSerial.print(F("Tick: "));
+  DBGSerial.print(CTRL_TICK_US, DEC);
+  DBGSerial.print(F("us Frames: "));
+  DBGSerial.print(g_ulCtrlFrames, DEC);
+  if (g_ulCtrlFrames) {
+    DBGSerial.print(F(" Late us min/avg/max: "));
+    DBGSerial.print(g_ulCtrlLateMin, DEC);
+    DBGSerial.print(F("/"));
+    DBGSerial.print(g_ulCtrlLateSum / g_ulCtrlFrames, DEC);
+    DBGSerial.print(F("/"));
+    DBGSerial.print(g_ulCtrlLateMax, DEC);
+  }
+  DBGSerial.print(F(" Overruns: "));
+  DBGSerial.println(g_ulCtrlOverruns, DEC);
+  DBGSerial.print(F("loop() core/prio: "));
+  DBGSerial.print(xPortGetCoreID(), DEC);
+  DBGSerial.print(F("/"));
+  DBGSerial.print(uxTaskPriorityGet(NULL), DEC);
+  DBGSerial.print(F(" Bluetooth core: "));
+  DBGSerial.println(CTRL_BT_CORE, DEC);
+#ifdef OPT_JITTER_BENCH
+  PrintJitterBench();
+#endif
+}
+#endif // OPT_CTRL_TICK
 
-    // note we broke up the servo driver into start/commit that way we can output all of the servo information
-    // before we wait and only have the termination information to output after the wait.  That way we hopefully
-    // be more accurate with our timings...
-    DoBackgroundProcess();
-    StartUpdateServos();
+//=============================================================================
+//[PIPELINE] The work of a frame split over FreeRTOS tasks:
+//      input    - PIPE_INPUT_CORE, copies the controller state every
+//                 PIPE_INPUT_MS into a mailbox (InputController::AcquireInput)
+//      kinematics - the Arduino loop task, takes the newest copy, does gait,
+//                 balance and IK and formats the servo commands and commit
+//                 into the frame buffer it owns, g_pServoFrame
+//      transport - PIPE_TRANSPORT_CORE, writes each frame to the servo
+//                 driver on the control tick it is due on
+//      There are two frame buffers.  PipelineSend hands the finished one to
+//      the transport and flips the kinematics over to the other, so the
+//      frame for the next move is computed and formatted while the SSC-32
+//      is still executing the current one, and at the deadline all that is
+//      left is writing bytes that are ready.  A frame starts on the tick the
+//      one before it is written on, which keeps the input of a move at most
+//      one move old, the same as without the pipeline.  Anything else loop()
+//      sends to the SSC-32 has to PipelineFlush first, so it doesn't mix in.
+//=============================================================================
+#ifdef OPT_PIPELINE
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+
+#ifndef PIPE_INPUT_MS
+#define PIPE_INPUT_MS           10      // Controller sample period
+#endif
+#ifndef PIPE_INPUT_CORE
+#define PIPE_INPUT_CORE         CTRL_BT_CORE    // With the Bluetooth stack
+#endif
+#ifndef PIPE_INPUT_PRIO
+#define PIPE_INPUT_PRIO         2
+#endif
+#ifndef PIPE_TRANSPORT_CORE
+#define PIPE_TRANSPORT_CORE     CTRL_CORE       // With the loop task
+#endif
+#ifndef PIPE_TRANSPORT_PRIO
+#define PIPE_TRANSPORT_PRIO     3       // Above the loop task, so it writes on time
+#endif
 
-    // See if we need to sync our processor with the servo driver while walking to ensure the prev is completed 
-    //before sending the next one
+SERVOFRAME          g_aServoFrames[2];
+SERVOFRAME          *g_pServoFrame = &g_aServoFrames[0];    // Frame the kinematics is building
+QueueHandle_t       g_qServoFrames;             // Kinematics to transport, the buffer pointers
+SemaphoreHandle_t   g_hsemTransportIdle;        // Taken while a frame is queued or being written
+word                g_wPipeWireMs;              // Time the last frame took on the wire at SSC_BAUD
+TaskHandle_t        g_htaskPipeInput;
+TaskHandle_t        g_htaskPipeTransport;
+int64_t             g_llPipeInputTime;          // When the input the kinematics works with was taken
+
+// Stage statistics since the last T command, us.  Each one is only
+// updated by one task.
+typedef struct {
+  unsigned long     cnt;
+  unsigned long     ulSum;
+  unsigned long     ulMax;
+} PIPESTAT;
+
+PIPESTAT            g_psPipeInput;              // Age of the input when the kinematics took it
+PIPESTAT            g_psPipeKin;                // Kinematics, frame start to handed over
+PIPESTAT            g_psPipeLate;               // Written after the due tick
+PIPESTAT            g_psPipeWrite;              // Writing the frame
+PIPESTAT            g_psPipeEndToEnd;           // Input taken to frame written
+unsigned long       g_ulPipeBytes;
+int64_t             g_llPipeStatsStart;
+
+void PipeStatAdd(PIPESTAT *pps, int64_t llUs)
+{
+  if (llUs < 0)
+    llUs = 0;
+  pps->cnt++;
+  pps->ulSum += (unsigned long)llUs;
+  if ((unsigned long)llUs > pps->ulMax)
+    pps->ulMax = (unsigned long)llUs;
+}
 
+void PipelineResetStats(void)
+{
+  memset(&g_psPipeInput, 0, sizeof(g_psPipeInput));
+  memset(&g_psPipeKin, 0, sizeof(g_psPipeKin));
+  memset(&g_psPipeLate, 0, sizeof(g_psPipeLate));
+  memset(&g_psPipeWrite, 0, sizeof(g_psPipeWrite));
+  memset(&g_psPipeEndToEnd, 0, sizeof(g_psPipeEndToEnd));
+  g_ulPipeBytes = 0;
+  g_llPipeStatsStart = ClockUs();
+}
 
-    // Finding any incident of GaitPos/Rot <>0:
-    for (LegIndex = 0; LegIndex < CNT_LEGS; LegIndex++) {
-      if ( (GaitPosX[LegIndex] > cGPlimit) || (GaitPosX[LegIndex] < -cGPlimit)
-        || (GaitPosZ[LegIndex] > cGPlimit) || (GaitPosZ[LegIndex] < -cGPlimit) 
-        || (GaitRotY[LegIndex] > cGPlimit) || (GaitRotY[LegIndex] < -cGPlimit))    {
+//--------------------------------------------------------------------
+// PipelineInputTask - Sample the controller at a fixed rate.
+//--------------------------------------------------------------------
+void PipelineInputTask(void *pvArg)
+{
+  TickType_t xLastWake = xTaskGetTickCount();
 
-        bExtraCycle = g_InControlState.gaitCur.NrLiftedPos + 1;//For making sure that we are using timed move until all legs are down
-        break;
-      }
+  for (;;) {
+    g_InputController.AcquireInput();
+    vTaskDelayUntil(&xLastWake, pdMS_TO_TICKS(PIPE_INPUT_MS));
+  }
+}
+
+//--------------------------------------------------------------------
+// PipelineTransportTask - Write each frame on the tick it is due on.  The
+//      control tick notifies us, so we sleep until then.
+//--------------------------------------------------------------------
+void PipelineTransportTask(void *pvArg)
+{
+  SERVOFRAME *pframe;
+  int64_t llWrite;
+
+  for (;;) {
+    if (xQueueReceive(g_qServoFrames, &pframe, portMAX_DELAY) != pdTRUE)
+      continue;
+    if (pframe->ulDueTick) {
+      while ((long)(g_ulCtrlTicks - pframe->ulDueTick) < 0)
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
     }
-    if (bExtraCycle>0){ 
-      bExtraCycle--;
-      fWalking = !(bExtraCycle==0);
+    llWrite = ClockUs();
+    if (pframe->ulDueTick)
+      PipeStatAdd(&g_psPipeLate, llWrite - (g_llCtrlTickBase + (int64_t)pframe->ulDueTick * CTRL_TICK_US));
+#ifdef OPT_ESTOP
+    EStopLock();            // A stop can not come between the check and the write
+    if (!g_fEStopped)       // Else the frame is dropped
+#endif
+    g_ServoDriver.WriteFrame(pframe);
+#ifdef OPT_ESTOP
+    EStopUnlock();
+#endif
+    PipeStatAdd(&g_psPipeWrite, ClockUs() - llWrite);
+    PipeStatAdd(&g_psPipeEndToEnd, ClockUs() - pframe->llInputTime);
+    g_ulPipeBytes += pframe->cb;
+    xSemaphoreGive(g_hsemTransportIdle);     // The kinematics may use this buffer again
+  }
+}
 
-      //Get endtime and calculate wait time
-      lTimeWaitEnd = lTimerStart + PrevServoMoveTime;
+void PipelineInit(void)
+{
+  g_qServoFrames = xQueueCreate(1, sizeof(SERVOFRAME *));
+  g_hsemTransportIdle = xSemaphoreCreateBinary();
+  xSemaphoreGive(g_hsemTransportIdle);
+  g_llPipeInputTime = ClockUs();
+  PipelineResetStats();
+  xTaskCreatePinnedToCore(PipelineTransportTask, "phxservo", 4096, NULL, PIPE_TRANSPORT_PRIO, 
+    &g_htaskPipeTransport, PIPE_TRANSPORT_CORE);
+  xTaskCreatePinnedToCore(PipelineInputTask, "phxinput", 4096, NULL, PIPE_INPUT_PRIO, 
+    &g_htaskPipeInput, PIPE_INPUT_CORE);
+}
 
-      DebugWrite(A1, HIGH);
-      do {
-        // Wait the appropriate time, call any background process while waiting...
-        DoBackgroundProcess();
-      } 
-      while (millis() < lTimeWaitEnd);
-      DebugWrite(A1, LOW);
-#ifdef DEBUG_X
-      if (g_fDebugOutput) {
+//--------------------------------------------------------------------
+// PipelineFrameStart - Called at the start of each frame.  The buffer we
+//      own is free, even if the transport is still writing the other one.
+//--------------------------------------------------------------------
+void PipelineFrameStart(void)
+{
+  g_pServoFrame->ulDueTick = 0;
+  g_pServoFrame->llStartTime = ClockUs();
+}
 
-        DBGSerial.print("BRX:");
-        DBGSerial.print(g_InControlState.BodyRot1.x,DEC); 
-        DBGSerial.print("W?:");
-         DBGSerial.print(fWalking,DEC);  
-         DBGSerial.print(" GS:");
-         DBGSerial.print(g_InControlState.GaitStep,DEC);  
-         //Debug LF leg
-         DBGSerial.print(" GPZ:");
-         DBGSerial.print(GaitPosZ[cLF],DEC);
-         DBGSerial.print(" GPY:");
-         DBGSerial.println(GaitPosY[cLF],DEC);
-      }
+//--------------------------------------------------------------------
+// PipelineFlush - Wait for the transport to have written everything, for
+//      when loop() wants to talk to the servo driver itself.
+//--------------------------------------------------------------------
+void PipelineFlush(void)
+{
+  xSemaphoreTake(g_hsemTransportIdle, portMAX_DELAY);
+  xSemaphoreGive(g_hsemTransportIdle);
+}
+
+//--------------------------------------------------------------------
+// PipelineInputTaken - The input controller took a new copy of the input.
+//--------------------------------------------------------------------
+void PipelineInputTaken(int64_t llTime)
+{
+  g_llPipeInputTime = llTime;
+  PipeStatAdd(&g_psPipeInput, ClockUs() - llTime);
+}
+
+//--------------------------------------------------------------------
+// PipelineSend - The frame is complete, commit included, hand it over.
+//--------------------------------------------------------------------
+void PipelineSend(void)
+{
+  SERVOFRAME *pframe = g_pServoFrame;
+
+  pframe->llInputTime = g_llPipeInputTime;
+  pframe->llReadyTime = ClockUs();
+  PipeStatAdd(&g_psPipeKin, pframe->llReadyTime - pframe->llStartTime);
+  g_wPipeWireMs = ((unsigned long)pframe->cb * 10000L) / SSC_BAUD + 1;
+
+  // Once the frame before is written its buffer is ours again
+  xSemaphoreTake(g_hsemTransportIdle, portMAX_DELAY);
+  xQueueSend(g_qServoFrames, &pframe, portMAX_DELAY);
+  g_pServoFrame = (pframe == &g_aServoFrames[0])? &g_aServoFrames[1] : &g_aServoFrames[0];
+  g_pServoFrame->cb = 0;
+}
+
+void PrintPipeStat(const char *psz, PIPESTAT *pps)
+{
+  DBGSerial.print(psz);
+  DBGSerial.print(pps->cnt? pps->ulSum / pps->cnt : 0, DEC);
+  DBGSerial.print(F("/"));
+  DBGSerial.print(pps->ulMax, DEC);
+}
+
+void PrintPipeline(void)
+{
+  unsigned long ulMs = (unsigned long)((ClockUs() - g_llPipeStatsStart) / 1000);
+
+  DBGSerial.println(F("Stage us avg/max"));
+  PrintPipeStat(" Input age: ", &g_psPipeInput);
+  PrintPipeStat(" Kinematics: ", &g_psPipeKin);
+  PrintPipeStat(" Late: ", &g_psPipeLate);
+  PrintPipeStat(" Write: ", &g_psPipeWrite);
+  PrintPipeStat(" End to end: ", &g_psPipeEndToEnd);
+  DBGSerial.println();
+  DBGSerial.print(F("Frames: "));
+  DBGSerial.print(g_psPipeWrite.cnt, DEC);
+  if (ulMs) {
+    DBGSerial.print(F(" ("));
+    DBGSerial.print((g_psPipeWrite.cnt * 1000.0) / ulMs, 1);
+    DBGSerial.print(F("/s) Bytes/s: "));
+    DBGSerial.print(((unsigned long long)g_ulPipeBytes * 1000) / ulMs, DEC);
+  }
+  DBGSerial.println();
+}
+#endif // OPT_PIPELINE
+
+//=============================================================================
+//[BACKGROUND JOBS] Work that is not part of the frame, run in the slack the
+//      control tick leaves before the next frame is due.  Each job has a
+//      period, how often it wants to run, and a budget, the time it is
+//      allowed.  CtrlTickWait offers BGJobsRun the time left before the tick
+//      and a job only starts when its budget still fits, so a job can not
+//      make the next frame late unless it overruns its budget.  The jobs take
+//      turns on who goes first.  The K command shows the per job CPU time and
+//      overruns.
+//=============================================================================
+#ifdef OPT_BG_JOBS
+#ifndef OPT_CTRL_TICK
+#error OPT_BG_JOBS needs OPT_CTRL_TICK
 #endif
-    }
-#ifdef DEBUG_X
+#define BG_JOBS_MAX         8
+
+typedef struct _BGJob {
+  const char    *pszName;
+  void          (*pfnJob)(void);
+  word          wPeriodMs;      // Run at most this often, 0 is every time there is room
+  word          wBudgetUs;      // Time the job may take
+  int64_t       llLast;         // ClockUs() it last ran
+  unsigned long ulRuns;         // Statistics since the last K command
+  unsigned long ulUsSum;
+  unsigned long ulUsMax;
+  unsigned long ulOverruns;     // Runs that took longer than the budget
+  unsigned long ulLateMax;      // ms the job waited past its period for room
+} BGJOB;
+
+BGJOB           g_aBGJobs[BG_JOBS_MAX];
+byte            g_cBGJobs;
+byte            g_iBGJobFirst;  // Job that gets the first chance next time
+
+//--------------------------------------------------------------------
+// BGJobAdd - Registers a job, returns its index or 0xff when full.
+//--------------------------------------------------------------------
+byte BGJobAdd(const char *pszName, void (*pfnJob)(void), word wPeriodMs, word wBudgetUs)
+{
+  if (g_cBGJobs >= BG_JOBS_MAX)
+    return 0xff;
+  BGJOB *pjob = &g_aBGJobs[g_cBGJobs];
+  memset(pjob, 0, sizeof(BGJOB));
+  pjob->pszName = pszName;
+  pjob->pfnJob = pfnJob;
+  pjob->wPeriodMs = wPeriodMs;
+  pjob->wBudgetUs = wBudgetUs;
+  pjob->llLast = ClockUs() - (int64_t)wPeriodMs * 1000;    // Due right away
+  return g_cBGJobs++;
+}
+
+//--------------------------------------------------------------------
+// BGJobsRun - Runs the jobs that are due and fit in the lSlackUs that is
+//      left before the next deadline.
+//--------------------------------------------------------------------
+void BGJobsRun(long lSlackUs)
+{
+  int64_t llStart = ClockUs();
+  byte iJob = g_iBGJobFirst;
+
+  if (!g_cBGJobs)
+    return;
+  if (++g_iBGJobFirst >= g_cBGJobs)
+    g_iBGJobFirst = 0;
+
+  for (byte cJobs = g_cBGJobs; cJobs; cJobs--) {
+    BGJOB *pjob = &g_aBGJobs[iJob];
+    if (++iJob >= g_cBGJobs)
+      iJob = 0;
+
+    unsigned long ulWaited = (unsigned long)((ClockUs() - pjob->llLast) / 1000);
+    if (ulWaited < pjob->wPeriodMs)
+      continue;
+    if ((lSlackUs - (long)(ClockUs() - llStart)) < (long)pjob->wBudgetUs)
+      continue;     // Try again in the next bit of slack
+
+    int64_t llJobStart = ClockUs();
+    pjob->pfnJob();
+    unsigned long ulUs = (unsigned long)(ClockUs() - llJobStart);
+
+    pjob->llLast = ClockUs();
+    pjob->ulRuns++;
+    pjob->ulUsSum += ulUs;
+    if (ulUs > pjob->ulUsMax)
+      pjob->ulUsMax = ulUs;
+    if (ulUs > pjob->wBudgetUs)
+      pjob->ulOverruns++;
+    if ((ulWaited - pjob->wPeriodMs) > pjob->ulLateMax)
+      pjob->ulLateMax = ulWaited - pjob->wPeriodMs;
+  }
+}
+
+void BGJobsResetStats(void)
+{
+  for (byte i = 0; i < g_cBGJobs; i++) {
+    g_aBGJobs[i].ulRuns = 0;
+    g_aBGJobs[i].ulUsSum = 0;
+    g_aBGJobs[i].ulUsMax = 0;
+    g_aBGJobs[i].ulOverruns = 0;
+    g_aBGJobs[i].ulLateMax = 0;
+  }
+}
+
+#ifdef OPT_TERMINAL_MONITOR
+// The terminal monitor, only while the robot is off as before.  loop() used
+// to return when it ran a command, which only skipped the 20ms idle delay
+// (the tick does the pacing now) and storing state that does not change
+// while the robot is off, so what it returns is not needed here.
+void BGJobTerminal(void)
+{
+  if (g_InControlState.fRobotOn)
+    return;
+#ifdef OPT_PIPELINE
+  PipelineFlush();        // Commands may talk to the SSC-32 themselves
+#endif
+  TerminalMonitor();
+}
+#endif
+
+//--------------------------------------------------------------------
+// BGJobsInit - The jobs the Phoenix code has itself, called from setup().
+//--------------------------------------------------------------------
+void BGJobsInit(void)
+{
+#ifdef OPT_TERMINAL_MONITOR
+  BGJobAdd("term", BGJobTerminal, 20, 2000);
+#endif
+#ifdef OPT_BACKGROUND_PROCESS
+  BGJobAdd("user", BackgroundProcess, 0, 200);
+#endif
+}
+
+void PrintBGJobs(void)
+{
+  DBGSerial.println(F("Job  Period Budget Runs Avg Max Overruns LateMax"));
+  for (byte i = 0; i < g_cBGJobs; i++) {
+    BGJOB *pjob = &g_aBGJobs[i];
+    DBGSerial.print(pjob->pszName);
+    DBGSerial.print(F(" "));
+    DBGSerial.print(pjob->wPeriodMs, DEC);
+    DBGSerial.print(F("ms "));
+    DBGSerial.print(pjob->wBudgetUs, DEC);
+    DBGSerial.print(F("us "));
+    DBGSerial.print(pjob->ulRuns, DEC);
+    DBGSerial.print(F(" "));
+    DBGSerial.print(pjob->ulRuns ? (pjob->ulUsSum / pjob->ulRuns) : 0, DEC);
+    DBGSerial.print(F("us "));
+    DBGSerial.print(pjob->ulUsMax, DEC);
+    DBGSerial.print(F("us "));
+    DBGSerial.print(pjob->ulOverruns, DEC);
+    DBGSerial.print(F(" "));
+    DBGSerial.print(pjob->ulLateMax, DEC);
+    DBGSerial.println(F("ms"));
+  }
+}
+#endif // OPT_BG_JOBS
+
+//=============================================================================
+//[FRAME DEADLINE] While walking, each frame's work has to be done before
+//      the previous move ends, else the move just gets stretched.  After
+//      the work, FrameDeadlineCheck sees how much of the move time the frame
+//      used.  Each miss sheds one more level of optional work.  After
+//      FRAME_SHED_RECOVER frames in a row that used less than
+//      FRAME_MARGIN_PCT, one level comes back.  With the control tick the
+//      time counts from the tick the frame was due on.  The W command shows
+//      the misses.
+//=============================================================================
+#ifdef OPT_FRAME_DEADLINE
+#define FRAME_SHED_DEBUG        1       // No debug output
+#define FRAME_SHED_TELEMETRY    2       // No gait trace records either
+#define FRAME_SHED_BALANCE      3       // No balance pass either
+#ifndef FRAME_MARGIN_PCT
+#define FRAME_MARGIN_PCT        75      // Frames using less of the move time than this have room to spare
+#endif
+#ifndef FRAME_SHED_RECOVER
+#define FRAME_SHED_RECOVER      50      // Frames with room to spare before one level comes back
+#endif
+
+int64_t         g_llFrameStartUs;       // ClockUs() the frame's work started
+byte            g_bFrameShed;           // FRAME_SHED_ level we are at
+byte            g_cFrameSpare;          // Frames in a row with room to spare
+boolean         g_fFrameDebugShed;      // Debug output was on when we shed it
+unsigned long   g_ulFrameChecks;        // Statistics since the last W command
+unsigned long   g_ulFrameMisses;
+unsigned long   g_ulFrameUsedMax;       // us
+unsigned long   g_ulFrameOverMax;       // us past the deadline
+unsigned long   g_ulFrameShedFrames;    // Frames that ran with something shed
+byte            g_bFrameShedMax;
+
+//--------------------------------------------------------------------
+// FrameShedStart - Called at the start of loop().  Nothing needs to be
+//      shed while the robot is off, and then the terminal monitor sees
+//      the debug setting the user made.
+//--------------------------------------------------------------------
+void FrameShedStart(void)
+{
+  g_llFrameStartUs = ClockUs();
+  if (!g_InControlState.fRobotOn) {
+    g_bFrameShed = 0;
+    g_cFrameSpare = 0;
+  }
+  if (g_bFrameShed >= FRAME_SHED_DEBUG) {
+    g_ulFrameShedFrames++;
     if (g_fDebugOutput) {
+      g_fDebugOutput = false;
+      g_fFrameDebugShed = true;
+    }
+  }
+  else if (g_fFrameDebugShed) {
+    g_fDebugOutput = true;
+    g_fFrameDebugShed = false;
+  }
+}
 
+//--------------------------------------------------------------------
+// FrameDeadlineCheck - Called when the frame's work is done, before it
+//      waits for the previous move of wMoveTime ms to end.
+//--------------------------------------------------------------------
+void FrameDeadlineCheck(word wMoveTime)
+{
+  unsigned long ulUsed;
+  unsigned long ulBudget = (unsigned long)wMoveTime * 1000;
 
-      DBGSerial.print("TY:");
-      DBGSerial.print(TotalYBal1,DEC); 
-      DBGSerial.print(" LFZ:");
-      DBGSerial.println(LegPosZ[cLF],DEC);
-      DBGSerial.flush();  // see if forcing it to output helps...
+  llTimerEnd = ClockMs();
+  CycleTime = (byte)min(llTimerEnd - llTimerStart, (int64_t)255);
+#ifdef OPT_CTRL_TICK
+  ulUsed = (unsigned long)(ClockUs() - (g_llCtrlTickBase + (int64_t)g_ulCtrlFrameTick * CTRL_TICK_US));
+#else
+  ulUsed = (unsigned long)(ClockUs() - g_llFrameStartUs);
+#endif
+  g_ulFrameChecks++;
+  if (ulUsed > g_ulFrameUsedMax)
+    g_ulFrameUsedMax = ulUsed;
+
+  if (ulUsed > ulBudget) {
+    g_ulFrameMisses++;
+    if ((ulUsed - ulBudget) > g_ulFrameOverMax)
+      g_ulFrameOverMax = ulUsed - ulBudget;
+    if (g_bFrameShed < FRAME_SHED_BALANCE)
+      g_bFrameShed++;
+    if (g_bFrameShed > g_bFrameShedMax)
+      g_bFrameShedMax = g_bFrameShed;
+    g_cFrameSpare = 0;
+  }
+  else if ((ulUsed * 100) < (ulBudget * FRAME_MARGIN_PCT)) {
+    if (g_bFrameShed && (++g_cFrameSpare >= FRAME_SHED_RECOVER)) {
+      g_bFrameShed--;
+      g_cFrameSpare = 0;
     }
+  }
+  else
+    g_cFrameSpare = 0;
+}
+
+void FrameDeadlineResetStats(void)
+{
+  g_ulFrameChecks = 0;
+  g_ulFrameMisses = 0;
+  g_ulFrameUsedMax = 0;
+  g_ulFrameOverMax = 0;
+  g_ulFrameShedFrames = 0;
+  g_bFrameShedMax = g_bFrameShed;
+}
+
+void PrintFrameDeadline(void)
+{
+  DBGSerial.print(F("Frames: "));
+  DBGSerial.print(g_ulFrameChecks, DEC);
+  DBGSerial.print(F(" Misses: "));
+  DBGSerial.print(g_ulFrameMisses, DEC);
+  DBGSerial.print(F(" Used max: "));
+  DBGSerial.print(g_ulFrameUsedMax, DEC);
+  DBGSerial.print(F("us Over max: "));
+  DBGSerial.print(g_ulFrameOverMax, DEC);
+  DBGSerial.print(F("us Shed frames: "));
+  DBGSerial.print(g_ulFrameShedFrames, DEC);
+  DBGSerial.print(F(" Shed level now/max: "));
+  DBGSerial.print(g_bFrameShed, DEC);
+  DBGSerial.print(F("/"));
+  DBGSerial.println(g_bFrameShedMax, DEC);
+}
+#endif // OPT_FRAME_DEADLINE
+
+//=============================================================================
+//[EMERGENCY STOP] Stops the robot without waiting for loop() to get around
+//      to it.  EStopTrigger can be called from any task, the input
+//      controller calls it from the Bluetooth task when the PS button is
+//      pressed while the robot is on.
+//      cEStopPin, if defined, is a button to ground that triggers it from
+//      an interrupt.  The e-stop task has the highest priority, it has the
+//      servo driver free the leg servos straight away (ServoDriver::EStop).
+//      Until the robot is turned on again no moves go to the SSC-32.  Whoever
+//      commits a move holds EStopLock from checking g_fEStopped until the
+//      commit is written, so a stop always comes after a whole move and no
+//      move can power the servos again after the stop.  loop()
+//      turns the robot off at the start of its next frame.  The latency
+//      is from the trigger until the last byte of the stop is on the wire.
+//      The X command shows it, X S fires a test stop.
+//=============================================================================
+#ifdef OPT_ESTOP
+#ifndef ESTOP_CORE
+#define ESTOP_CORE          CTRL_CORE   // Same core as loop() and the transport, so it preempts them
 #endif
-    // Only do commit if we are actually doing something...
-    DebugToggle(A2);
-    g_ServoDriver.CommitServoDriver(ServoMoveTime);
+#define ESTOP_PRIO          (configMAX_PRIORITIES - 1)
+
+TaskHandle_t            g_htaskEStop;
+SemaphoreHandle_t       g_hmtxEStop;        // Held over the stop, and over a commit and its check of g_fEStopped
+volatile boolean        g_fEStopped;        // Set by the e-stop task, cleared when the robot is turned on
+volatile boolean        g_fEStopPending;    // Triggered, the task has not sent the stop yet
+volatile int64_t        g_llEStopTrigger;   // esp_timer time of the trigger
+volatile unsigned long  g_ulEStops;         // Stops sent
+unsigned long           g_ulEStopsSeen;     // Stops loop() has turned the robot off for
+unsigned long           g_ulEStopUsLast;    // Latency statistics since the last X command
+unsigned long           g_ulEStopUsMin;
+unsigned long           g_ulEStopUsMax;
 
+//--------------------------------------------------------------------
+// EStopTrigger - Ask for a stop, from any task.  The first trigger
+//      sets the time the latency is counted from.
+//--------------------------------------------------------------------
+void EStopTrigger(void)
+{
+  if (!g_fEStopPending) {
+    g_llEStopTrigger = ClockUs();
+    g_fEStopPending = true;
+  }
+  if (g_htaskEStop)       // The controller may connect before setup() is done
+    xTaskNotifyGive(g_htaskEStop);
+}
 
-  } 
-  else {
-    //Turn the bot off - May need to add ajust here...
-    if (g_InControlState.fPrev_RobotOn || (AllDown= 0)) {
-      ServoMoveTime = 600;
-      StartUpdateServos();
-      g_ServoDriver.CommitServoDriver(ServoMoveTime);
-      MSound(3, 100, 2500, 80, 2250, 60, 2000);
-#ifdef USEXBEE            
-      XBeePlaySounds(3, 100, 2500, 80, 2250, 60, 2000);
-#endif    
-      lTimeWaitEnd = millis() + 600;    // setup to process background stuff while we wait...
-      do {
-        // Wait the appropriate time, call any background process while waiting...
-        DoBackgroundProcess();
-      } 
-      while (millis() < lTimeWaitEnd);
-      //delay(600);
-    } 
-    else {
-      g_ServoDriver.FreeServos();
-      Eyes = 0;
+//--------------------------------------------------------------------
+// EStopLock/EStopUnlock - Around the stop, and around checking g_fEStopped
+//      and writing a move's commit.  A stop waits for a commit already
+//      being written, at most one frame.
+//--------------------------------------------------------------------
+void EStopLock(void)
+{
+  if (g_hmtxEStop)        // Nothing to race with before EStopInit
+    xSemaphoreTake(g_hmtxEStop, portMAX_DELAY);
+}
+
+void EStopUnlock(void)
+{
+  if (g_hmtxEStop)
+    xSemaphoreGive(g_hmtxEStop);
+}
+
+#ifdef cEStopPin
+void IRAM_ATTR EStopISR(void)
+{
+  BaseType_t fWoken = pdFALSE;
+  if (!g_fEStopPending) {
+    g_llEStopTrigger = ClockUs();
+    g_fEStopPending = true;
+  }
+  vTaskNotifyGiveFromISR(g_htaskEStop, &fWoken);
+  portYIELD_FROM_ISR(fWoken);
+}
+#endif
+
+void EStopTask(void *pvArg)
+{
+  unsigned long ulUs;
+
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (!g_fEStopPending)
+      continue;
+    EStopLock();
+    g_fEStopped = true;
+    g_ServoDriver.EStop();
+    EStopUnlock();
+    ulUs = (unsigned long)(ClockUs() - g_llEStopTrigger);
+    g_ulEStopUsLast = ulUs;
+    if (ulUs < g_ulEStopUsMin)
+      g_ulEStopUsMin = ulUs;
+    if (ulUs > g_ulEStopUsMax)
+      g_ulEStopUsMax = ulUs;
+    g_ulEStops++;
+    g_fEStopPending = false;
+  }
+}
+
+void EStopResetStats(void)
+{
+  g_ulEStopUsMin = 0xffffffff;
+  g_ulEStopUsMax = 0;
+}
+
+//--------------------------------------------------------------------
+// EStopInit - Starts the task, after the servo driver is set up.
+//--------------------------------------------------------------------
+void EStopInit(void)
+{
+  EStopResetStats();
+  g_hmtxEStop = xSemaphoreCreateMutex();
+  xTaskCreatePinnedToCore(EStopTask, "phxestop", 2048, NULL, ESTOP_PRIO, &g_htaskEStop, ESTOP_CORE);
+#ifdef cEStopPin
+  pinMode(cEStopPin, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(cEStopPin), EStopISR, FALLING);
+#endif
+}
+
+//--------------------------------------------------------------------
+// EStopLatch - Called by loop() after the input, turns the robot off
+//      once for each stop.  The previous on state is dropped as well, so
+//      there is no power off move, the servos are already free.
+//--------------------------------------------------------------------
+void EStopLatch(void)
+{
+  if (g_ulEStopsSeen == g_ulEStops)
+    return;
+  g_ulEStopsSeen = g_ulEStops;
+#ifdef DBGSerial
+  DBGSerial.print(F("Emergency stop, us: "));
+  DBGSerial.println(g_ulEStopUsLast, DEC);
+#endif
+  g_InControlState.BodyPos.x = 0;
+  g_InControlState.BodyPos.y = 0;
+  g_InControlState.BodyPos.z = 0;
+  g_InControlState.BodyRot1.x = 0;
+  g_InControlState.BodyRot1.y = 0;
+  g_InControlState.BodyRot1.z = 0;
+  g_InControlState.TravelLength.x = 0;
+  g_InControlState.TravelLength.z = 0;
+#ifdef OPT_SINGLELEG
+  g_InControlState.TravelLength.y = 0;
+  g_InControlState.SelectedLeg = 255;
+#endif
+  g_InControlState.fRobotOn = false;
+  g_InControlState.fPrev_RobotOn = false;
+}
+
+void PrintEStop(void)
+{
+  DBGSerial.print(F("E-stops: "));
+  DBGSerial.print(g_ulEStops, DEC);
+  if (g_ulEStopUsMax) {
+    DBGSerial.print(F(" Latency us last/min/max: "));
+    DBGSerial.print(g_ulEStopUsLast, DEC);
+    DBGSerial.print(F("/"));
+    DBGSerial.print(g_ulEStopUsMin, DEC);
+    DBGSerial.print(F("/"));
+    DBGSerial.print(g_ulEStopUsMax, DEC);
+  }
+  DBGSerial.println();
+}
+#endif // OPT_ESTOP
+
+//=============================================================================
+//[CPU GOVERNOR] Sets the CPU clock to what the control loop needs.  Every
+//      GOV_WINDOW_FRAMES frames the load is measured: the part of the time
+//      loop() was not asleep in CtrlTickWait, so the background jobs count
+//      as load.  GovernorDecide then picks
+//      the clock from the load and what the robot is doing.  Walking needs
+//      at least GOV_WALK_LEVEL, walking with balance needs the top clock.
+//      It goes up as soon as the load at a clock would be over GOV_UP_PCT.
+//      It comes down one step at a time, only after GOV_DOWN_WINDOWS
+//      windows in a row where a lower clock would stay under GOV_DOWN_PCT.
+//      GovernorDecide only does arithmetic, so tools/gov_replay.cpp runs it
+//      on the host against load traces logged with the V L command.
+//=============================================================================
+#ifdef OPT_CPU_GOVERNOR
+#ifndef OPT_CTRL_TICK
+#error OPT_CPU_GOVERNOR needs OPT_CTRL_TICK
+#endif
+#define GOV_LEVELS          3
+#ifndef GOV_WINDOW_FRAMES
+#define GOV_WINDOW_FRAMES   10      // 200ms with the default tick
+#endif
+#ifndef GOV_UP_PCT
+#define GOV_UP_PCT          70
+#endif
+#ifndef GOV_DOWN_PCT
+#define GOV_DOWN_PCT        45
+#endif
+#ifndef GOV_DOWN_WINDOWS
+#define GOV_DOWN_WINDOWS    5
+#endif
+#define GOV_WALK_LEVEL      1
+
+// Below 80MHz the Bluetooth and the UARTs stop working right
+const word c_awGovMhz[GOV_LEVELS] = {80, 160, 240};
+
+enum {GOV_MODE_OFF, GOV_MODE_POSE, GOV_MODE_WALK, GOV_MODE_BALANCE};
+
+typedef struct _GovState {
+  byte          iLevel;             // Into c_awGovMhz
+  byte          cDownWindows;       // Windows in a row that a lower clock would do
+} GOVSTATE;
+
+GOVSTATE        g_gsCpu;
+byte            g_cGovFrames;       // Frames in the current window
+int64_t         g_llGovWindowStart;
+int64_t         g_llGovIdleUs;      // Slept in CtrlTickWait this window
+byte            g_bGovLoad;         // % of the last window
+boolean         g_fGovLog;          // V L, print a line per window
+unsigned long   g_aulGovWindows[GOV_LEVELS];    // Statistics since the last V command
+unsigned long   g_ulGovChanges;
+
+//--------------------------------------------------------------------
+// GovernorDecide - bLoadPct was measured at the clock pgs is at now, bMode
+//      is a GOV_MODE_.  Updates pgs and returns the clock to use, MHz.
+//--------------------------------------------------------------------
+word GovernorDecide(GOVSTATE *pgs, byte bLoadPct, byte bMode)
+{
+  byte iFloor = (bMode == GOV_MODE_BALANCE) ? (GOV_LEVELS - 1) : 
+                (bMode == GOV_MODE_WALK) ? GOV_WALK_LEVEL : 0;
+  byte iUp = GOV_LEVELS - 1;
+  byte iDown = GOV_LEVELS - 1;
+
+  // Lowest clocks the load would fit under each limit
+  for (byte i = GOV_LEVELS; i-- > 0; ) {
+    unsigned long ulLoad = ((unsigned long)bLoadPct * c_awGovMhz[pgs->iLevel]) / c_awGovMhz[i];
+    if (ulLoad <= GOV_UP_PCT)
+      iUp = i;
+    if (ulLoad <= GOV_DOWN_PCT)
+      iDown = i;
+  }
+  iUp = max(iUp, iFloor);
+  iDown = max(iDown, iFloor);
+
+  if (iUp > pgs->iLevel) {
+    pgs->iLevel = iUp;
+    pgs->cDownWindows = 0;
+  }
+  else if (iDown < pgs->iLevel) {
+    if (++pgs->cDownWindows >= GOV_DOWN_WINDOWS) {
+      pgs->iLevel--;
+      pgs->cDownWindows = 0;
     }
+  }
+  else
+    pgs->cDownWindows = 0;
+  return c_awGovMhz[pgs->iLevel];
+}
 
-    // Allow the Servo driver to do stuff durint our idle time
-    g_ServoDriver.IdleTime();
+void GovernorResetStats(void)
+{
+  memset(g_aulGovWindows, 0, sizeof(g_aulGovWindows));
+  g_ulGovChanges = 0;
+}
+
+void GovernorInit(void)
+{
+  g_gsCpu.iLevel = GOV_LEVELS - 1;
+  g_gsCpu.cDownWindows = 0;
+  setCpuFrequencyMhz(c_awGovMhz[g_gsCpu.iLevel]);
+  GovernorResetStats();
+  g_llGovWindowStart = ClockUs();
+}
+
+//--------------------------------------------------------------------
+// GovernorFrame - Called by CtrlTickFrame, once a frame.
+//--------------------------------------------------------------------
+void GovernorFrame(void)
+{
+  int64_t llNow;
+  int64_t llSpan;
+  byte bMode;
+  byte iLevel = g_gsCpu.iLevel;
+
+  if (++g_cGovFrames < GOV_WINDOW_FRAMES)
+    return;
+  llNow = ClockUs();
+  llSpan = llNow - g_llGovWindowStart;
+  g_bGovLoad = (llSpan > g_llGovIdleUs) ? (byte)(((llSpan - g_llGovIdleUs) * 100) / llSpan) : 0;
+
+  if (!g_InControlState.fRobotOn)
+    bMode = GOV_MODE_OFF;
+  else if (!fWalking && (abs(g_InControlState.TravelLength.x) <= cTravelDeadZone) && 
+      (abs(g_InControlState.TravelLength.z) <= cTravelDeadZone) && (abs(g_InControlState.TravelLength.y*2) <= cTravelDeadZone))
+    bMode = GOV_MODE_POSE;
+  else if (g_InControlState.BalanceMode)
+    bMode = GOV_MODE_BALANCE;
+  else
+    bMode = GOV_MODE_WALK;
+
+  if (g_fGovLog) {
+    DBGSerial.print(F("GOV "));
+    DBGSerial.print(g_bGovLoad, DEC);
+    DBGSerial.print(F(" "));
+    DBGSerial.print(bMode, DEC);
+    DBGSerial.print(F(" "));
+    DBGSerial.println(c_awGovMhz[iLevel], DEC);
+  }
+  g_aulGovWindows[iLevel]++;
+  GovernorDecide(&g_gsCpu, g_bGovLoad, bMode);
+  if (g_gsCpu.iLevel != iLevel) {
+    setCpuFrequencyMhz(c_awGovMhz[g_gsCpu.iLevel]);
+    g_ulGovChanges++;
+  }
+
+  g_cGovFrames = 0;
+  g_llGovIdleUs = 0;
+  g_llGovWindowStart = ClockUs();
+}
+
+void PrintGovernor(void)
+{
+  DBGSerial.print(F("CPU MHz: "));
+  DBGSerial.print(c_awGovMhz[g_gsCpu.iLevel], DEC);
+  DBGSerial.print(F(" Load: "));
+  DBGSerial.print(g_bGovLoad, DEC);
+  DBGSerial.print(F("% Windows"));
+  for (byte i = 0; i < GOV_LEVELS; i++) {
+    DBGSerial.print(F(" "));
+    DBGSerial.print(c_awGovMhz[i], DEC);
+    DBGSerial.print(F(":"));
+    DBGSerial.print(g_aulGovWindows[i], DEC);
+  }
+  DBGSerial.print(F(" Changes: "));
+  DBGSerial.println(g_ulGovChanges, DEC);
+}
+#endif // OPT_CPU_GOVERNOR
+
+//=============================================================================
+//[BOOT PROFILE] setup() marks the end of each of its steps and the first
+//      frame marks when the robot takes input.  The SSC-32 link is opened
+//      first, the Bluetooth stack comes up in a task on BOOT_BT_CORE while
+//      the rest of setup runs, and the fixed boot delays are gone.  The
+//      profile is printed when the first frame starts, the Bluetooth line
+//      shows when the controller stack was ready, which may be later.
+//=============================================================================
+#ifdef OPT_FAST_BOOT
+#ifndef BOOT_BT_CORE
+#ifdef CTRL_BT_CORE
+#define BOOT_BT_CORE        CTRL_BT_CORE
+#else
+#define BOOT_BT_CORE        0
+#endif
+#endif
+#define BOOT_STEPS          12
+
+typedef struct {
+  const char    *pszName;
+  int64_t       llTime;             // ClockUs() at the end of the step
+} BOOTSTEP;
+
+BOOTSTEP        g_aBootSteps[BOOT_STEPS];
+byte            g_cBootSteps;
+boolean         g_fBootShown;
+volatile int64_t g_llBootBTReady;   // Set by PS4BeginTask, 0 until then
+
+//-----------------------------------------------------------------------------
+// BootMark - A boot step is done.  Steps past BOOT_STEPS are dropped.
+//-----------------------------------------------------------------------------
+void BootMark(const char *pszName)
+{
+  if (g_cBootSteps < BOOT_STEPS) {
+    g_aBootSteps[g_cBootSteps].pszName = pszName;
+    g_aBootSteps[g_cBootSteps].llTime = ClockUs();
+    g_cBootSteps++;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// BootFirstFrame - Called at the start of every frame, the first one ends
+//      the boot.
+//-----------------------------------------------------------------------------
+void BootFirstFrame(void)
+{
+  if (g_fBootShown)
+    return;
+  BootMark("first frame");
+  g_fBootShown = true;
+  PrintBootProfile();
+}
+
+//-----------------------------------------------------------------------------
+// PrintBootProfile - Each step with its own time and the time since power on
+//-----------------------------------------------------------------------------
+void PrintBootProfile(void)
+{
+#ifdef DBGSerial
+  int64_t llPrev = 0;
+  DBGSerial.println(F("Boot profile: step us (ms since power on)"));
+  for (byte i = 0; i < g_cBootSteps; i++) {
+    DBGSerial.print(F("  "));
+    DBGSerial.print(g_aBootSteps[i].pszName);
+    DBGSerial.print(F(" "));
+    DBGSerial.print((long)(g_aBootSteps[i].llTime - llPrev), DEC);
+    DBGSerial.print(F(" ("));
+    DBGSerial.print((long)(g_aBootSteps[i].llTime / 1000), DEC);
+    DBGSerial.println(F(")"));
+    llPrev = g_aBootSteps[i].llTime;
+  }
+  DBGSerial.print(F("  bluetooth "));
+  if (g_llBootBTReady)
+    DBGSerial.println((long)(g_llBootBTReady / 1000), DEC);
+  else
+    DBGSerial.println(F("not ready yet"));
+#endif
+}
+#endif // OPT_FAST_BOOT
+
+
+//=============================================================================
+// Loop: the main arduino main Loop function
+//=============================================================================
+
+
+void loop(void)
+{
+  //Start time
+#ifdef OPT_CTRL_TICK
+  CtrlTickFrame();      // Wait for the tick this frame is due on
+#ifdef OPT_PIPELINE
+  PipelineFrameStart();
+#endif
+#else
+  int64_t llTimeWaitEnd;
+#endif
+  llTimerStart = ClockMs();
+#ifdef OPT_FRAME_DEADLINE
+  FrameShedStart();
+#endif
+#ifdef OPT_FAST_BOOT
+  BootFirstFrame();
+#endif
+#ifndef OPT_BG_JOBS      // Else it is a background job
+  DoBackgroundProcess();
+#endif
+  CheckVoltage();        // check our voltages, every frame, a low battery can not wait for slack
+  //Read input
+  if (!g_fLowVoltageShutdown) {
+    //    DebugWrite(A0, HIGH);
+    g_InputController.ControlInput();
+    //    DebugWrite(A0, LOW);
+  }
+#ifdef OPT_ESTOP
+  EStopLatch();         // The servos are already free if there was a stop
+#endif
+#ifdef OPT_INPUT_FEEDBACK
+  g_InputController.UpdateFeedback();   // Rumble and light bar steps
+#endif
+  WriteOutputs();        // Write Outputs
+
+#ifdef IsRobotUpsideDown
+    if (!fWalking){// dont do this while walking
+    g_fRobotUpsideDown = IsRobotUpsideDown;    // Grab the current state of the robot... 
+    if (g_fRobotUpsideDown != fRobotUpsideDownPrev) {
+      // Double check to make sure that it was not a one shot error
+      g_fRobotUpsideDown = IsRobotUpsideDown;    // Grab the current state of the robot... 
+      if (g_fRobotUpsideDown != fRobotUpsideDownPrev) {
+        fRobotUpsideDownPrev = g_fRobotUpsideDown;
+#ifdef DGBSerial        
+        DBGSerial.println(fRobotUpsideDownPrev, DEC);
+#endif        
+      }
+    }
+  }
+  //  DBGSerial.println(analogRead(0), DEC);
+#endif
+#ifdef OPT_WALK_UPSIDE_DOWN
+  if (g_fRobotUpsideDown){
+    g_InControlState.TravelLength.x = -g_InControlState.TravelLength.x;
+    g_InControlState.BodyPos.x = -g_InControlState.BodyPos.x;
+    g_InControlState.SLLeg.x = -g_InControlState.SLLeg.x;
+    g_InControlState.BodyRot1.z = -g_InControlState.BodyRot1.z;
+  }
+#endif
+
+#ifdef OPT_GPPLAYER
+    //GP Player
+#ifdef OPT_PIPELINE
+  if (g_ServoDriver.FIsGPSeqActive())
+    PipelineFlush();    // The player talks to the SSC-32 itself
+#endif
+  g_ServoDriver.GPPlayer();
+  if (g_ServoDriver.FIsGPSeqActive())
+    return;  // go back to process the next message
+#endif
+
+  //Single leg control
+  SingleLegControl ();
+#ifndef OPT_BG_JOBS
+  DoBackgroundProcess();
+#endif
+
+  //Gait
+  GaitSeq();
+
+#ifndef OPT_BG_JOBS
+  DoBackgroundProcess();
+#endif
+
+  //Balance calculations
+  TotalTransX = 0;     //reset values used for calculation of balance
+  TotalTransZ = 0;
+  TotalTransY = 0;
+  TotalXBal1 = 0;
+  TotalYBal1 = 0;
+  TotalZBal1 = 0;
+  
+#ifdef OPT_FRAME_DEADLINE
+  if (g_InControlState.BalanceMode && (g_bFrameShed < FRAME_SHED_BALANCE)) {
+#else
+  if (g_InControlState.BalanceMode) {
+#endif
+#ifdef DEBUG
+      if (g_fDebugOutput) {
+  TravelRequest = (abs(g_InControlState.TravelLength.x)>cTravelDeadZone) || (abs(g_InControlState.TravelLength.z)>cTravelDeadZone) 
+    || (abs(g_InControlState.TravelLength.y)>cTravelDeadZone) || (g_InControlState.ForceGaitStepCnt != 0) || fWalking;
+
+        DBGSerial.print("T("); 
+		DBGSerial.print(fWalking, DEC);
+		DBGSerial.print(" ");
+        DBGSerial.print(g_InControlState.TravelLength.x,DEC); 
+        DBGSerial.print(","); 
+        DBGSerial.print(g_InControlState.TravelLength.y,DEC); 
+        DBGSerial.print(","); 
+        DBGSerial.print(g_InControlState.TravelLength.z,DEC); 
+        DBGSerial.print(")"); 
+      }
+#endif
+    for (LegIndex = 0; LegIndex < (CNT_LEGS/2); LegIndex++) {    // balance calculations for all Right legs
+
+#ifndef OPT_BG_JOBS
+      DoBackgroundProcess();
+#endif
+      BalCalcOneLeg (-LegPosX[LegIndex]+GaitPosX[LegIndex], LegPosZ[LegIndex]+GaitPosZ[LegIndex], 
+          (LegPosY[LegIndex]-(short)pgm_read_word(&cInitPosY[LegIndex]))+GaitPosY[LegIndex], LegIndex);
+    }
+
+    for (LegIndex = (CNT_LEGS/2); LegIndex < CNT_LEGS; LegIndex++) {    // balance calculations for all Right legs
+#ifndef OPT_BG_JOBS
+      DoBackgroundProcess();
+#endif
+      BalCalcOneLeg(LegPosX[LegIndex]+GaitPosX[LegIndex], LegPosZ[LegIndex]+GaitPosZ[LegIndex], 
+          (LegPosY[LegIndex]-(short)pgm_read_word(&cInitPosY[LegIndex]))+GaitPosY[LegIndex], LegIndex);
+    }
+    BalanceBody();
+  }
+
+
+#ifdef OPT_STABILITY_MARGIN
+  // Support polygon of the feet on the ground, now that the balance translation is known
+  CalcStabilityMargin();
+#endif
+
+  //Reset IKsolution indicators 
+  IKSolution = 0 ;
+  IKSolutionWarning = 0; 
+  IKSolutionError = 0 ;
+
+  //Do IK for all legs
+#ifdef DEBUG
+    if (g_fDebugOutput && g_InControlState.fRobotOn) {
+        DBGSerial.print(g_InControlState.GaitStep,DEC);
+        DBGSerial.print(":");
+    }
+#endif
+#ifdef OPT_GAIT_CACHE
+  // Steady walking, the angles for this step may already be known
+  if (!GaitCacheLookup()) {
+#endif
+
+  CalcLegsIK();
+#ifdef OPT_GAIT_CACHE
+    GaitCacheStore();
+  }
+#endif
+#ifdef OPT_WALK_UPSIDE_DOWN
+  if (g_fRobotUpsideDown){ //Need to set them back for not messing with the SmoothControl
+    g_InControlState.BodyPos.x = -g_InControlState.BodyPos.x;
+    g_InControlState.SLLeg.x = -g_InControlState.SLLeg.x;
+    g_InControlState.BodyRot1.z = -g_InControlState.BodyRot1.z;
+  }
+#endif
+  //Check mechanical limits
+  CheckAngles();
+#ifdef OPT_ODOMETRY
+  // Integrate what the feet on the ground did to the body
+  if (g_InControlState.fRobotOn) {
+    OdometryUpdate();
+#ifdef DEBUG
+    if (g_fDebugOutput && fWalking && (g_InControlState.GaitStep == 1))
+      PrintOdometry();
+#endif
+  }
+#endif
+#ifdef OPT_GAIT_TRACE
+#ifdef OPT_FRAME_DEADLINE
+  if (g_InControlState.fRobotOn && (g_bFrameShed < FRAME_SHED_TELEMETRY))
+#else
+  if (g_InControlState.fRobotOn)
+#endif
+    TraceRecord();
+#endif
+
+  //Write IK errors to leds
+  LedC = IKSolutionWarning;
+  LedA = IKSolutionError;
+
+  //Drive Servos
+  if (g_InControlState.fRobotOn) {
+    if (g_InControlState.fRobotOn && !g_InControlState.fPrev_RobotOn) {
+#ifdef OPT_ESTOP
+      g_fEStopped = false;  // Turned on again, the SSC-32 may have our moves
+#endif
+      MSound(3, 60, 2000, 80, 2250, 100, 2500);
+#ifdef USEXBEE
+      XBeePlaySounds(3, 60, 2000, 80, 2250, 100, 2500);
+#endif            
+
+      Eyes = 1;
+    }
+
+    //Calculate Servo Move time
+    if ((abs(g_InControlState.TravelLength.x)>cTravelDeadZone) || (abs(g_InControlState.TravelLength.z)>cTravelDeadZone) ||
+      (abs(g_InControlState.TravelLength.y*2)>cTravelDeadZone)) {         
+      ServoMoveTime = g_InControlState.gaitCur.NomGaitSpeed + (g_InControlState.InputTimeDelay*2) + g_InControlState.SpeedControl;
+
+      //Add aditional delay when Balance mode is on
+#ifdef OPT_STABILITY_MARGIN
+      // but only when we are actually close to tipping
+      if (g_InControlState.BalanceMode && (g_sStabilityMargin < cStabilityMinMargin))
+#else
+      if (g_InControlState.BalanceMode)
+#endif
+        ServoMoveTime = ServoMoveTime + BALANCE_DELAY;
+    } 
+    else //Movement speed excl. Walking
+    ServoMoveTime = 200 + g_InControlState.SpeedControl;
+#ifdef OPT_PIPELINE
+    // Nothing but the bytes on the wire left between two moves
+    if (ServoMoveTime < g_wPipeWireMs)
+      ServoMoveTime = g_wPipeWireMs;
+#endif
+#ifdef OPT_CTRL_TICK
+    // Whole ticks, so the move ends on the tick the next frame starts on
+    ServoMoveTime = CtrlTickRoundMs(ServoMoveTime);
+#endif
+
+    // note we broke up the servo driver into start/commit that way we can output all of the servo information
+    // before we wait and only have the termination information to output after the wait.  That way we hopefully
+    // be more accurate with our timings...
+#ifndef OPT_BG_JOBS
+    DoBackgroundProcess();
+#endif
+    StartUpdateServos();
+
+    // See if we need to sync our processor with the servo driver while walking to ensure the prev is completed 
+    //before sending the next one
+
+
+    // Finding any incident of GaitPos/Rot <>0:
+    for (LegIndex = 0; LegIndex < CNT_LEGS; LegIndex++) {
+      if ( (GaitPosX[LegIndex] > cGPlimit) || (GaitPosX[LegIndex] < -cGPlimit)
+        || (GaitPosZ[LegIndex] > cGPlimit) || (GaitPosZ[LegIndex] < -cGPlimit) 
+        || (GaitRotY[LegIndex] > cGPlimit) || (GaitRotY[LegIndex] < -cGPlimit)
+#ifdef OPT_QUICK_START_STOP
+        || (GaitPosY[LegIndex] < 0)) {
+        // The stop planner puts the feet down itself, we only need one timed move after that
+        bExtraCycle = 2;
+#else
+        )    {
+
+        bExtraCycle = g_InControlState.gaitCur.NrLiftedPos + 1;//For making sure that we are using timed move until all legs are down
+#endif
+        break;
+      }
+    }
+    if (bExtraCycle>0){ 
+      bExtraCycle--;
+      fWalking = !(bExtraCycle==0);
+
+#ifdef OPT_FRAME_DEADLINE
+      FrameDeadlineCheck(PrevServoMoveTime);
+#endif
+      DebugWrite(A1, HIGH);
+#if defined(OPT_PIPELINE)
+      // The transport writes it on the tick the previous move ends on
+      g_pServoFrame->ulDueTick = CtrlTickMoveDue(PrevServoMoveTime);
+#elif defined(OPT_CTRL_TICK)
+      // Wait for the tick the previous move ends on
+      CtrlTickWaitMove(PrevServoMoveTime);
+#else
+      //Get endtime and calculate wait time
+      llTimeWaitEnd = llTimerStart + PrevServoMoveTime;
+
+      do {
+        // Wait the appropriate time, call any background process while waiting...
+        DoBackgroundProcess();
+      } 
+      while (ClockMs() < llTimeWaitEnd);
+#endif
+      DebugWrite(A1, LOW);
+#ifdef DEBUG_X
+      if (g_fDebugOutput) {
+
+        DBGSerial.print("BRX:");
+        DBGSerial.print(g_InControlState.BodyRot1.x,DEC); 
+        DBGSerial.print("W?:");
+         DBGSerial.print(fWalking,DEC);  
+         DBGSerial.print(" GS:");
+         DBGSerial.print(g_InControlState.GaitStep,DEC);  
+         //Debug LF leg
+         DBGSerial.print(" GPZ:");
+         DBGSerial.print(GaitPosZ[cLF],DEC);
+         DBGSerial.print(" GPY:");
+         DBGSerial.println(GaitPosY[cLF],DEC);
+      }
+#endif
+    }
+#ifdef DEBUG_X
+    if (g_fDebugOutput) {
+
+
+      DBGSerial.print("TY:");
+      DBGSerial.print(TotalYBal1,DEC); 
+      DBGSerial.print(" LFZ:");
+      DBGSerial.println(LegPosZ[cLF],DEC);
+      DBGSerial.flush();  // see if forcing it to output helps...
+    }
+#endif
+    // Only do commit if we are actually doing something...
+    DebugToggle(A2);
+    g_ServoDriver.CommitServoDriver(ServoMoveTime);
+#ifdef OPT_PIPELINE
+    PipelineSend();
+#endif
+
+
+  } 
+  else {
+    //Turn the bot off - May need to add ajust here...
+    if (g_InControlState.fPrev_RobotOn || (AllDown= 0)) {
+      ServoMoveTime = 600;
+      StartUpdateServos();
+      g_ServoDriver.CommitServoDriver(ServoMoveTime);
+#ifdef OPT_PIPELINE
+      PipelineSend();
+#endif
+      MSound(3, 100, 2500, 80, 2250, 60, 2000);
+#ifdef USEXBEE            
+      XBeePlaySounds(3, 100, 2500, 80, 2250, 60, 2000);
+#endif    
+#ifdef OPT_CTRL_TICK
+      CtrlTickWaitMove(600);
+#else
+      llTimeWaitEnd = ClockMs() + 600;    // setup to process background stuff while we wait...
+      do {
+        // Wait the appropriate time, call any background process while waiting...
+        DoBackgroundProcess();
+      } 
+      while (ClockMs() < llTimeWaitEnd);
+      //delay(600);
+#endif
+    } 
+    else {
+#ifdef OPT_PIPELINE
+      PipelineFlush();
+#endif
+      g_ServoDriver.FreeServos();
+      Eyes = 0;
+    }
+
+#ifdef OPT_PIPELINE
+    // The driver and the terminal monitor may talk to the SSC-32 themselves
+    PipelineFlush();
+#endif
+    // Allow the Servo driver to do stuff durint our idle time
+    g_ServoDriver.IdleTime();
+
+    // We also have a simple debug monitor that allows us to 
+    // check things. call it here..
+#if defined(OPT_TERMINAL_MONITOR) && !defined(OPT_BG_JOBS)  // Else it is a background job
+    if (TerminalMonitor())
+      return;           
+#endif
+#ifndef OPT_CTRL_TICK
+    ClockDelayMs(20);  // give a pause between times we call if nothing is happening
+#endif
+  }
+
+  PrevServoMoveTime = ServoMoveTime;
+
+  //Store previous g_InControlState.fRobotOn State
+  if (g_InControlState.fRobotOn)
+    g_InControlState.fPrev_RobotOn = 1;
+  else
+    g_InControlState.fPrev_RobotOn = 0;
+}
+
+
+void StartUpdateServos()
+{        
+  byte    LegIndex;
+
+  // First call off to the init...
+  g_ServoDriver.BeginServoUpdate();    // Start the update 
+
+    for (LegIndex = 0; LegIndex < CNT_LEGS; LegIndex++) {
+#ifdef c4DOF
+    g_ServoDriver.OutputServoInfoForLeg(LegIndex, 
+        cCoxaInv[LegIndex]? -CoxaAngle1[LegIndex] : CoxaAngle1[LegIndex], 
+        cFemurInv[LegIndex]? -FemurAngle1[LegIndex] : FemurAngle1[LegIndex], 
+        cTibiaInv[LegIndex]? -TibiaAngle1[LegIndex] : TibiaAngle1[LegIndex], 
+        cTarsInv[LegIndex]? -TarsAngle1[LegIndex] : TarsAngle1[LegIndex]);
+#else
+    g_ServoDriver.OutputServoInfoForLeg(LegIndex, 
+        cCoxaInv[LegIndex]? -CoxaAngle1[LegIndex] : CoxaAngle1[LegIndex], 
+        cFemurInv[LegIndex]? -FemurAngle1[LegIndex] : FemurAngle1[LegIndex], 
+        cTibiaInv[LegIndex]? -TibiaAngle1[LegIndex] : TibiaAngle1[LegIndex]);
+#endif      
+  }
+#ifdef cTurretRotPin
+  g_ServoDriver.OutputServoInfoForTurret(g_InControlState.TurretRotAngle1, g_InControlState.TurretTiltAngle1);  // fist just see if it will talk
+#endif  
+#ifdef OPT_SSC_FRAME_ASM
+  g_ServoDriver.EndServoUpdate();
+#endif
+}
+
+
+
+
+//--------------------------------------------------------------------
+//[WriteOutputs] Updates the state of the leds
+//--------------------------------------------------------------------
+void WriteOutputs(void)
+{
+#ifdef cEyesPin
+  digitalWrite(cEyesPin, Eyes);
+#endif        
+}
+//--------------------------------------------------------------------
+//[CHECK VOLTAGE]
+//Reads the input voltage and shuts down the bot when the power drops.
+//Never waits: it is a small state machine, the shutdown and the low
+//voltage beeps are due at a time and handled on a later call.  The
+//voltage has to stay under cTurnOffVol for cLVSagTime before the bot
+//shuts down, and has to come back above cTurnOnVol to turn it on again.
+#ifndef cLVSagTime
+#define cLVSagTime      200     // ms the voltage must stay low before we shut down
+#endif
+#ifndef cLVBeepTime
+#define cLVBeepTime     2000    // ms between the low voltage beeps
+#endif
+#ifndef cLVBeepCnt
+#define cLVBeepCnt      5       // how many times we beep once shut down
+#endif
+
+enum {LVS_OK, LVS_SAG, LVS_SHUTDOWN};
+byte s_bLVState;                // LVS_ state
+byte s_bLVBeepCnt;              // how many times we beeped...
+int64_t s_llLVDue;              // ClockMs() the next shutdown or beep is due
+
+boolean CheckVoltage() {
+#ifdef cTurnOffVol
+  // Moved to Servo Driver - BUGBUG: Need to do when I merge back...
+  //    Voltage = analogRead(cVoltagePin); // Battery voltage 
+  //    Voltage = ((long)Voltage*1955)/1000;
+  Voltage = g_ServoDriver.GetBatteryVoltage();
+
+  // BUGBUG:: if voltage is 0 it failed to retrieve don't hang program...
+  //    if (!Voltage)
+  //      return;
+  boolean fLow = (Voltage < cTurnOffVol) || (Voltage >= 1999);
+  int64_t llNow = ClockMs();
+
+  switch (s_bLVState) {
+  case LVS_OK:
+    if (fLow) {
+      s_bLVState = LVS_SAG;
+      s_llLVDue = llNow + cLVSagTime;
+    }
+    break;
+
+  case LVS_SAG:
+    if (!fLow) {
+      s_bLVState = LVS_OK;      // Only a dip, say while the servos start moving
+      break;
+    }
+    if (llNow < s_llLVDue)
+      break;
+#ifdef DBGSerial          
+    DBGSerial.print("Voltage went low, turn off robot ");
+    DBGSerial.println(Voltage, DEC);
+#endif            
+    //Turn off
+    g_InControlState.BodyPos.x = 0;
+    g_InControlState.BodyPos.y = 0;
+    g_InControlState.BodyPos.z = 0;
+    g_InControlState.BodyRot1.x = 0;
+    g_InControlState.BodyRot1.y = 0;
+    g_InControlState.BodyRot1.z = 0;
+    g_InControlState.TravelLength.x = 0;
+    g_InControlState.TravelLength.z = 0;
+
+#ifdef OPT_SINGLELEG
+    g_InControlState.TravelLength.y = 0;
+    g_InControlState.SelectedLeg = 255;
+#endif
+    g_fLowVoltageShutdown = 1;
+    g_InControlState.fRobotOn = false;
+    s_bLVState = LVS_SHUTDOWN;
+    s_bLVBeepCnt = 0;
+    s_llLVDue = llNow;          // First beep on the next call
+    break;
+
+  case LVS_SHUTDOWN:
+#ifdef cTurnOnVol
+    if ((Voltage > cTurnOnVol) && (Voltage < 1999)) {
+#ifdef DBGSerial
+      DBGSerial.print(F("Voltage restored: "));
+      DBGSerial.println(Voltage, DEC);
+#endif          
+      g_fLowVoltageShutdown = 0;
+      s_bLVState = LVS_OK;
+      break;
+    }
+#endif      
+    if ((s_bLVBeepCnt < cLVBeepCnt) && (llNow >= s_llLVDue)) {
+      s_bLVBeepCnt++;
+      s_llLVDue = llNow + cLVBeepTime;
+#ifdef DBGSerial
+      DBGSerial.println(Voltage, DEC);
+#endif          
+      MSound( 1, 45, 2000);
+    }
+    break;
+  }
+#endif	
+  return g_fLowVoltageShutdown;
+}
+
+//--------------------------------------------------------------------
+//[SINGLE LEG CONTROL]
+void SingleLegControl(void)
+{
+#ifdef OPT_SINGLELEG
+
+  //Check if all legs are down
+  AllDown = (LegPosY[cRF]==(short)pgm_read_word(&cInitPosY[cRF])) && 
+    (LegPosY[cRR]==(short)pgm_read_word(&cInitPosY[cRR])) && 
+    (LegPosY[cLR]==(short)pgm_read_word(&cInitPosY[cLR])) && 
+#ifndef QUADMODE
+    (LegPosY[cRM]==(short)pgm_read_word(&cInitPosY[cRM])) && 
+    (LegPosY[cLM]==(short)pgm_read_word(&cInitPosY[cLM])) && 
+#endif	
+    (LegPosY[cLF]==(short)pgm_read_word(&cInitPosY[cLF]));
+
+  if (g_InControlState.SelectedLeg<= (CNT_LEGS-1)) {
+    if (g_InControlState.SelectedLeg!=PrevSelectedLeg) {
+      if (AllDown) { //Lift leg a bit when it got selected
+        LegPosY[g_InControlState.SelectedLeg] = (short)pgm_read_word(&cInitPosY[g_InControlState.SelectedLeg])-20;
+
+        //Store current status
+        PrevSelectedLeg = g_InControlState.SelectedLeg;
+      } 
+      else {//Return prev leg back to the init position
+        LegPosX[PrevSelectedLeg] = (short)pgm_read_word(&cInitPosX[PrevSelectedLeg]);
+        LegPosY[PrevSelectedLeg] = (short)pgm_read_word(&cInitPosY[PrevSelectedLeg]);
+        LegPosZ[PrevSelectedLeg] = (short)pgm_read_word(&cInitPosZ[PrevSelectedLeg]);
+      }
+    } 
+    else if (!g_InControlState.fSLHold) {
+      //LegPosY[g_InControlState.SelectedLeg] = LegPosY[g_InControlState.SelectedLeg]+g_InControlState.SLLeg.y;
+      LegPosY[g_InControlState.SelectedLeg] = (short)pgm_read_word(&cInitPosY[g_InControlState.SelectedLeg])+g_InControlState.SLLeg.y;// Using DIY remote Zenta prefer it this way
+      LegPosX[g_InControlState.SelectedLeg] = (short)pgm_read_word(&cInitPosX[g_InControlState.SelectedLeg])+g_InControlState.SLLeg.x;
+      LegPosZ[g_InControlState.SelectedLeg] = (short)pgm_read_word(&cInitPosZ[g_InControlState.SelectedLeg])+g_InControlState.SLLeg.z;     
+    }
+  } 
+  else {//All legs to init position
+    if (!AllDown) {
+      for(LegIndex = 0; LegIndex <= (CNT_LEGS-1);LegIndex++) {
+        LegPosX[LegIndex] = (short)pgm_read_word(&cInitPosX[LegIndex]);
+        LegPosY[LegIndex] = (short)pgm_read_word(&cInitPosY[LegIndex]);
+        LegPosZ[LegIndex] = (short)pgm_read_word(&cInitPosZ[LegIndex]);
+      }
+    } 
+    if (PrevSelectedLeg!=255)
+      PrevSelectedLeg = 255;
+  }
+#endif
+}
+
+
+void GaitSelect(void)
+{
+  //Gait selector
+  // First pass simply use defined table, next up will allow robots to add or relace set...
+  if (g_InControlState.GaitType < CNT_BUILTIN_GAITS) {
+#ifdef ADD_GAITS
+    if (g_InControlState.GaitType < (sizeof(APG_EXTRA)/sizeof(APG_EXTRA[0])))
+        g_InControlState.gaitCur = APG_EXTRA[g_InControlState.GaitType];
+    else
+        g_InControlState.gaitCur = APG[g_InControlState.GaitType - (sizeof(APG_EXTRA)/sizeof(APG_EXTRA[0]))];
+#else
+    g_InControlState.gaitCur = APG[g_InControlState.GaitType];
+#endif
+  }
+#ifdef OPT_GAIT_STORE
+  else if (g_InControlState.GaitType < NUM_GAITS) {
+    GaitStoreGet(g_InControlState.GaitType - CNT_BUILTIN_GAITS, &g_InControlState.gaitCur);
+  }
+#endif
+
+#ifdef DBGSerial  
+  if (g_fDebugOutput) {
+    DBGSerial.print(g_InControlState.GaitType, DEC);
+    DBGSerial.print("    ");
+    PrintGait(&g_InControlState.gaitCur);
+  }  
+#endif  
+
+}    
+
+//--------------------------------------------------------------------
+//[PrintGait] Print a gait in the same form as the APG table entries
+//--------------------------------------------------------------------
+void PrintGait(PHOENIXGAIT *pgait)
+{
+#ifdef DBGSerial  
+  DBGSerial.print("{");
+  DBGSerial.print(pgait->NomGaitSpeed, DEC);
+  DBGSerial.print(", ");
+  DBGSerial.print(pgait->StepsInGait, DEC); 
+  DBGSerial.print(", ");
+  DBGSerial.print(pgait->NrLiftedPos, DEC); 
+  DBGSerial.print(", ");
+  DBGSerial.print(pgait->FrontDownPos, DEC);
+  DBGSerial.print(", ");
+  DBGSerial.print(pgait->LiftDivFactor, DEC);
+  DBGSerial.print(", ");
+  DBGSerial.print(pgait->TLDivFactor, DEC);  
+  DBGSerial.print(", ");
+  DBGSerial.print(pgait->HalfLiftHeight, DEC); 
+  DBGSerial.print(", {");
+  for (int il = 0; il < CNT_LEGS; il++) {
+    DBGSerial.print(pgait->GaitLegNr[il], DEC);
+    if (il < (CNT_LEGS-1))
+      DBGSerial.print(", ");
+  }
+#ifdef OPT_TRAVEL_BLEND
+  DBGSerial.print("}, ");
+  DBGSerial.print(pgait->TravelBlendDiv, DEC);
+  DBGSerial.println("}");
+#else
+  DBGSerial.println("}}");
+#endif
+#endif  
+}
+
+//--------------------------------------------------------------------
+//[ValidateGait] Sanity check a gait definition before we allow it to
+//      be used.  Gait() divides by some of these and indexes the steps by
+//      others, so a bad entry typed in at the terminal could hang or crash
+//      the robot instead of just walking funny.
+//--------------------------------------------------------------------
+#ifndef MAX_STEPS_IN_GAIT
+#define MAX_STEPS_IN_GAIT   48
+#endif
+
+boolean ValidateGait(PHOENIXGAIT *pgait, boolean fReport)
+{
+  const char *pszErr = NULL;
+
+  if ((pgait->StepsInGait < 4) || (pgait->StepsInGait > MAX_STEPS_IN_GAIT))
+    pszErr = "StepsInGait";
+  else if ((pgait->NrLiftedPos < 1) || (pgait->NrLiftedPos > 5) || ((pgait->NrLiftedPos+2) > pgait->StepsInGait))
+    pszErr = "NrLiftedPos";
+  else if ((pgait->FrontDownPos < 1) || (pgait->FrontDownPos >= pgait->StepsInGait))
+    pszErr = "FrontDownPos";
+  else if (!pgait->LiftDivFactor)
+    pszErr = "LiftDivFactor";
+  else if (!pgait->TLDivFactor || (pgait->TLDivFactor >= pgait->StepsInGait))
+    pszErr = "TLDivFactor";
+  else if (pgait->HalfLiftHeight > 10)
+    pszErr = "HalfLiftHeight";
+  else if (pgait->NomGaitSpeed < 0)
+    pszErr = "NomGaitSpeed";
+#ifdef OPT_TRAVEL_BLEND
+  else if (pgait->TravelBlendDiv > MAX_STEPS_IN_GAIT)
+    pszErr = "TravelBlendDiv";
+#endif
+  else {
+    for (byte il = 0; il < CNT_LEGS; il++) {
+      if ((pgait->GaitLegNr[il] < 1) || (pgait->GaitLegNr[il] > pgait->StepsInGait)) {
+        pszErr = "GaitLegNr";
+        break;
+      }
+    }
+  }
+#ifdef DBGSerial
+  if (pszErr && fReport) {
+    DBGSerial.print(F("Invalid gait: "));
+    DBGSerial.println(pszErr);
+  }
+#endif
+  return (pszErr == NULL);
+}
+
+//=============================================================================
+// Gait Store - Gaits that can be loaded, edited, saved and listed from the
+//      terminal monitor without reflashing.  They are kept in the ESP32 NVS
+//      using Preferences, one key per slot, and are added to the end of the
+//      built in gait table so the controller can select them as well.
+//=============================================================================
+#ifdef OPT_GAIT_STORE
+#include <Preferences.h>
+
+#ifndef MAX_STORED_GAITS
+#define MAX_STORED_GAITS    8
+#endif
+static_assert(MAX_STORED_GAITS <= 8, "g_bStoredGaitMask has one bit per slot in a byte");
+#define GAIT_STORE_NS       "phxgaits"
+#define GAIT_STORE_VERSION  2       // 2 added TravelBlendDiv
+
+// Size of the gait in a version 1 record, which ended before TravelBlendDiv
+#ifdef OPT_TRAVEL_BLEND
+#define GAIT_STORE_V1_SIZE  ((offsetof(PHOENIXGAIT, TravelBlendDiv) + alignof(PHOENIXGAIT) - 1) \
+                                / alignof(PHOENIXGAIT) * alignof(PHOENIXGAIT))
+#else
+#define GAIT_STORE_V1_SIZE  sizeof(PHOENIXGAIT)
+#endif
+
+typedef struct _StoredGaitRec {
+  byte          bVersion;
+  byte          bChecksum;           // Sum of the gait bytes
+  PHOENIXGAIT   gait;
+} STOREDGAITREC;
+
+PHOENIXGAIT     g_aStoredGaits[MAX_STORED_GAITS];
+byte            g_bStoredGaitMask;      // Which slots have a valid gait in them
+
+#ifdef DISPLAY_GAIT_NAMES
+extern "C" {
+  const char s_szGNStored[] PROGMEM = "Stored";
+};  
+#endif
+
+//--------------------------------------------------------------------
+// GaitStoreChecksum - simple sum of the first cb gait bytes
+//--------------------------------------------------------------------
+byte GaitStoreChecksum(PHOENIXGAIT *pgait, word cb)
+{
+  byte bSum = 0;
+  byte *pb = (byte*)pgait;
+  for (word i = 0; i < cb; i++)
+    bSum += *pb++;
+  return bSum;
+}
+
+//--------------------------------------------------------------------
+// GaitStoreRecOK - Check the version, size and checksum of a record read
+//      from NVS.  A version 1 record, saved before TravelBlendDiv was
+//      added, is brought up to date with the travel changed at once, as
+//      it was when that gait was saved.
+//--------------------------------------------------------------------
+boolean GaitStoreRecOK(STOREDGAITREC *prec, size_t cb)
+{
+  if ((prec->bVersion == GAIT_STORE_VERSION) && (cb == sizeof(STOREDGAITREC)))
+    return (prec->bChecksum == GaitStoreChecksum(&prec->gait, sizeof(PHOENIXGAIT)));
+  if ((prec->bVersion != 1) || (cb != offsetof(STOREDGAITREC, gait) + GAIT_STORE_V1_SIZE)
+      || (prec->bChecksum != GaitStoreChecksum(&prec->gait, GAIT_STORE_V1_SIZE)))
+    return false;
+#ifdef OPT_TRAVEL_BLEND
+  // What was the padding at the end of the old record
+  memset(&prec->gait.TravelBlendDiv, 0, sizeof(PHOENIXGAIT) - offsetof(PHOENIXGAIT, TravelBlendDiv));
+#endif
+  return true;
+}
+
+//--------------------------------------------------------------------
+// GaitStoreKey - NVS key for a slot: "g0", "g1"...
+//--------------------------------------------------------------------
+void GaitStoreKey(byte iSlot, char *pszKey)
+{
+  pszKey[0] = 'g';
+  pszKey[1] = '0' + iSlot;
+  pszKey[2] = '\0';
+}
+
+//--------------------------------------------------------------------
+// GaitStoreCountGaits - update NUM_GAITS after the slots change.
+//--------------------------------------------------------------------
+void GaitStoreCountGaits(void)
+{
+  NUM_GAITS = CNT_BUILTIN_GAITS;
+  for (byte iSlot = 0; iSlot < MAX_STORED_GAITS; iSlot++) {
+    if (g_bStoredGaitMask & (1 << iSlot))
+      NUM_GAITS++;
+  }
+}
+
+//--------------------------------------------------------------------
+// GaitStoreInit - Load all of the valid gaits from NVS.  Records that
+//      do not match our version, size or checksum, or that fail
+//      ValidateGait are ignored.
+//--------------------------------------------------------------------
+void GaitStoreInit(void)
+{
+  Preferences prefs;
+  STOREDGAITREC rec;
+  char szKey[4];
+  size_t cb;
+
+  g_bStoredGaitMask = 0;
+  if (prefs.begin(GAIT_STORE_NS, true)) {
+    for (byte iSlot = 0; iSlot < MAX_STORED_GAITS; iSlot++) {
+      GaitStoreKey(iSlot, szKey);
+      memset(&rec, 0, sizeof(rec));
+      cb = prefs.getBytesLength(szKey);
+      if ((cb <= sizeof(rec)) && (prefs.getBytes(szKey, &rec, cb) == cb)
+          && GaitStoreRecOK(&rec, cb)) {
+#ifdef DISPLAY_GAIT_NAMES
+        rec.gait.pszName = s_szGNStored;
+#endif
+        if (ValidateGait(&rec.gait, false)) {
+          g_aStoredGaits[iSlot] = rec.gait;
+          g_bStoredGaitMask |= (1 << iSlot);
+        }
+      }
+    }
+    prefs.end();
+  }
+  GaitStoreCountGaits();
+#ifdef DBGSerial
+  DBGSerial.print(F("Stored gaits: "));
+  DBGSerial.println(NUM_GAITS - CNT_BUILTIN_GAITS, DEC);
+#endif
+}
+
+//--------------------------------------------------------------------
+// GaitStoreSlotFromIndex - Convert the index of a stored gait (0 is the
+//      first one after the built in gaits) into its slot, 0xff if none.
+//--------------------------------------------------------------------
+byte GaitStoreSlotFromIndex(byte iStored)
+{
+  for (byte iSlot = 0; iSlot < MAX_STORED_GAITS; iSlot++) {
+    if (g_bStoredGaitMask & (1 << iSlot)) {
+      if (!iStored)
+        return iSlot;
+      iStored--;
+    }
+  }
+  return 0xff;
+}
+
+//--------------------------------------------------------------------
+// GaitStoreIndexFromSlot - The inverse, returns the GaitType to use.
+//--------------------------------------------------------------------
+byte GaitStoreIndexFromSlot(byte iSlot)
+{
+  byte iGait = CNT_BUILTIN_GAITS;
+  for (byte i = 0; i < iSlot; i++) {
+    if (g_bStoredGaitMask & (1 << i))
+      iGait++;
+  }
+  return iGait;
+}
+
+//--------------------------------------------------------------------
+// GaitStoreCurSlot - The slot the current GaitType is on, 0xff if it is
+//      a built in gait.  Taken before the slots change, so the GaitType
+//      can be moved with its slot after.
+//--------------------------------------------------------------------
+byte GaitStoreCurSlot(void)
+{
+  if (g_InControlState.GaitType < CNT_BUILTIN_GAITS)
+    return 0xff;
+  return GaitStoreSlotFromIndex(g_InControlState.GaitType - CNT_BUILTIN_GAITS);
+}
+
+//--------------------------------------------------------------------
+// GaitStoreGet - Used by GaitSelect to retrieve a stored gait
+//--------------------------------------------------------------------
+boolean GaitStoreGet(byte iStored, PHOENIXGAIT *pgait)
+{
+  byte iSlot = GaitStoreSlotFromIndex(iStored);
+  if (iSlot == 0xff)
+    return false;
+  *pgait = g_aStoredGaits[iSlot];
+  return true;
+}
+
+//--------------------------------------------------------------------
+// GaitStoreSave - validate and persist a gait into a slot
+//--------------------------------------------------------------------
+boolean GaitStoreSave(byte iSlot, PHOENIXGAIT *pgait)
+{
+  Preferences prefs;
+  STOREDGAITREC rec;
+  char szKey[4];
+  boolean fOK = false;
+
+  if ((iSlot >= MAX_STORED_GAITS) || !ValidateGait(pgait, true))
+    return false;
+
+  memset(&rec, 0, sizeof(rec));
+  rec.bVersion = GAIT_STORE_VERSION;
+  rec.gait = *pgait;
+#ifdef DISPLAY_GAIT_NAMES
+  rec.gait.pszName = NULL;      // Pointers mean nothing the next time we boot
+#endif
+  rec.bChecksum = GaitStoreChecksum(&rec.gait, sizeof(PHOENIXGAIT));
+
+  GaitStoreKey(iSlot, szKey);
+  if (prefs.begin(GAIT_STORE_NS, false)) {
+    fOK = (prefs.putBytes(szKey, &rec, sizeof(rec)) == sizeof(rec));
+    prefs.end();
+  }
+  if (fOK) {
+    byte iCurSlot = GaitStoreCurSlot();
+    g_aStoredGaits[iSlot] = *pgait;
+    g_bStoredGaitMask |= (1 << iSlot);
+    GaitStoreCountGaits();
+    // A new slot before the one we are on moves it up one
+    if (iCurSlot != 0xff)
+      g_InControlState.GaitType = GaitStoreIndexFromSlot(iCurSlot);
+  }
+  return fOK;
+}
+
+//--------------------------------------------------------------------
+// GaitStoreDelete - remove a slot
+//--------------------------------------------------------------------
+void GaitStoreDelete(byte iSlot)
+{
+  Preferences prefs;
+  char szKey[4];
+  byte iCurSlot;
+
+  if (iSlot >= MAX_STORED_GAITS)
+    return;
+  iCurSlot = GaitStoreCurSlot();
+  GaitStoreKey(iSlot, szKey);
+  if (prefs.begin(GAIT_STORE_NS, false)) {
+    prefs.remove(szKey);
+    prefs.end();
+  }
+  g_bStoredGaitMask &= ~(1 << iSlot);
+  GaitStoreCountGaits();
+
+  // If we were using this gait go back to the first one, a later stored
+  // gait moves down one
+  if (iCurSlot == iSlot) {
+    g_InControlState.GaitType = 0;
+    GaitSelect();
+  }
+  else if (iCurSlot != 0xff)
+    g_InControlState.GaitType = GaitStoreIndexFromSlot(iCurSlot);
+}
+#endif // OPT_GAIT_STORE
+
+//--------------------------------------------------------------------
+//[GAIT Sequence]
+void GaitSeq(void)
+{
+  //Check if the Gait is in motion - If not if we are going to start a motion try to align our Gaitstep to start with a good foot
+  // for the direction we are about to go...
+  
+  if (fWalking || (g_InControlState.ForceGaitStepCnt != 0))
+	TravelRequest = true;	// Is walking or was walking...
+  else {
+	TravelRequest = (abs(g_InControlState.TravelLength.x)>cTravelDeadZone) 
+		|| (abs(g_InControlState.TravelLength.z)>cTravelDeadZone) 
+		|| (abs(g_InControlState.TravelLength.y)>cTravelDeadZone) ;
+
+    if (TravelRequest) {
+#ifdef QUADCODE
+		// just start walking - Try to guess a good foot to start off on...
+		if (g_InControlState.TravelLength.z < 0) 
+            g_InControlState.GaitStep = ((g_InControlState.TravelLength.X < 0)? g_InControlState.gaitCur.GaitLegNr[cLR] : g_InControlState.gaitCur.GaitLegNr[cRR]);
+		else 
+            g_InControlState.GaitStep = ((g_InControlState.TravelLength.X < 0)? g_InControlState.gaitCur.GaitLegNr[cLF] : g_InControlState.gaitCur.GaitLegNr[cRF]);
+		// And lets backup a few Gaitsteps before this to allow it to start the up swing... 
+        g_InControlState.GaitStep = ((g_InControlState.GaitStep > g_InControlState.gaitCur.FrontDownPos)? (g_InControlState.GaitStep - g_InControlState.gaitCur.FrontDownPos) : (g_InControlState.GaitStep + g_InControlState.gaitCur.StepsInGait - g_InControlState.gaitCur.FrontDownPos);
+#elif defined(OPT_QUICK_START_STOP) && !defined(QUADMODE)
+		// Hexapod: start with the step where the trailing leg is lifted, not where ever the schedule was left
+		WalkStartStep();
+#endif
+    }
+    else {    //Clear values under the cTravelDeadZone
+      g_InControlState.TravelLength.x=0;
+      g_InControlState.TravelLength.z=0;
+      g_InControlState.TravelLength.y=0;//Gait NOT in motion, return to home position
+    } 
+  }
+
+#ifdef OPT_STRIDE_LIMIT
+  // Scale the travel back so every foot stays inside what LegIK can solve
+  if (TravelRequest)
+    StrideLimit();
+#endif
+
+#ifdef OPT_FREE_GAIT
+  // Decide if a leg should be lifted this step
+  if (g_InControlState.fFreeGait && TravelRequest)
+    FreeGaitPlan();
+#endif
+
+#ifdef OPT_TRAVEL_BLEND
+  // Move the body travel towards the commanded one
+  TravelBlend();
+#endif
+
+#ifdef OPT_ODOMETRY
+  g_bOdoStanceLegs = 0;     // Gait() marks the legs that pushed the body this step
+#endif
+
+#ifdef OPT_QUICK_START_STOP
+  // Travel was released, put the feet straight back home instead of finishing the gait cycle
+  if (WalkStopStep())
+    return;
+#endif
+
+  //Calculate Gait sequence
+  for (LegIndex = 0; LegIndex < CNT_LEGS; LegIndex++) { // for all legs
+    Gait(LegIndex);
+  }    // next leg
+
+#ifdef OPT_FREE_GAIT
+  if (g_InControlState.fFreeGait)
+    FreeGaitAdvance();
+#endif
+
+  //Advance to the next step
+  g_InControlState.GaitStep++;
+  if (g_InControlState.GaitStep>g_InControlState.gaitCur.StepsInGait)
+    g_InControlState.GaitStep = 1;
+
+  // If we have a force count decrement it now... 
+  if (g_InControlState.ForceGaitStepCnt)
+    g_InControlState.ForceGaitStepCnt--;
+}
+
+//--------------------------------------------------------------------
+//[TRAVEL BLEND] A change of TravelLength is not handed to the legs at
+//      once, as that makes the feet on the ground jump to a new speed.  The
+//      body travel moves towards the commanded one, spread over
+//      TravelBlendDiv steps of the gait.  All the feet on the ground push
+//      with that one travel, so they keep their places relative to each
+//      other and do not slip.  Only the lifted legs aim for the front down
+//      point of the commanded travel, so they land where the new speed
+//      wants them.
+//--------------------------------------------------------------------
+#ifdef OPT_TRAVEL_BLEND
+short TravelBlendOne(short sBody, short sCmd, short sDiv)
+{
+  short sDiff = sCmd - sBody;
+  // Round away from zero so small differences still get there
+  if (sDiff > 0)
+    return sBody + (sDiff + sDiv - 1) / sDiv;
+  return sBody + (sDiff - sDiv + 1) / sDiv;
+}
+
+void TravelBlend(void)
+{
+  short   sDiv = g_InControlState.gaitCur.TravelBlendDiv;
+
+#ifdef OPT_FREE_GAIT
+  if (g_InControlState.fFreeGait && g_fFreeGaitHold)
+    sDiv = 0;             // A foot is out of stroke, the body has to stop now
+#endif
+  if (!TravelRequest || (sDiv <= 1)) {
+    // Not walking, the feet go home with no travel at all
+    g_sBlendTravelX = g_InControlState.TravelLength.x;
+    g_sBlendTravelZ = g_InControlState.TravelLength.z;
+    g_sBlendTravelY = g_InControlState.TravelLength.y;
+  }
+  else {
+    g_sBlendTravelX = TravelBlendOne(g_sBlendTravelX, g_InControlState.TravelLength.x, sDiv);
+    g_sBlendTravelZ = TravelBlendOne(g_sBlendTravelZ, g_InControlState.TravelLength.z, sDiv);
+    g_sBlendTravelY = TravelBlendOne(g_sBlendTravelY, g_InControlState.TravelLength.y, sDiv);
+  }
+  g_fTravelBlending = (g_sBlendTravelX != g_InControlState.TravelLength.x) 
+      || (g_sBlendTravelZ != g_InControlState.TravelLength.z) || (g_sBlendTravelY != g_InControlState.TravelLength.y);
+}
+#endif // OPT_TRAVEL_BLEND
+
+
+//--------------------------------------------------------------------
+//[GAIT TRACE] Recorder of what the gait did, one record per frame kept in
+//      a RAM ring so it does not slow the loop down.  The R command dumps it
+//      as hex text lines which tools/gait_trace.cpp decodes on the host.
+//--------------------------------------------------------------------
+#ifdef OPT_GAIT_TRACE
+#ifndef TRACE_RECORDS
+#define TRACE_RECORDS           96      // ~12K of RAM with 6 3DOF legs
+#endif
+#define TRACE_VERSION           1
+#ifdef c4DOF
+#define TRACE_DOF               4
+#else
+#define TRACE_DOF               3
+#endif
+
+typedef struct _TraceRec {
+  unsigned long lTime;                          // millis at the start of the frame
+  word          wMoveTime;                      // ServoMoveTime used for the frame
+  byte          bGaitType;
+  byte          bGaitStep;                      // Next GaitStep, as left by GaitSeq
+  byte          bClampedLegs;                   // g_bClampedLegs
+  byte          abIKFlags[CNT_LEGS];            // g_abLegIKFlags
+  short         asGaitPos[CNT_LEGS][4];         // GaitPosX, GaitPosY, GaitPosZ, GaitRotY
+  short         asLegPos[CNT_LEGS][3];          // LegPosX, LegPosY, LegPosZ
+  short         asAngle1[CNT_LEGS][TRACE_DOF];  // Coxa, Femur, Tibia (, Tars) after CheckAngles
+} TRACEREC;
+
+TRACEREC        g_aTrace[TRACE_RECORDS];
+word            g_wTraceHead;                   // Next record to write
+word            g_wTraceCount;                  // Records in the ring
+boolean         g_fTraceOn;
+
+//--------------------------------------------------------------------
+// TraceRecord - Called from the main loop once the angles are final.
+//--------------------------------------------------------------------
+void TraceRecord(void)
+{
+  TRACEREC *ptr;
+
+  if (!g_fTraceOn)
+    return;
+  ptr = &g_aTrace[g_wTraceHead];
+  ptr->lTime = (unsigned long)llTimerStart;
+  ptr->wMoveTime = ServoMoveTime;
+  ptr->bGaitType = g_InControlState.GaitType;
+  ptr->bGaitStep = g_InControlState.GaitStep;
+  ptr->bClampedLegs = g_bClampedLegs;
+  for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++) {
+    ptr->abIKFlags[LegNr] = g_abLegIKFlags[LegNr];
+    ptr->asGaitPos[LegNr][0] = GaitPosX[LegNr];
+    ptr->asGaitPos[LegNr][1] = GaitPosY[LegNr];
+    ptr->asGaitPos[LegNr][2] = GaitPosZ[LegNr];
+    ptr->asGaitPos[LegNr][3] = GaitRotY[LegNr];
+    ptr->asLegPos[LegNr][0] = LegPosX[LegNr];
+    ptr->asLegPos[LegNr][1] = LegPosY[LegNr];
+    ptr->asLegPos[LegNr][2] = LegPosZ[LegNr];
+    ptr->asAngle1[LegNr][0] = CoxaAngle1[LegNr];
+    ptr->asAngle1[LegNr][1] = FemurAngle1[LegNr];
+    ptr->asAngle1[LegNr][2] = TibiaAngle1[LegNr];
+#ifdef c4DOF
+    ptr->asAngle1[LegNr][3] = TarsAngle1[LegNr];
+#endif
+  }
+  if (++g_wTraceHead >= TRACE_RECORDS)
+    g_wTraceHead = 0;
+  if (g_wTraceCount < TRACE_RECORDS)
+    g_wTraceCount++;
+}
+#endif // OPT_GAIT_TRACE
+
+//--------------------------------------------------------------------
+//[WALK START/STOP] Shorten the time between the stick and the feet moving.
+//      On start the gait step is set so that the leg at the back of the
+//      direction of travel is lifted right away.  On stop, the feet that are
+//      not home are lifted straight back home, in the groups the gait lifts
+//      together anyway, one group every two steps (up and down).
+//--------------------------------------------------------------------
+#ifdef OPT_QUICK_START_STOP
+byte            g_bStopWaveLegs;        // Legs lifted by the stop planner, put down the next step
+
+//--------------------------------------------------------------------
+// WalkStartStep - Called by GaitSeq when travel starts from standing.
+//--------------------------------------------------------------------
+void WalkStartStep(void)
+{
+  long    lDot;
+  long    lBest = 0;
+  byte    iBest = 0xff;
+  short   sStep;
+
+  // Trailing leg, the one with the foot furthest back along the travel vector
+  for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++) {
+    long lBX = (short)pgm_read_word(&cOffsetX[LegNr]) + ((LegNr < (CNT_LEGS/2))? -LegPosX[LegNr] : LegPosX[LegNr]);
+    long lBZ = (short)pgm_read_word(&cOffsetZ[LegNr]) + LegPosZ[LegNr];
+    lDot = lBX * g_InControlState.TravelLength.x + lBZ * g_InControlState.TravelLength.z;
+    if ((iBest == 0xff) || (lDot < lBest)) {
+      iBest = LegNr;
+      lBest = lDot;
+    }
+  }
+  if (!(g_InControlState.TravelLength.x || g_InControlState.TravelLength.z))
+    iBest = 0;        // Only rotating, any leg will do
+
+  // First lifted position of that leg, rear half height when there is one
+  sStep = g_InControlState.gaitCur.GaitLegNr[iBest] - ((g_InControlState.gaitCur.NrLiftedPos - 1) / 2);
+  if (sStep < 1)
+    sStep += g_InControlState.gaitCur.StepsInGait;
+  g_InControlState.GaitStep = sStep;
+}
+
+//--------------------------------------------------------------------
+// WalkStopStep - Called by GaitSeq, returns true if it took care of the
+//      legs for this step.  Only active when we are still walking but the
+//      travel is back inside the dead zone.
+//--------------------------------------------------------------------
+boolean WalkStopStep(void)
+{
+  byte    iBest = 0xff;
+  short   sBest = 0;
+  byte    bGroup;
+
+  if (!fWalking || (g_InControlState.ForceGaitStepCnt != 0)
+      || (abs(g_InControlState.TravelLength.x)>cTravelDeadZone) 
+      || (abs(g_InControlState.TravelLength.z)>cTravelDeadZone) 
+      || (abs(g_InControlState.TravelLength.y)>cTravelDeadZone)) {
+    g_bStopWaveLegs = 0;
+    return false;
+  }
+#ifdef OPT_FREE_GAIT
+  if (g_InControlState.fFreeGait)
+    return false;     // Free gait brings its feet home by itself
+#endif
+
+  // Put down the ones lifted last step
+  if (g_bStopWaveLegs) {
+    for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++)
+      if (g_bStopWaveLegs & (1 << LegNr))
+        GaitPosY[LegNr] = 0;
+    g_bStopWaveLegs = 0;
+    return true;
+  }
+
+  // Also put down any foot the gait had in the air, then pick the group
+  // with the foot that is furthest from home
+  for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++) {
+    short sOff = abs(GaitPosX[LegNr]) + abs(GaitPosZ[LegNr]) + abs(GaitRotY[LegNr]);
+    if ((sOff > cGPlimit) && ((iBest == 0xff) || (sOff > sBest))) {
+      iBest = LegNr;
+      sBest = sOff;
+    }
+  }
+  if (iBest == 0xff) {
+    for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++)
+      GaitPosY[LegNr] = 0;
+    return true;
+  }
+
+  bGroup = g_InControlState.gaitCur.GaitLegNr[iBest];
+  for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++) {
+    if ((g_InControlState.gaitCur.GaitLegNr[LegNr] == bGroup) && 
+        ((abs(GaitPosX[LegNr]) > cGPlimit) || (abs(GaitPosZ[LegNr]) > cGPlimit) || (abs(GaitRotY[LegNr]) > cGPlimit))) {
+      GaitPosX[LegNr] = 0;
+      GaitPosY[LegNr] = -g_InControlState.LegLiftHeight;
+      GaitPosZ[LegNr] = 0;
+      GaitRotY[LegNr] = 0;
+      g_bStopWaveLegs |= (1 << LegNr);
+    }
+    else if (GaitPosY[LegNr] < 0) 
+      GaitPosY[LegNr] = 0;
+  }
+  return true;
+}
+#endif // OPT_QUICK_START_STOP
+
+#if defined(OPT_GAIT_CACHE) || defined(OPT_STRIDE_LIMIT)
+//--------------------------------------------------------------------
+// Coord3DEqual, GaitEqual - Field by field compares, for the keys of what
+//      was calculated from a gait.
+//--------------------------------------------------------------------
+boolean Coord3DEqual(COORD3D *pc1, COORD3D *pc2)
+{
+  return (pc1->x == pc2->x) && (pc1->y == pc2->y) && (pc1->z == pc2->z);
+}
+
+boolean GaitEqual(PHOENIXGAIT *pg1, PHOENIXGAIT *pg2)
+{
+  if ((pg1->NomGaitSpeed != pg2->NomGaitSpeed) || (pg1->StepsInGait != pg2->StepsInGait)
+      || (pg1->NrLiftedPos != pg2->NrLiftedPos) || (pg1->FrontDownPos != pg2->FrontDownPos)
+      || (pg1->LiftDivFactor != pg2->LiftDivFactor) || (pg1->TLDivFactor != pg2->TLDivFactor)
+      || (pg1->HalfLiftHeight != pg2->HalfLiftHeight))
+    return false;
+#ifdef QUADMODE
+  if ((pg1->COGAngleStart1 != pg2->COGAngleStart1) || (pg1->COGAngleStep1 != pg2->COGAngleStep1)
+      || (pg1->COGRadius != pg2->COGRadius) || (pg1->COGCCW != pg2->COGCCW))
+    return false;
+#endif
+#ifdef OPT_TRAVEL_BLEND
+  if (pg1->TravelBlendDiv != pg2->TravelBlendDiv)
+    return false;
+#endif
+  return !memcmp(pg1->GaitLegNr, pg2->GaitLegNr, sizeof(pg1->GaitLegNr));
+}
+#endif
+
+//--------------------------------------------------------------------
+//[GAIT CACHE] Baked keyframes for the gait we are walking.  With the same
+//      gait, travel, lift height and body pose, every GaitStep ends up with
+//      the same joint angles each cycle, so once a full cycle has been
+//      walked the angles of each step are kept and BodyFK/LegIK are skipped
+//      the next time that step comes around.  Gait() and the balance code
+//      still run, only the IK result is looked up.  The servo driver still
+//      interpolates between the keyframes as it does between IK results.
+//      The key holds the inputs themselves, the travel exactly as it is
+//      walked, so a hit gives the angles the IK would have given and
+//      GaitPos, odometry and the trace stay in step with the servos.  Any
+//      change of the travel flushes it, it pays off at a steady stick.
+//--------------------------------------------------------------------
+#ifdef OPT_GAIT_CACHE
+typedef struct _GaitKeyFrame {
+  short         aCoxaAngle1[CNT_LEGS];
+  short         aFemurAngle1[CNT_LEGS];
+  short         aTibiaAngle1[CNT_LEGS];
+#ifdef c4DOF
+  short         aTarsAngle1[CNT_LEGS];
+#endif
+  byte          abIKFlags[CNT_LEGS];    // What LegIK put in g_abLegIKFlags
+} GAITKEYFRAME;
+
+typedef struct _GaitCacheKey {
+  boolean       fValid;
+  byte          GaitType;
+  PHOENIXGAIT   gait;                   // Catches gait edits from the terminal
+  COORD3D       TravelLength;
+  short         sLiftHeight;
+  COORD3D       BodyPos;
+  COORD3D       BodyRot1;
+  COORD3D       BodyRotOffset;
+  boolean       BalanceMode;
+  boolean       fUpsideDown;
+  short         aLegPosX[CNT_LEGS];
+  short         aLegPosY[CNT_LEGS];
+  short         aLegPosZ[CNT_LEGS];
+} GAITCACHEKEY;
+
+GAITKEYFRAME    g_aGaitKeyFrames[MAX_STEPS_IN_GAIT];
+GAITCACHEKEY    g_GaitCacheKey;
+unsigned long long g_ullGaitCacheFilled;        // Bit per step that has a keyframe
+byte            g_bGaitCacheWarm;               // Steps walked with the current key
+byte            g_bGaitCacheStep;               // Step of the current frame, 0 if not cachable
+unsigned long   g_ulGaitCacheHits;
+unsigned long   g_ulGaitCacheMisses;
+unsigned long   g_ulGaitCacheFlushes;
+
+//--------------------------------------------------------------------
+// GaitCacheKeyUpdate - Compare the key with what we walk with now, field
+//      by field, and take over the new values.  Returns true if any of
+//      them changed.
+//--------------------------------------------------------------------
+boolean GaitCacheKeyUpdate(GAITCACHEKEY *pkey)
+{
+  boolean fChanged = !pkey->fValid
+    || (pkey->GaitType != g_InControlState.GaitType)
+    || !GaitEqual(&pkey->gait, &g_InControlState.gaitCur)
+    || !Coord3DEqual(&pkey->TravelLength, &g_InControlState.TravelLength)
+    || (pkey->sLiftHeight != g_InControlState.LegLiftHeight)
+    || !Coord3DEqual(&pkey->BodyPos, &g_InControlState.BodyPos)
+    || !Coord3DEqual(&pkey->BodyRot1, &g_InControlState.BodyRot1)
+    || !Coord3DEqual(&pkey->BodyRotOffset, &g_InControlState.BodyRotOffset)
+    || (pkey->BalanceMode != g_InControlState.BalanceMode)
+#ifdef OPT_WALK_UPSIDE_DOWN
+    || (pkey->fUpsideDown != g_fRobotUpsideDown)
+#endif
+    || memcmp(pkey->aLegPosX, LegPosX, sizeof(LegPosX))
+    || memcmp(pkey->aLegPosY, LegPosY, sizeof(LegPosY))
+    || memcmp(pkey->aLegPosZ, LegPosZ, sizeof(LegPosZ));
+  if (!fChanged)
+    return false;
+
+  pkey->fValid = true;
+  pkey->GaitType = g_InControlState.GaitType;
+  pkey->gait = g_InControlState.gaitCur;
+  pkey->TravelLength = g_InControlState.TravelLength;
+  pkey->sLiftHeight = g_InControlState.LegLiftHeight;
+  pkey->BodyPos = g_InControlState.BodyPos;
+  pkey->BodyRot1 = g_InControlState.BodyRot1;
+  pkey->BodyRotOffset = g_InControlState.BodyRotOffset;
+  pkey->BalanceMode = g_InControlState.BalanceMode;
+#ifdef OPT_WALK_UPSIDE_DOWN
+  pkey->fUpsideDown = g_fRobotUpsideDown;
+#endif
+  memcpy(pkey->aLegPosX, LegPosX, sizeof(LegPosX));
+  memcpy(pkey->aLegPosY, LegPosY, sizeof(LegPosY));
+  memcpy(pkey->aLegPosZ, LegPosZ, sizeof(LegPosZ));
+  return true;
+}
+
+//--------------------------------------------------------------------
+// GaitCacheLookup - Called from the main loop in place of BodyFK/LegIK.
+//      Returns true if the angles and IK flags were filled in from the cache.
+//--------------------------------------------------------------------
+boolean GaitCacheLookup(void)
+{
+  byte            iStep;
+
+  g_bGaitCacheStep = 0;
+
+  // Only steady, periodic walking can be cached
+  if (!g_InControlState.fRobotOn || !TravelRequest || (g_InControlState.ForceGaitStepCnt != 0)
+      || !((abs(g_InControlState.TravelLength.x)>cTravelDeadZone) 
+      || (abs(g_InControlState.TravelLength.z)>cTravelDeadZone) 
+      || (abs(g_InControlState.TravelLength.y)>cTravelDeadZone)))
+    return false;
+#ifdef OPT_FREE_GAIT
+  if (g_InControlState.fFreeGait)
+    return false;
+#endif
+#ifdef OPT_TRAVEL_BLEND
+  if (g_fTravelBlending)
+    return false;     // The body is still on its way to the new travel
+#endif
+#ifdef OPT_SINGLELEG
+  if (g_InControlState.SelectedLeg <= (CNT_LEGS-1))
+    return false;
+#endif
+
+  if (GaitCacheKeyUpdate(&g_GaitCacheKey)) {
+    if (g_ullGaitCacheFilled)
+      g_ulGaitCacheFlushes++;
+    g_ullGaitCacheFilled = 0;
+    g_bGaitCacheWarm = 0;
+  }
+
+  // GaitSeq has already moved GaitStep on to the next step
+  iStep = (g_InControlState.GaitStep > 1)? g_InControlState.GaitStep - 1 : g_InControlState.gaitCur.StepsInGait;
+  if ((iStep < 1) || (iStep > MAX_STEPS_IN_GAIT))
+    return false;
+  g_bGaitCacheStep = iStep;
+
+  if (g_ullGaitCacheFilled & (1ULL << (iStep - 1))) {
+    GAITKEYFRAME *pkf = &g_aGaitKeyFrames[iStep - 1];
+    for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++) {
+      CoxaAngle1[LegNr] = pkf->aCoxaAngle1[LegNr];
+      FemurAngle1[LegNr] = pkf->aFemurAngle1[LegNr];
+      TibiaAngle1[LegNr] = pkf->aTibiaAngle1[LegNr];
+#ifdef c4DOF
+      TarsAngle1[LegNr] = pkf->aTarsAngle1[LegNr];
+#endif
+      g_abLegIKFlags[LegNr] = pkf->abIKFlags[LegNr];
+      if (pkf->abIKFlags[LegNr] & 1)
+        IKSolution = 1;
+      if (pkf->abIKFlags[LegNr] & 2)
+        IKSolutionWarning = 1;
+      if (pkf->abIKFlags[LegNr] & 4)
+        IKSolutionError = 1;
+    }
+    g_ulGaitCacheHits++;
+    return true;
+  }
+  g_ulGaitCacheMisses++;
+  return false;
+}
+
+//--------------------------------------------------------------------
+// GaitCacheStore - Called after the IK was calculated for a step that was
+//      not in the cache.  Steps are only kept once every leg has done a
+//      full cycle with the current key, before that the feet may still be
+//      where the previous travel left them.
+//--------------------------------------------------------------------
+void GaitCacheStore(void)
+{
+  if (!g_bGaitCacheStep)
+    return;
+  if (g_bGaitCacheWarm < g_InControlState.gaitCur.StepsInGait) {
+    g_bGaitCacheWarm++;
+    return;
+  }
+
+  GAITKEYFRAME *pkf = &g_aGaitKeyFrames[g_bGaitCacheStep - 1];
+  for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++) {
+    pkf->aCoxaAngle1[LegNr] = CoxaAngle1[LegNr];
+    pkf->aFemurAngle1[LegNr] = FemurAngle1[LegNr];
+    pkf->aTibiaAngle1[LegNr] = TibiaAngle1[LegNr];
+#ifdef c4DOF
+    pkf->aTarsAngle1[LegNr] = TarsAngle1[LegNr];
+#endif
+    pkf->abIKFlags[LegNr] = g_abLegIKFlags[LegNr];
+  }
+  g_ullGaitCacheFilled |= (1ULL << (g_bGaitCacheStep - 1));
+}
+#endif // OPT_GAIT_CACHE
+
+//--------------------------------------------------------------------
+//[ODOMETRY] Dead reckoning from the stance legs.  Every foot on the ground
+//      that Gait() moves back pushes the body forward by the same amount, so
+//      the body motion of a step is the average over those feet.  Legs that
+//      CheckAngles had to clamp did not get where GaitPos wanted them and are
+//      left out, if all of them were clamped we assume the body did not move.
+//      Position is in mm in the same axes as TravelLength, but turned with
+//      the heading so it is relative to where the robot was when reset.
+//--------------------------------------------------------------------
+#ifdef OPT_ODOMETRY
+byte            g_bOdoStanceLegs;               // Legs that were pushing this step
+short           g_asOdoDX[CNT_LEGS];            // What each of them did
+short           g_asOdoDZ[CNT_LEGS];
+short           g_asOdoDRot[CNT_LEGS];
+long            g_lOdoX;                        // Position, decimals = 2
+long            g_lOdoZ;
+long            g_lOdoHeading;                  // Heading, degrees, decimals = 2
+long            g_lOdoDist;                     // Distance walked, decimals = 2
+word            g_wOdoClampedSteps;             // Steps where a stance leg was left out
+
+//--------------------------------------------------------------------
+// OdometryReset - Start counting from here.
+//--------------------------------------------------------------------
+void OdometryReset(void)
+{
+  g_lOdoX = 0;
+  g_lOdoZ = 0;
+  g_lOdoHeading = 0;
+  g_lOdoDist = 0;
+  g_wOdoClampedSteps = 0;
+}
+
+//--------------------------------------------------------------------
+// OdometryStance - Called by Gait() for a foot on the ground that moves
+//      by -lDX, -lDZ, -lDRot this step.
+//--------------------------------------------------------------------
+void OdometryStance(byte LegNr, long lDX, long lDZ, long lDRot)
+{
+  g_asOdoDX[LegNr] = lDX;
+  g_asOdoDZ[LegNr] = lDZ;
+  g_asOdoDRot[LegNr] = lDRot;
+  g_bOdoStanceLegs |= (1 << LegNr);
+}
+
+//--------------------------------------------------------------------
+// OdometryUpdate - Called from the main loop after CheckAngles.
+//--------------------------------------------------------------------
+void OdometryUpdate(void)
+{
+  long    lDX = 0;
+  long    lDZ = 0;
+  long    lDRot = 0;
+  byte    cLegs = 0;
+  byte    bLegs = g_bOdoStanceLegs & ~g_bClampedLegs;
+
+  if (!g_bOdoStanceLegs)
+    return;
+  if (bLegs != g_bOdoStanceLegs)
+    g_wOdoClampedSteps++;
+
+  for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++) {
+    if (bLegs & (1 << LegNr)) {
+      lDX += g_asOdoDX[LegNr];
+      lDZ += g_asOdoDZ[LegNr];
+      lDRot += g_asOdoDRot[LegNr];
+      cLegs++;
+    }
+  }
+  if (!cLegs)
+    return;
+  lDX = (lDX * c2DEC) / cLegs;
+  lDZ = (lDZ * c2DEC) / cLegs;
+  lDRot = (lDRot * c2DEC) / cLegs;
+
+  // Turn the body frame step into the odometry frame, use the heading half
+  // way through the step
+  GetSinCos((g_lOdoHeading + lDRot/2) / 10);
+  g_lOdoX += (lDX * cos4 - lDZ * sin4) / c4DEC;
+  g_lOdoZ += (lDX * sin4 + lDZ * cos4) / c4DEC;
+  g_lOdoDist += isqrt32(lDX * lDX + lDZ * lDZ);
+  g_lOdoHeading += lDRot;
+  if (g_lOdoHeading >= 36000)
+    g_lOdoHeading -= 36000;
+  else if (g_lOdoHeading < 0)
+    g_lOdoHeading += 36000;
+}
+
+//--------------------------------------------------------------------
+// PrintOdometry - Position in mm and heading in degrees, used by the P
+//      command and the debug output once per gait cycle.
+//--------------------------------------------------------------------
+void PrintOdometry(void)
+{
+  DBGSerial.print(F("Odo X: "));
+  DBGSerial.print(g_lOdoX / c2DEC, DEC);
+  DBGSerial.print(F(" Z: "));
+  DBGSerial.print(g_lOdoZ / c2DEC, DEC);
+  DBGSerial.print(F(" Heading: "));
+  DBGSerial.print(g_lOdoHeading / c2DEC, DEC);
+  DBGSerial.print(F(" Dist: "));
+  DBGSerial.print(g_lOdoDist / c2DEC, DEC);
+  DBGSerial.print(F(" Clamped steps: "));
+  DBGSerial.println(g_wOdoClampedSteps, DEC);
+}
+#endif // OPT_ODOMETRY
+
+//--------------------------------------------------------------------
+//[GAIT]
+void Gait (byte GaitCurrentLegNr)
+{
+
+  // Try to reduce the number of time we look at GaitLegnr and Gaitstep
+  short int LegStep = g_InControlState.GaitStep - g_InControlState.gaitCur.GaitLegNr[GaitCurrentLegNr];
+  // The feet on the ground move the body with TravelX/Z/RotY, a lifted leg
+  // comes down where AimX/Z/RotY want it
+  short AimX = g_InControlState.TravelLength.x;
+  short AimZ = g_InControlState.TravelLength.z;
+  short AimRotY = g_InControlState.TravelLength.y;
+#ifdef OPT_TRAVEL_BLEND
+  short TravelX = g_sBlendTravelX;
+  short TravelZ = g_sBlendTravelZ;
+  short TravelRotY = g_sBlendTravelY;
+#else
+  short TravelX = AimX;
+  short TravelZ = AimZ;
+  short TravelRotY = AimRotY;
+#endif
+#ifdef OPT_FREE_GAIT
+  // In free gait each leg has its own step, which is only in the swing part while lifted
+  if (g_InControlState.fFreeGait)
+    LegStep = g_asFreeGaitStep[GaitCurrentLegNr];
+#endif
+
+  //Leg middle up position OK
+  //Gait in motion	                                                                                  
+  // For Lifted pos = 1, 3, 5
+  if ((TravelRequest && (g_InControlState.gaitCur.NrLiftedPos&1) && 
+    LegStep==0) || (!TravelRequest && LegStep==0 && ((abs(GaitPosX[GaitCurrentLegNr])>2) || 
+    (abs(GaitPosZ[GaitCurrentLegNr])>2) || (abs(GaitRotY[GaitCurrentLegNr])>2)))) { //Up
+    GaitPosX[GaitCurrentLegNr] = 0;
+    GaitPosY[GaitCurrentLegNr] = -g_InControlState.LegLiftHeight;
+    GaitPosZ[GaitCurrentLegNr] = 0;
+    GaitRotY[GaitCurrentLegNr] = 0;
+  }
+  //Optional Half heigth Rear (2, 3, 5 lifted positions)
+  else if (((g_InControlState.gaitCur.NrLiftedPos==2 && LegStep==0) || (g_InControlState.gaitCur.NrLiftedPos>=3 && 
+    (LegStep==-1 || LegStep==(g_InControlState.gaitCur.StepsInGait-1))))
+    && TravelRequest) {
+    GaitPosX[GaitCurrentLegNr] = -TravelX/g_InControlState.gaitCur.LiftDivFactor;
+    GaitPosY[GaitCurrentLegNr] = -3*g_InControlState.LegLiftHeight/(3+g_InControlState.gaitCur.HalfLiftHeight);     //Easier to shift between div factor: /1 (3/3), /2 (3/6) and 3/4
+    GaitPosZ[GaitCurrentLegNr] = -TravelZ/g_InControlState.gaitCur.LiftDivFactor;
+    GaitRotY[GaitCurrentLegNr] = -TravelRotY/g_InControlState.gaitCur.LiftDivFactor;
+  }    
+  // _A_	  
+  // Optional Half heigth front (2, 3, 5 lifted positions)
+  else if ((g_InControlState.gaitCur.NrLiftedPos>=2) && (LegStep==1 || LegStep==-(g_InControlState.gaitCur.StepsInGait-1)) && TravelRequest) {
+    GaitPosX[GaitCurrentLegNr] = AimX/g_InControlState.gaitCur.LiftDivFactor;
+    GaitPosY[GaitCurrentLegNr] = -3*g_InControlState.LegLiftHeight/(3+g_InControlState.gaitCur.HalfLiftHeight); // Easier to shift between div factor: /1 (3/3), /2 (3/6) and 3/4
+    GaitPosZ[GaitCurrentLegNr] = AimZ/g_InControlState.gaitCur.LiftDivFactor;
+    GaitRotY[GaitCurrentLegNr] = AimRotY/g_InControlState.gaitCur.LiftDivFactor;
+  }
+
+  //Optional Half heigth Rear 5 LiftedPos (5 lifted positions)
+  else if (((g_InControlState.gaitCur.NrLiftedPos==5 && (LegStep==-2 ))) && TravelRequest) {
+    GaitPosX[GaitCurrentLegNr] = -TravelX/2;
+    GaitPosY[GaitCurrentLegNr] = -g_InControlState.LegLiftHeight/2;
+    GaitPosZ[GaitCurrentLegNr] = -TravelZ/2;
+    GaitRotY[GaitCurrentLegNr] = -TravelRotY/2;
+  }  		
+
+  //Optional Half heigth Front 5 LiftedPos (5 lifted positions)
+  else if ((g_InControlState.gaitCur.NrLiftedPos==5) && (LegStep==2 || LegStep==-(g_InControlState.gaitCur.StepsInGait-2)) && TravelRequest) {
+    GaitPosX[GaitCurrentLegNr] = AimX/2;
+    GaitPosY[GaitCurrentLegNr] = -g_InControlState.LegLiftHeight/2;
+    GaitPosZ[GaitCurrentLegNr] = AimZ/2;
+    GaitRotY[GaitCurrentLegNr] = AimRotY/2;
+  }
+  //_B_
+  //Leg front down position //bug here?  From _A_ to _B_ there should only be one gaitstep, not 2!
+  //For example, where is the case of LegStep==0+2 executed when NRLiftedPos=3?
+  else if ((LegStep==g_InControlState.gaitCur.FrontDownPos || LegStep==-(g_InControlState.gaitCur.StepsInGait-g_InControlState.gaitCur.FrontDownPos)) && GaitPosY[GaitCurrentLegNr]<0) {
+    GaitPosX[GaitCurrentLegNr] = AimX/2;
+    GaitPosZ[GaitCurrentLegNr] = AimZ/2;
+    GaitRotY[GaitCurrentLegNr] = AimRotY/2;      	
+    GaitPosY[GaitCurrentLegNr] = 0;	
+  }
 
-    // We also have a simple debug monitor that allows us to 
-    // check things. call it here..
-#ifdef OPT_TERMINAL_MONITOR  
-    if (TerminalMonitor())
-      return;           
+  //Move body forward      
+  else {
+#ifdef OPT_ODOMETRY
+    // Only a foot that was already on the ground moves the body
+    if (GaitPosY[GaitCurrentLegNr] == 0)
+      OdometryStance(GaitCurrentLegNr, TravelX/(short)g_InControlState.gaitCur.TLDivFactor,
+          TravelZ/(short)g_InControlState.gaitCur.TLDivFactor,
+          TravelRotY/(short)g_InControlState.gaitCur.TLDivFactor);
 #endif
-    delay(20);  // give a pause between times we call if nothing is happening
+    GaitPosX[GaitCurrentLegNr] = GaitPosX[GaitCurrentLegNr] - (TravelX/(short)g_InControlState.gaitCur.TLDivFactor);
+    GaitPosY[GaitCurrentLegNr] = 0; 
+    GaitPosZ[GaitCurrentLegNr] = GaitPosZ[GaitCurrentLegNr] - (TravelZ/(short)g_InControlState.gaitCur.TLDivFactor);
+    GaitRotY[GaitCurrentLegNr] = GaitRotY[GaitCurrentLegNr] - (TravelRotY/(short)g_InControlState.gaitCur.TLDivFactor);
   }
 
-  PrevServoMoveTime = ServoMoveTime;
+}  
 
-  //Store previous g_InControlState.fRobotOn State
-  if (g_InControlState.fRobotOn)
-    g_InControlState.fPrev_RobotOn = 1;
-  else
-    g_InControlState.fPrev_RobotOn = 0;
+//--------------------------------------------------------------------
+//[FootInReach] Quick check if LegIK will find a solution for the foot
+//      position, given in the same leg coordinates that LegIK uses.  Same
+//      femur + tibia test as the IKSolution flags, less a small margin.
+//--------------------------------------------------------------------
+#ifndef STRIDE_REACH_MARGIN
+#define STRIDE_REACH_MARGIN     10      // mm short of a fully stretched leg
+#endif
+
+boolean FootInReach(byte LegNr, long lX, long lY, long lZ)
+{
+  long    lFemur = (byte)pgm_read_byte(&cFemurLength[LegNr]);
+  long    lTibia = (byte)pgm_read_byte(&cTibiaLength[LegNr]);
+  long    lXZ;
+  long    lSW2;
+  long    lReach;
+  long    lMin;
+
+  lXZ = (long)isqrt32(lX*lX + lZ*lZ) - (byte)pgm_read_byte(&cCoxaLength[LegNr]);
+  lSW2 = lXZ*lXZ + lY*lY;
+  lReach = lFemur + lTibia - STRIDE_REACH_MARGIN;
+  lMin = abs(lFemur - lTibia) + STRIDE_REACH_MARGIN;
+  return (lSW2 <= lReach*lReach) && (lSW2 >= lMin*lMin);
 }
 
+//--------------------------------------------------------------------
+//[STRIDE LIMIT] Envelope of the largest travel length the current gait
+//      can use at the current body height and leg positions.  It is
+//      rebuilt only when one of those changes, GaitSeq then scales the
+//      commanded travel so that every foot stays solvable instead of
+//      finding out afterwards through IKSolutionError and CheckAngles.
+//--------------------------------------------------------------------
+#ifdef OPT_STRIDE_LIMIT
+#define STRIDE_DIRS             8       // Directions over 180 deg, both signs are checked
+#ifndef STRIDE_MAX_TRAVEL
+#define STRIDE_MAX_TRAVEL       300     // Upper bound for the search, mm
+#endif
+#ifndef STRIDE_MAX_ROT
+#define STRIDE_MAX_ROT          60      // Upper bound for the rotation search, deg
+#endif
 
-void StartUpdateServos()
-{        
-  byte    LegIndex;
+short           g_asStrideMax[STRIDE_DIRS];     // Max travel length per direction, mm
+short           g_sStrideRotMax;                // Max travel rotation, deg
+byte            g_bStrideExcursion;             // How far a foot gets from home as % of the travel length
+byte            g_bStridePct = 100;             // How much we scaled the last travel request
+// What the envelope was calculated for
+boolean         g_fStrideKeyValid;
+byte            g_bStrideKeyGaitType;
+PHOENIXGAIT     g_StrideKeyGait;
+COORD3D         g_StrideKeyBodyPos;
+short           g_asStrideKeyLegPosX[CNT_LEGS];
+short           g_asStrideKeyLegPosY[CNT_LEGS];
+short           g_asStrideKeyLegPosZ[CNT_LEGS];
 
-  // First call off to the init...
-  g_ServoDriver.BeginServoUpdate();    // Start the update 
+//--------------------------------------------------------------------
+// GaitStrideExcursion - Furthest a foot gets from its home position over
+//      the gait, in percent of the travel length.  Front down puts the foot
+//      at T/2, the stance steps move it back T/TLDivFactor each and the
+//      rear half lift position is at T/LiftDivFactor.
+//--------------------------------------------------------------------
+byte GaitStrideExcursion(PHOENIXGAIT *pgait)
+{
+  short sStance = pgait->StepsInGait - pgait->NrLiftedPos - (pgait->NrLiftedPos & 1);
+  short sExc = 50;
+
+  if ((100 / pgait->LiftDivFactor) > sExc)
+    sExc = 100 / pgait->LiftDivFactor;
+  if (abs((100 * sStance) / pgait->TLDivFactor - 50) > sExc)
+    sExc = abs((100 * sStance) / pgait->TLDivFactor - 50);
+  return (byte)min(sExc, 250);
+}
 
-    for (LegIndex = 0; LegIndex < CNT_LEGS; LegIndex++) {
-#ifdef c4DOF
-    g_ServoDriver.OutputServoInfoForLeg(LegIndex, 
-        cCoxaInv[LegIndex]? -CoxaAngle1[LegIndex] : CoxaAngle1[LegIndex], 
-        cFemurInv[LegIndex]? -FemurAngle1[LegIndex] : FemurAngle1[LegIndex], 
-        cTibiaInv[LegIndex]? -TibiaAngle1[LegIndex] : TibiaAngle1[LegIndex], 
-        cTarsInv[LegIndex]? -TarsAngle1[LegIndex] : TarsAngle1[LegIndex]);
-#else
-    g_ServoDriver.OutputServoInfoForLeg(LegIndex, 
-        cCoxaInv[LegIndex]? -CoxaAngle1[LegIndex] : CoxaAngle1[LegIndex], 
-        cFemurInv[LegIndex]? -FemurAngle1[LegIndex] : FemurAngle1[LegIndex], 
-        cTibiaInv[LegIndex]? -TibiaAngle1[LegIndex] : TibiaAngle1[LegIndex]);
-#endif      
+//--------------------------------------------------------------------
+// StrideFeetInReach - Are all feet solvable when displaced by the body
+//      frame vector (lDX, lDZ)?  Right legs are mirrored in X the same way
+//      they are when the main loop calls LegIK.
+//--------------------------------------------------------------------
+boolean StrideFeetInReach(long lDX, long lDZ)
+{
+  for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++) {
+    long lX = LegPosX[LegNr] + ((LegNr < (CNT_LEGS/2))? -(g_InControlState.BodyPos.x + lDX) : (g_InControlState.BodyPos.x + lDX));
+    long lY = LegPosY[LegNr] + g_InControlState.BodyPos.y;
+    long lZ = LegPosZ[LegNr] + g_InControlState.BodyPos.z + lDZ;
+    if (!FootInReach(LegNr, lX, lY, lZ))
+      return false;
   }
-#ifdef cTurretRotPin
-  g_ServoDriver.OutputServoInfoForTurret(g_InControlState.TurretRotAngle1, g_InControlState.TurretTiltAngle1);  // fist just see if it will talk
-#endif  
+  return true;
 }
 
-
-
-
 //--------------------------------------------------------------------
-//[WriteOutputs] Updates the state of the leds
+// StrideFeetInReachRot - Same for the feet rotated sDeg1 around the body
+//      center, which is what GaitRotY does through BodyFK.
 //--------------------------------------------------------------------
-void WriteOutputs(void)
+boolean StrideFeetInReachRot(short sDeg1)
 {
-#ifdef cEyesPin
-  digitalWrite(cEyesPin, Eyes);
-#endif        
+  GetSinCos(sDeg1);
+  for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++) {
+    long lBX = (short)pgm_read_word(&cOffsetX[LegNr]) + ((LegNr < (CNT_LEGS/2))? -LegPosX[LegNr] : LegPosX[LegNr]);
+    long lBZ = (short)pgm_read_word(&cOffsetZ[LegNr]) + LegPosZ[LegNr];
+    long lDX = ((lBX*cos4 - lBZ*sin4) / c4DEC) - lBX;
+    long lDZ = ((lBX*sin4 + lBZ*cos4) / c4DEC) - lBZ;
+    long lX = LegPosX[LegNr] + ((LegNr < (CNT_LEGS/2))? -(g_InControlState.BodyPos.x + lDX) : (g_InControlState.BodyPos.x + lDX));
+    long lY = LegPosY[LegNr] + g_InControlState.BodyPos.y;
+    long lZ = LegPosZ[LegNr] + g_InControlState.BodyPos.z + lDZ;
+    if (!FootInReach(LegNr, lX, lY, lZ))
+      return false;
+  }
+  return true;
 }
-//--------------------------------------------------------------------
-//[CHECK VOLTAGE]
-//Reads the input voltage and shuts down the bot when the power drops
-byte s_bLVBeepCnt;
-boolean CheckVoltage() {
-#ifdef cTurnOffVol
-  // Moved to Servo Driver - BUGBUG: Need to do when I merge back...
-  //    Voltage = analogRead(cVoltagePin); // Battery voltage 
-  //    Voltage = ((long)Voltage*1955)/1000;
-  Voltage = g_ServoDriver.GetBatteryVoltage();
-
-  // BUGBUG:: if voltage is 0 it failed to retrieve don't hang program...
-  //    if (!Voltage)
-  //      return;
-
-  if (!g_fLowVoltageShutdown) {
-    if ((Voltage < cTurnOffVol) || (Voltage >= 1999)) {
-#ifdef DBGSerial          
-      DBGSerial.print("Voltage went low, turn off robot ");
-      DBGSerial.println(Voltage, DEC);
-#endif            
-      //Turn off
-      g_InControlState.BodyPos.x = 0;
-      g_InControlState.BodyPos.y = 0;
-      g_InControlState.BodyPos.z = 0;
-      g_InControlState.BodyRot1.x = 0;
-      g_InControlState.BodyRot1.y = 0;
-      g_InControlState.BodyRot1.z = 0;
-      g_InControlState.TravelLength.x = 0;
-      g_InControlState.TravelLength.z = 0;
 
-#ifdef OPT_SINGLELEG
-      g_InControlState.TravelLength.y = 0;
-      g_InControlState.SelectedLeg = 255;
-#endif
-      g_fLowVoltageShutdown = 1;
-      s_bLVBeepCnt = 0;    // how many times we beeped...
-      g_InControlState.fRobotOn = false;
+//--------------------------------------------------------------------
+// StrideEnvelopeUpdate - Rebuild the envelope if the gait or any field of
+//      it, the body position or the leg positions changed since the last
+//      time.
+//--------------------------------------------------------------------
+void StrideEnvelopeUpdate(void)
+{
+  short   sLow;
+  short   sHigh;
+  short   sMid;
+  long    lExc;
+
+  // All of the gait, N E edits it in place without changing GaitType
+  if (g_fStrideKeyValid && (g_bStrideKeyGaitType == g_InControlState.GaitType)
+      && GaitEqual(&g_StrideKeyGait, &g_InControlState.gaitCur)
+      && Coord3DEqual(&g_StrideKeyBodyPos, &g_InControlState.BodyPos)
+      && !memcmp(g_asStrideKeyLegPosX, LegPosX, sizeof(LegPosX))
+      && !memcmp(g_asStrideKeyLegPosY, LegPosY, sizeof(LegPosY))
+      && !memcmp(g_asStrideKeyLegPosZ, LegPosZ, sizeof(LegPosZ)))
+    return;
+  g_fStrideKeyValid = true;
+  g_bStrideKeyGaitType = g_InControlState.GaitType;
+  g_StrideKeyGait = g_InControlState.gaitCur;
+  g_StrideKeyBodyPos = g_InControlState.BodyPos;
+  memcpy(g_asStrideKeyLegPosX, LegPosX, sizeof(LegPosX));
+  memcpy(g_asStrideKeyLegPosY, LegPosY, sizeof(LegPosY));
+  memcpy(g_asStrideKeyLegPosZ, LegPosZ, sizeof(LegPosZ));
+  g_bStrideExcursion = GaitStrideExcursion(&g_InControlState.gaitCur);
+  lExc = g_bStrideExcursion;
+
+  // Translation, binary search the largest travel in each direction for which
+  // the feet at both ends of the stroke can be reached.
+  for (byte iDir = 0; iDir < STRIDE_DIRS; iDir++) {
+    GetSinCos((iDir * 1800) / STRIDE_DIRS);
+    short sDirSin4 = sin4;
+    short sDirCos4 = cos4;
+    sLow = 0;
+    sHigh = STRIDE_MAX_TRAVEL;
+    while (sLow < sHigh) {
+      sMid = (sLow + sHigh + 1) / 2;
+      long lDX = ((long)sMid * lExc * sDirCos4) / ((long)c2DEC * c4DEC);
+      long lDZ = ((long)sMid * lExc * sDirSin4) / ((long)c2DEC * c4DEC);
+      if (StrideFeetInReach(lDX, lDZ) && StrideFeetInReach(-lDX, -lDZ))
+        sLow = sMid;
+      else
+        sHigh = sMid - 1;
     }
-#ifdef cTurnOnVol
-  } 
-  else if ((Voltage > cTurnOnVol) && (Voltage < 1999)) {
-#ifdef DBGSerial
-    DBGSerial.print(F("Voltage restored: "));
-    DBGSerial.println(Voltage, DEC);
-#endif          
-    g_fLowVoltageShutdown = 0;
+    g_asStrideMax[iDir] = sLow;
+  }
 
-#endif      
-  } 
-  else {
-    if (s_bLVBeepCnt < 5) {
-      s_bLVBeepCnt++;
-#ifdef DBGSerial
-      DBGSerial.println(Voltage, DEC);
-#endif          
-      MSound( 1, 45, 2000);
+  // Rotation
+  sLow = 0;
+  sHigh = STRIDE_MAX_ROT;
+  while (sLow < sHigh) {
+    sMid = (sLow + sHigh + 1) / 2;
+    short sDeg1 = (short)((sMid * lExc * c1DEC) / c2DEC);
+    if (StrideFeetInReachRot(sDeg1) && StrideFeetInReachRot(-sDeg1))
+      sLow = sMid;
+    else
+      sHigh = sMid - 1;
+  }
+  g_sStrideRotMax = sLow;
+
+#ifdef DEBUG
+  if (g_fDebugOutput) {
+    DBGSerial.print(F("Stride envelope:"));
+    for (byte iDir = 0; iDir < STRIDE_DIRS; iDir++) {
+      DBGSerial.print(" ");
+      DBGSerial.print(g_asStrideMax[iDir], DEC);
     }
-    delay(2000);
+    DBGSerial.print(F(" Rot: "));
+    DBGSerial.println(g_sStrideRotMax, DEC);
   }
-#endif	
-  return g_fLowVoltageShutdown;
+#endif
 }
 
 //--------------------------------------------------------------------
-//[SINGLE LEG CONTROL]
-void SingleLegControl(void)
+// StrideLimit - Called by GaitSeq before the legs are moved.  The
+//      translation and rotation parts each use up part of the envelope, if
+//      together they use more than all of it the whole travel vector is
+//      scaled down, so the walking direction does not change.
+//--------------------------------------------------------------------
+void StrideLimit(void)
 {
-#ifdef OPT_SINGLELEG
-
-  //Check if all legs are down
-  AllDown = (LegPosY[cRF]==(short)pgm_read_word(&cInitPosY[cRF])) && 
-    (LegPosY[cRR]==(short)pgm_read_word(&cInitPosY[cRR])) && 
-    (LegPosY[cLR]==(short)pgm_read_word(&cInitPosY[cLR])) && 
-#ifndef QUADMODE
-    (LegPosY[cRM]==(short)pgm_read_word(&cInitPosY[cRM])) && 
-    (LegPosY[cLM]==(short)pgm_read_word(&cInitPosY[cLM])) && 
-#endif	
-    (LegPosY[cLF]==(short)pgm_read_word(&cInitPosY[cLF]));
+  long    lTravel;
+  long    lMax;
+  long    lUse;
+  short   sAngle1;
+  byte    iDir;
+
+  StrideEnvelopeUpdate();
+
+  lUse = 0;
+  lTravel = isqrt32(g_InControlState.TravelLength.x*g_InControlState.TravelLength.x 
+    + g_InControlState.TravelLength.z*g_InControlState.TravelLength.z);
+  if (lTravel) {
+    // Direction of travel folded into 0-180 deg, use the smaller of the two
+    // envelope directions on each side of it.
+    sAngle1 = ((long)GetATan2(g_InControlState.TravelLength.x, g_InControlState.TravelLength.z) * 1800) / 31416;
+    if (sAngle1 < 0)
+      sAngle1 += 1800;
+    iDir = ((long)sAngle1 * STRIDE_DIRS) / 1800;
+    if (iDir >= STRIDE_DIRS)
+      iDir = STRIDE_DIRS - 1;
+    lMax = min(g_asStrideMax[iDir], g_asStrideMax[(iDir + 1) % STRIDE_DIRS]);
+    lUse = lMax? (lTravel * c2DEC) / lMax : c4DEC;  // No room at all, stop
+  }
+  if (g_InControlState.TravelLength.y)
+    lUse += g_sStrideRotMax? (abs(g_InControlState.TravelLength.y) * c2DEC) / g_sStrideRotMax : c4DEC;
+
+  if (lUse > c2DEC) {
+    g_bStridePct = (lUse >= c4DEC)? 0 : (c2DEC * c2DEC) / lUse;
+    g_InControlState.TravelLength.x = (g_InControlState.TravelLength.x * g_bStridePct) / c2DEC;
+    g_InControlState.TravelLength.z = (g_InControlState.TravelLength.z * g_bStridePct) / c2DEC;
+    g_InControlState.TravelLength.y = (g_InControlState.TravelLength.y * g_bStridePct) / c2DEC;
+  }
+  else
+    g_bStridePct = 100;
+}
+#endif // OPT_STRIDE_LIMIT
 
-  if (g_InControlState.SelectedLeg<= (CNT_LEGS-1)) {
-    if (g_InControlState.SelectedLeg!=PrevSelectedLeg) {
-      if (AllDown) { //Lift leg a bit when it got selected
-        LegPosY[g_InControlState.SelectedLeg] = (short)pgm_read_word(&cInitPosY[g_InControlState.SelectedLeg])-20;
+//--------------------------------------------------------------------
+//[BODY POSE LIMIT] Translate and rotate modes write BodyPos and BodyRot1
+//      straight from the sticks.  Before that pose goes to BodyFK, find
+//      the largest part of it, in percent, for which every foot is still
+//      in reach and scale the command back to that, instead of finding out
+//      afterwards through IKSolutionError and CheckAngles.
+//--------------------------------------------------------------------
+#ifdef OPT_BODY_POSE_LIMIT
+byte            g_bBodyPosePct = 100;           // How much we scaled the last pose command
 
-        //Store current status
-        PrevSelectedLeg = g_InControlState.SelectedLeg;
-      } 
-      else {//Return prev leg back to the init position
-        LegPosX[PrevSelectedLeg] = (short)pgm_read_word(&cInitPosX[PrevSelectedLeg]);
-        LegPosY[PrevSelectedLeg] = (short)pgm_read_word(&cInitPosY[PrevSelectedLeg]);
-        LegPosZ[PrevSelectedLeg] = (short)pgm_read_word(&cInitPosZ[PrevSelectedLeg]);
-      }
-    } 
-    else if (!g_InControlState.fSLHold) {
-      //LegPosY[g_InControlState.SelectedLeg] = LegPosY[g_InControlState.SelectedLeg]+g_InControlState.SLLeg.y;
-      LegPosY[g_InControlState.SelectedLeg] = (short)pgm_read_word(&cInitPosY[g_InControlState.SelectedLeg])+g_InControlState.SLLeg.y;// Using DIY remote Zenta prefer it this way
-      LegPosX[g_InControlState.SelectedLeg] = (short)pgm_read_word(&cInitPosX[g_InControlState.SelectedLeg])+g_InControlState.SLLeg.x;
-      LegPosZ[g_InControlState.SelectedLeg] = (short)pgm_read_word(&cInitPosZ[g_InControlState.SelectedLeg])+g_InControlState.SLLeg.z;     
+//--------------------------------------------------------------------
+// BodyPoseInReach - Are all feet solvable with the current body pose?
+//      Same positions CalcLegsIK gives to BodyFK and LegIK.
+//--------------------------------------------------------------------
+boolean BodyPoseInReach(void)
+{
+  long    lX;
+
+  for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++) {
+    if (LegNr < (CNT_LEGS/2)) {
+      BodyFK(-LegPosX[LegNr]+g_InControlState.BodyPos.x+GaitPosX[LegNr] - TotalTransX,
+        LegPosZ[LegNr]+g_InControlState.BodyPos.z+GaitPosZ[LegNr] - TotalTransZ,
+        LegPosY[LegNr]+g_InControlState.BodyPos.y+GaitPosY[LegNr] - TotalTransY,
+        GaitRotY[LegNr], LegNr);
+      lX = LegPosX[LegNr]-g_InControlState.BodyPos.x+BodyFKPosX-(GaitPosX[LegNr] - TotalTransX);
     }
-  } 
-  else {//All legs to init position
-    if (!AllDown) {
-      for(LegIndex = 0; LegIndex <= (CNT_LEGS-1);LegIndex++) {
-        LegPosX[LegIndex] = (short)pgm_read_word(&cInitPosX[LegIndex]);
-        LegPosY[LegIndex] = (short)pgm_read_word(&cInitPosY[LegIndex]);
-        LegPosZ[LegIndex] = (short)pgm_read_word(&cInitPosZ[LegIndex]);
-      }
-    } 
-    if (PrevSelectedLeg!=255)
-      PrevSelectedLeg = 255;
+    else {
+      BodyFK(LegPosX[LegNr]-g_InControlState.BodyPos.x+GaitPosX[LegNr] - TotalTransX,
+        LegPosZ[LegNr]+g_InControlState.BodyPos.z+GaitPosZ[LegNr] - TotalTransZ,
+        LegPosY[LegNr]+g_InControlState.BodyPos.y+GaitPosY[LegNr] - TotalTransY,
+        GaitRotY[LegNr], LegNr);
+      lX = LegPosX[LegNr]+g_InControlState.BodyPos.x-BodyFKPosX+GaitPosX[LegNr] - TotalTransX;
+    }
+    if (!FootInReach(LegNr, lX,
+        LegPosY[LegNr]+g_InControlState.BodyPos.y-BodyFKPosY+GaitPosY[LegNr] - TotalTransY,
+        LegPosZ[LegNr]+g_InControlState.BodyPos.z-BodyFKPosZ+GaitPosZ[LegNr] - TotalTransZ))
+      return false;
   }
-#endif
+  return true;
 }
 
+//--------------------------------------------------------------------
+// BodyPoseScale - Set the pose to bPct percent of the command.
+//--------------------------------------------------------------------
+void BodyPoseScale(COORD3D *ppose, COORD3D *pcmd, short sBase, byte bPct)
+{
+  ppose->x = ((long)pcmd->x * bPct) / c2DEC;
+  ppose->y = sBase + ((long)(pcmd->y - sBase) * bPct) / c2DEC;
+  ppose->z = ((long)pcmd->z * bPct) / c2DEC;
+}
 
-void GaitSelect(void)
+//--------------------------------------------------------------------
+// BodyPoseLimit - Called by the input controller after it set the pose.
+//      fRotate picks what the sticks drive: BodyRot1, or BodyPos where Y
+//      is taken relative to sBaseY, the body height without the stick.
+//      If the pose at 0% can't be reached either, scaling won't help and
+//      the command is left alone.  Returns the percent used.
+//--------------------------------------------------------------------
+byte BodyPoseLimit(boolean fRotate, short sBaseY)
 {
-  //Gait selector
-  // First pass simply use defined table, next up will allow robots to add or relace set...
-  if (g_InControlState.GaitType < NUM_GAITS) {
-#ifdef ADD_GAITS
-    if (g_InControlState.GaitType < (sizeof(APG_EXTRA)/sizeof(APG_EXTRA[0])))
-        g_InControlState.gaitCur = APG_EXTRA[g_InControlState.GaitType];
+  COORD3D *ppose = fRotate? &g_InControlState.BodyRot1 : &g_InControlState.BodyPos;
+  COORD3D cmd = *ppose;
+  short   sBase = fRotate? 0 : sBaseY;
+  byte    bLow;
+  byte    bHigh;
+  byte    bMid;
+
+  g_bBodyPosePct = 100;
+  if (BodyPoseInReach())
+    return g_bBodyPosePct;
+
+  // Binary search the largest part of the command that can be reached
+  bLow = 0;
+  bHigh = 100;
+  while (bLow < bHigh) {
+    bMid = (bLow + bHigh + 1) / 2;
+    BodyPoseScale(ppose, &cmd, sBase, bMid);
+    if (BodyPoseInReach())
+      bLow = bMid;
     else
-        g_InControlState.gaitCur = APG[g_InControlState.GaitType - (sizeof(APG_EXTRA)/sizeof(APG_EXTRA[0]))];
-#else
-    g_InControlState.gaitCur = APG[g_InControlState.GaitType];
-#endif
+      bHigh = bMid - 1;
   }
+  BodyPoseScale(ppose, &cmd, sBase, bLow);
+  if (!bLow && !BodyPoseInReach()) {
+    *ppose = cmd;
+    return g_bBodyPosePct;
+  }
+  g_bBodyPosePct = bLow;
+  return g_bBodyPosePct;
+}
+#endif // OPT_BODY_POSE_LIMIT
 
-#ifdef DBGSerial  
-  if (g_fDebugOutput) {
-    DBGSerial.print(g_InControlState.GaitType, DEC);
-    DBGSerial.print("    {");
-  	DBGSerial.print(g_InControlState.gaitCur.NomGaitSpeed, DEC);
-    DBGSerial.print(", ");
-	DBGSerial.print(g_InControlState.gaitCur.StepsInGait, DEC); 
-    DBGSerial.print(", ");
-	DBGSerial.print(g_InControlState.gaitCur.NrLiftedPos, DEC); 
-    DBGSerial.print(", ");
-	DBGSerial.print(g_InControlState.gaitCur.FrontDownPos, DEC);
-    DBGSerial.print(", ");
-	DBGSerial.print(g_InControlState.gaitCur.LiftDivFactor, DEC);
-    DBGSerial.print(", ");
-	DBGSerial.print(g_InControlState.gaitCur.TLDivFactor, DEC);  
-    DBGSerial.print(", ");
-	DBGSerial.print(g_InControlState.gaitCur.HalfLiftHeight, DEC); 
-    DBGSerial.print(", {");
-    for (int il = 0; il < CNT_LEGS; il++) {
-        DBGSerial.print(g_InControlState.gaitCur.GaitLegNr[il], DEC);
-        if (il < (CNT_LEGS-1))
-            DBGSerial.print(", ");
-    }
-    DBGSerial.println("}}");
-  }  
-#endif  
-
-}    
+//--------------------------------------------------------------------
+//[STABILITY MARGIN] Static stability of the body: the support polygon is
+//      the convex hull of the feet on the ground (GaitPosY == 0) and the
+//      margin is the distance from the body center to its nearest edge.
+//      Positive is inside the polygon, negative means the robot would tip
+//      over if it was standing still.  Body rotations are ignored, the feet
+//      are taken in the body frame the same way BalCalcOneLeg does.
+//--------------------------------------------------------------------
+#ifdef OPT_STABILITY_MARGIN
+#define STABILITY_NO_SUPPORT    -999    // Less than 3 feet on the ground
 
 //--------------------------------------------------------------------
-//[GAIT Sequence]
-void GaitSeq(void)
+// SupportMargin - Margin of the support polygon formed by the feet in
+//      bLegMask.  Can be used by the gait to see what happens when a leg
+//      is lifted, before lifting it.
+//--------------------------------------------------------------------
+short SupportMargin(byte bLegMask)
 {
-  //Check if the Gait is in motion - If not if we are going to start a motion try to align our Gaitstep to start with a good foot
-  // for the direction we are about to go...
-  
-  if (fWalking || (g_InControlState.ForceGaitStepCnt != 0))
-	TravelRequest = true;	// Is walking or was walking...
-  else {
-	TravelRequest = (abs(g_InControlState.TravelLength.x)>cTravelDeadZone) 
-		|| (abs(g_InControlState.TravelLength.z)>cTravelDeadZone) 
-		|| (abs(g_InControlState.TravelLength.y)>cTravelDeadZone) ;
+  byte    abHull[CNT_LEGS*2];
+  byte    abLegs[CNT_LEGS];
+  byte    cLegs;
+  byte    cHull;
+  byte    i;
+  byte    j;
+  long    lMargin;
+
+  // Legs sorted on X then Z, at most 6 of them so insertion sort
+  cLegs = 0;
+  for (i = 0; i < CNT_LEGS; i++) {
+    if (!(bLegMask & (1 << i)))
+      continue;
+    for (j = cLegs; (j > 0) && ((g_asFootX[abLegs[j-1]] > g_asFootX[i]) 
+        || ((g_asFootX[abLegs[j-1]] == g_asFootX[i]) && (g_asFootZ[abLegs[j-1]] > g_asFootZ[i]))); j--)
+      abLegs[j] = abLegs[j-1];
+    abLegs[j] = i;
+    cLegs++;
+  }
+  if (cLegs < 3)
+    return STABILITY_NO_SUPPORT;
+
+#define HULL_CROSS(a, b, c) (((long)g_asFootX[b] - g_asFootX[a]) * ((long)g_asFootZ[c] - g_asFootZ[a]) \
+    - ((long)g_asFootZ[b] - g_asFootZ[a]) * ((long)g_asFootX[c] - g_asFootX[a]))
+
+  // Monotone chain, lower hull then upper hull, counter clockwise
+  cHull = 0;
+  for (i = 0; i < cLegs; i++) {
+    while ((cHull >= 2) && (HULL_CROSS(abHull[cHull-2], abHull[cHull-1], abLegs[i]) <= 0))
+      cHull--;
+    abHull[cHull++] = abLegs[i];
+  }
+  for (i = cLegs - 1, j = cHull + 1; i > 0; i--) {
+    while ((cHull >= j) && (HULL_CROSS(abHull[cHull-2], abHull[cHull-1], abLegs[i-1]) <= 0))
+      cHull--;
+    abHull[cHull++] = abLegs[i-1];
+  }
+  cHull--;        // Last one is the first one again
+  if (cHull < 3)
+    return STABILITY_NO_SUPPORT;  // All in a line
+
+  // Distance from the body center to each edge, the smallest one is the margin
+  lMargin = 0x7fffffff;
+  for (i = 0; i < cHull; i++) {
+    byte a = abHull[i];
+    byte b = abHull[i+1];
+    long lDX = (long)g_asFootX[b] - g_asFootX[a];
+    long lDZ = (long)g_asFootZ[b] - g_asFootZ[a];
+    long lLen = isqrt32(lDX*lDX + lDZ*lDZ);
+    long lDist;
+    if (!lLen)
+      continue;
+    lDist = (lDX * (0 - (long)g_asFootZ[a]) - lDZ * (0 - (long)g_asFootX[a])) / lLen;
+    if (lDist < lMargin)
+      lMargin = lDist;
+  }
+#undef HULL_CROSS
+  return (short)lMargin;
+}
 
-    if (TravelRequest) {
-#ifdef QUADCODE
-		// just start walking - Try to guess a good foot to start off on...
-		if (g_InControlState.TravelLength.z < 0) 
-            g_InControlState.GaitStep = ((g_InControlState.TravelLength.X < 0)? g_InControlState.gaitCur.GaitLegNr[cLR] : g_InControlState.gaitCur.GaitLegNr[cRR]);
-		else 
-            g_InControlState.GaitStep = ((g_InControlState.TravelLength.X < 0)? g_InControlState.gaitCur.GaitLegNr[cLF] : g_InControlState.gaitCur.GaitLegNr[cRF]);
-		// And lets backup a few Gaitsteps before this to allow it to start the up swing... 
-        g_InControlState.GaitStep = ((g_InControlState.GaitStep > g_InControlState.gaitCur.FrontDownPos)? (g_InControlState.GaitStep - g_InControlState.gaitCur.FrontDownPos) : (g_InControlState.GaitStep + g_InControlState.gaitCur.StepsInGait - g_InControlState.gaitCur.FrontDownPos);
-#endif		
-    }
-    else {    //Clear values under the cTravelDeadZone
-      g_InControlState.TravelLength.x=0;
-      g_InControlState.TravelLength.z=0;
-      g_InControlState.TravelLength.y=0;//Gait NOT in motion, return to home position
-    } 
+//--------------------------------------------------------------------
+// CalcStabilityMargin - Called from the main loop after the balance
+//      calculations, updates the foot positions, grounded legs and margin.
+//--------------------------------------------------------------------
+void CalcStabilityMargin(void)
+{
+  g_bGroundedLegs = 0;
+  for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++) {
+    g_asFootX[LegNr] = (short)pgm_read_word(&cOffsetX[LegNr]) + ((LegNr < (CNT_LEGS/2))? -LegPosX[LegNr] : LegPosX[LegNr])
+      + g_InControlState.BodyPos.x + GaitPosX[LegNr] - TotalTransX;
+    g_asFootZ[LegNr] = (short)pgm_read_word(&cOffsetZ[LegNr]) + LegPosZ[LegNr]
+      + g_InControlState.BodyPos.z + GaitPosZ[LegNr] - TotalTransZ;
+    if (GaitPosY[LegNr] == 0)
+      g_bGroundedLegs |= (1 << LegNr);
   }
+  g_sStabilityMargin = SupportMargin(g_bGroundedLegs);
+}
+#endif // OPT_STABILITY_MARGIN
 
-  //Calculate Gait sequence
-  for (LegIndex = 0; LegIndex < CNT_LEGS; LegIndex++) { // for all legs
-    Gait(LegIndex);
-  }    // next leg
+//--------------------------------------------------------------------
+//[FREE GAIT] Instead of lifting the legs on the fixed schedule of the gait
+//      table, a leg is lifted when it is about to run out of stroke, as long
+//      as the body stays stable without it.  The swing itself is still done
+//      by Gait(), each leg just gets its own LegStep: it walks through the
+//      lifted positions of the current gait up to FrontDownPos and then stays
+//      at FREE_GAIT_STANCE, which Gait() treats as a normal stance step.
+//--------------------------------------------------------------------
+#ifdef OPT_FREE_GAIT
+#ifndef OPT_STABILITY_MARGIN
+#error OPT_FREE_GAIT needs OPT_STABILITY_MARGIN
+#endif
+#define FREE_GAIT_STANCE        0x7f    // LegStep that none of the swing cases in Gait() match
+#ifndef FREE_GAIT_MAX_STROKE
+#define FREE_GAIT_MAX_STROKE    60      // How far a foot may get from its home position, mm
+#endif
+#ifndef FREE_GAIT_LOOKAHEAD
+#define FREE_GAIT_LOOKAHEAD     24      // Max stance steps we look ahead
+#endif
+#ifndef cFreeGaitMinMargin
+#define cFreeGaitMinMargin      10      // Margin the other feet must leave before a leg is lifted, mm
+#endif
 
-  //Advance to the next step
-  g_InControlState.GaitStep++;
-  if (g_InControlState.GaitStep>g_InControlState.gaitCur.StepsInGait)
-    g_InControlState.GaitStep = 1;
+short           g_asFreeGaitStep[CNT_LEGS];     // LegStep per leg
+word            g_wFreeGaitLifts;               // Number of legs lifted
+word            g_wFreeGaitHolds;               // Times travel was held to wait for a leg
+boolean         g_fFreeGaitHold;                // Travel is held this step
 
-  // If we have a force count decrement it now... 
-  if (g_InControlState.ForceGaitStepCnt)
-    g_InControlState.ForceGaitStepCnt--;
+//--------------------------------------------------------------------
+// FreeGaitReset - Put all legs in stance, called when the mode changes.
+//--------------------------------------------------------------------
+void FreeGaitReset(void)
+{
+  for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++)
+    g_asFreeGaitStep[LegNr] = FREE_GAIT_STANCE;
+  g_fFreeGaitHold = false;
+}
+
+//--------------------------------------------------------------------
+// FreeGaitStepsLeft - How many more stance steps the leg can do at the
+//      current travel before the foot leaves its stroke or its reach.
+//      Each step moves the foot by the travel Gait() will use, which with
+//      OPT_TRAVEL_BLEND is the body travel on its way to TravelLength.
+//--------------------------------------------------------------------
+byte FreeGaitStepsLeft(byte LegNr)
+{
+  short   sTLDiv = g_InControlState.gaitCur.TLDivFactor;
+  long    lBX = (short)pgm_read_word(&cOffsetX[LegNr]) + ((LegNr < (CNT_LEGS/2))? -LegPosX[LegNr] : LegPosX[LegNr]);
+  long    lBZ = (short)pgm_read_word(&cOffsetZ[LegNr]) + LegPosZ[LegNr];
+  long    lGX = GaitPosX[LegNr];
+  long    lGZ = GaitPosZ[LegNr];
+  long    lRot = GaitRotY[LegNr];
+#ifdef OPT_TRAVEL_BLEND
+  short   sDiv = g_InControlState.gaitCur.TravelBlendDiv;
+  short   sTravelX = g_sBlendTravelX;
+  short   sTravelZ = g_sBlendTravelZ;
+  short   sTravelY = g_sBlendTravelY;
+#endif
+  byte    iStep;
+
+  for (iStep = 1; iStep <= FREE_GAIT_LOOKAHEAD; iStep++) {
+#ifdef OPT_TRAVEL_BLEND
+    if (sDiv > 1) {
+      sTravelX = TravelBlendOne(sTravelX, g_InControlState.TravelLength.x, sDiv);
+      sTravelZ = TravelBlendOne(sTravelZ, g_InControlState.TravelLength.z, sDiv);
+      sTravelY = TravelBlendOne(sTravelY, g_InControlState.TravelLength.y, sDiv);
+    }
+    else {
+      sTravelX = g_InControlState.TravelLength.x;
+      sTravelZ = g_InControlState.TravelLength.z;
+      sTravelY = g_InControlState.TravelLength.y;
+    }
+    lGX -= sTravelX / sTLDiv;
+    lGZ -= sTravelZ / sTLDiv;
+    lRot -= sTravelY / sTLDiv;
+#else
+    lGX -= g_InControlState.TravelLength.x / sTLDiv;
+    lGZ -= g_InControlState.TravelLength.z / sTLDiv;
+    lRot -= g_InControlState.TravelLength.y / sTLDiv;
+#endif
+    if ((lGX*lGX + lGZ*lGZ) > ((long)FREE_GAIT_MAX_STROKE*FREE_GAIT_MAX_STROKE))
+      break;
+    long lPX = lGX;
+    long lPZ = lGZ;
+    if (lRot) {
+      // Rotation moves the foot around the body center, like BodyFK does
+      GetSinCos(lRot*c1DEC);
+      lPX += ((lBX*cos4 - lBZ*sin4) / c4DEC) - lBX;
+      lPZ += ((lBX*sin4 + lBZ*cos4) / c4DEC) - lBZ;
+    }
+    if (!FootInReach(LegNr, 
+        LegPosX[LegNr] + ((LegNr < (CNT_LEGS/2))? -(g_InControlState.BodyPos.x + lPX) : (g_InControlState.BodyPos.x + lPX)),
+        LegPosY[LegNr] + g_InControlState.BodyPos.y,
+        LegPosZ[LegNr] + g_InControlState.BodyPos.z + lPZ))
+      break;
+  }
+  return iStep - 1;
 }
 
-
 //--------------------------------------------------------------------
-//[GAIT]
-void Gait (byte GaitCurrentLegNr)
+// FreeGaitPlan - Called by GaitSeq before the legs are moved.  Picks the
+//      leg in stance that will run out of stroke first, or when we are not
+//      traveling the one furthest from home, and lifts it if the support
+//      polygon of the other feet still has enough margin.  A leg that has
+//      no stroke left but is not lifted holds the travel until one of the
+//      lifted legs is down again.
+//--------------------------------------------------------------------
+void FreeGaitPlan(void)
 {
-
-  // Try to reduce the number of time we look at GaitLegnr and Gaitstep
-  short int LegStep = g_InControlState.GaitStep - g_InControlState.gaitCur.GaitLegNr[GaitCurrentLegNr];
-
-  //Leg middle up position OK
-  //Gait in motion	                                                                                  
-  // For Lifted pos = 1, 3, 5
-  if ((TravelRequest && (g_InControlState.gaitCur.NrLiftedPos&1) && 
-    LegStep==0) || (!TravelRequest && LegStep==0 && ((abs(GaitPosX[GaitCurrentLegNr])>2) || 
-    (abs(GaitPosZ[GaitCurrentLegNr])>2) || (abs(GaitRotY[GaitCurrentLegNr])>2)))) { //Up
-    GaitPosX[GaitCurrentLegNr] = 0;
-    GaitPosY[GaitCurrentLegNr] = -g_InControlState.LegLiftHeight;
-    GaitPosZ[GaitCurrentLegNr] = 0;
-    GaitRotY[GaitCurrentLegNr] = 0;
-  }
-  //Optional Half heigth Rear (2, 3, 5 lifted positions)
-  else if (((g_InControlState.gaitCur.NrLiftedPos==2 && LegStep==0) || (g_InControlState.gaitCur.NrLiftedPos>=3 && 
-    (LegStep==-1 || LegStep==(g_InControlState.gaitCur.StepsInGait-1))))
-    && TravelRequest) {
-    GaitPosX[GaitCurrentLegNr] = -g_InControlState.TravelLength.x/g_InControlState.gaitCur.LiftDivFactor;
-    GaitPosY[GaitCurrentLegNr] = -3*g_InControlState.LegLiftHeight/(3+g_InControlState.gaitCur.HalfLiftHeight);     //Easier to shift between div factor: /1 (3/3), /2 (3/6) and 3/4
-    GaitPosZ[GaitCurrentLegNr] = -g_InControlState.TravelLength.z/g_InControlState.gaitCur.LiftDivFactor;
-    GaitRotY[GaitCurrentLegNr] = -g_InControlState.TravelLength.y/g_InControlState.gaitCur.LiftDivFactor;
-  }    
-  // _A_	  
-  // Optional Half heigth front (2, 3, 5 lifted positions)
-  else if ((g_InControlState.gaitCur.NrLiftedPos>=2) && (LegStep==1 || LegStep==-(g_InControlState.gaitCur.StepsInGait-1)) && TravelRequest) {
-    GaitPosX[GaitCurrentLegNr] = g_InControlState.TravelLength.x/g_InControlState.gaitCur.LiftDivFactor;
-    GaitPosY[GaitCurrentLegNr] = -3*g_InControlState.LegLiftHeight/(3+g_InControlState.gaitCur.HalfLiftHeight); // Easier to shift between div factor: /1 (3/3), /2 (3/6) and 3/4
-    GaitPosZ[GaitCurrentLegNr] = g_InControlState.TravelLength.z/g_InControlState.gaitCur.LiftDivFactor;
-    GaitRotY[GaitCurrentLegNr] = g_InControlState.TravelLength.y/g_InControlState.gaitCur.LiftDivFactor;
+  byte    abLeft[CNT_LEGS];
+  byte    bSwingLegs = 0;
+  byte    iBest = 0xff;
+  short   sBest = 0;
+  short   sSwingStart;
+  boolean fTravel;
+
+  for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++)
+    if (g_asFreeGaitStep[LegNr] != FREE_GAIT_STANCE)
+      bSwingLegs |= (1 << LegNr);
+
+  // Swing goes through the lifted positions of the gait, -1 and -2 are the rear half height ones
+  sSwingStart = -((g_InControlState.gaitCur.NrLiftedPos - 1) / 2);
+  fTravel = (abs(g_InControlState.TravelLength.x)>cTravelDeadZone) 
+    || (abs(g_InControlState.TravelLength.z)>cTravelDeadZone) 
+    || (abs(g_InControlState.TravelLength.y)>cTravelDeadZone);
+
+  for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++) {
+    abLeft[LegNr] = FREE_GAIT_LOOKAHEAD;
+    if (bSwingLegs & (1 << LegNr))
+      continue;
+    if (fTravel) {
+      abLeft[LegNr] = FreeGaitStepsLeft(LegNr);
+      if ((iBest == 0xff) || (abLeft[LegNr] < sBest)) {
+        iBest = LegNr;
+        sBest = abLeft[LegNr];
+      }
+    }
+    else {
+      // Not going anywhere, bring the feet that are not home back one at a time
+      short sOff = abs(GaitPosX[LegNr]) + abs(GaitPosZ[LegNr]) + abs(GaitRotY[LegNr]);
+      if ((sOff > cGPlimit) && ((iBest == 0xff) || (sOff > sBest))) {
+        iBest = LegNr;
+        sBest = sOff;
+      }
+    }
   }
 
-  //Optional Half heigth Rear 5 LiftedPos (5 lifted positions)
-  else if (((g_InControlState.gaitCur.NrLiftedPos==5 && (LegStep==-2 ))) && TravelRequest) {
-    GaitPosX[GaitCurrentLegNr] = -g_InControlState.TravelLength.x/2;
-    GaitPosY[GaitCurrentLegNr] = -g_InControlState.LegLiftHeight/2;
-    GaitPosZ[GaitCurrentLegNr] = -g_InControlState.TravelLength.z/2;
-    GaitRotY[GaitCurrentLegNr] = -g_InControlState.TravelLength.y/2;
-  }  		
-
-  //Optional Half heigth Front 5 LiftedPos (5 lifted positions)
-  else if ((g_InControlState.gaitCur.NrLiftedPos==5) && (LegStep==2 || LegStep==-(g_InControlState.gaitCur.StepsInGait-2)) && TravelRequest) {
-    GaitPosX[GaitCurrentLegNr] = g_InControlState.TravelLength.x/2;
-    GaitPosY[GaitCurrentLegNr] = -g_InControlState.LegLiftHeight/2;
-    GaitPosZ[GaitCurrentLegNr] = g_InControlState.TravelLength.z/2;
-    GaitRotY[GaitCurrentLegNr] = g_InControlState.TravelLength.y/2;
-  }
-  //_B_
-  //Leg front down position //bug here?  From _A_ to _B_ there should only be one gaitstep, not 2!
-  //For example, where is the case of LegStep==0+2 executed when NRLiftedPos=3?
-  else if ((LegStep==g_InControlState.gaitCur.FrontDownPos || LegStep==-(g_InControlState.gaitCur.StepsInGait-g_InControlState.gaitCur.FrontDownPos)) && GaitPosY[GaitCurrentLegNr]<0) {
-    GaitPosX[GaitCurrentLegNr] = g_InControlState.TravelLength.x/2;
-    GaitPosZ[GaitCurrentLegNr] = g_InControlState.TravelLength.z/2;
-    GaitRotY[GaitCurrentLegNr] = g_InControlState.TravelLength.y/2;      	
-    GaitPosY[GaitCurrentLegNr] = 0;	
+  // Don't lift yet if the leg can still do a whole swing worth of stance steps
+  if ((iBest != 0xff) && (!fTravel || (sBest <= (g_InControlState.gaitCur.FrontDownPos - sSwingStart)))) {
+    if ((SupportMargin(g_bGroundedLegs & ~bSwingLegs & ~(1 << iBest)) >= cFreeGaitMinMargin)
+        || (!bSwingLegs && (!fTravel || (sBest == 0)))) {
+      // Either it is stable without the leg, or nothing else is lifted and it has to go now
+      g_asFreeGaitStep[iBest] = sSwingStart;
+      abLeft[iBest] = FREE_GAIT_LOOKAHEAD;
+      g_wFreeGaitLifts++;
+    }
   }
 
-  //Move body forward      
-  else {
-    GaitPosX[GaitCurrentLegNr] = GaitPosX[GaitCurrentLegNr] - (g_InControlState.TravelLength.x/(short)g_InControlState.gaitCur.TLDivFactor);
-    GaitPosY[GaitCurrentLegNr] = 0; 
-    GaitPosZ[GaitCurrentLegNr] = GaitPosZ[GaitCurrentLegNr] - (g_InControlState.TravelLength.z/(short)g_InControlState.gaitCur.TLDivFactor);
-    GaitRotY[GaitCurrentLegNr] = GaitRotY[GaitCurrentLegNr] - (g_InControlState.TravelLength.y/(short)g_InControlState.gaitCur.TLDivFactor);
+  // Any foot in stance that can't go any further holds the travel until it gets its turn
+  g_fFreeGaitHold = false;
+  for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++) {
+    if (fTravel && (abLeft[LegNr] == 0)) {
+      g_InControlState.TravelLength.x = 0;
+      g_InControlState.TravelLength.z = 0;
+      g_InControlState.TravelLength.y = 0;
+      g_fFreeGaitHold = true;     // TravelBlend stops the body at once
+      g_wFreeGaitHolds++;
+      break;
+    }
   }
+}
 
-}  
+//--------------------------------------------------------------------
+// FreeGaitAdvance - Move the lifted legs on to their next swing step, once
+//      a foot has been put down it is back in stance.
+//--------------------------------------------------------------------
+void FreeGaitAdvance(void)
+{
+  for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++) {
+    if (g_asFreeGaitStep[LegNr] != FREE_GAIT_STANCE) {
+      g_asFreeGaitStep[LegNr]++;
+      if (g_asFreeGaitStep[LegNr] > g_InControlState.gaitCur.FrontDownPos)
+        g_asFreeGaitStep[LegNr] = FREE_GAIT_STANCE;
+    }
+  }
+}
+#endif // OPT_FREE_GAIT
 
 //--------------------------------------------------------------------
 //[BalCalcOneLeg]
@@ -1585,6 +4636,43 @@ short GetATan2 (short AtanX, short AtanY)
   return Atan4;
 }    
 
+//--------------------------------------------------------------------
+//[CALC LEGS IK] Body FK and leg IK for all the legs, from the current
+//      LegPos, BodyPos, GaitPos and balance translation.  Also used by the
+//      host side gait optimizer, tools/gait_opt.cpp.
+//--------------------------------------------------------------------
+void CalcLegsIK(void)
+{
+  //Do IK for all Right legs
+  for (LegIndex = 0; LegIndex < (CNT_LEGS/2); LegIndex++) {    
+#ifndef OPT_BG_JOBS
+    DoBackgroundProcess();
+#endif
+    BodyFK(-LegPosX[LegIndex]+g_InControlState.BodyPos.x+GaitPosX[LegIndex] - TotalTransX,
+    LegPosZ[LegIndex]+g_InControlState.BodyPos.z+GaitPosZ[LegIndex] - TotalTransZ,
+    LegPosY[LegIndex]+g_InControlState.BodyPos.y+GaitPosY[LegIndex] - TotalTransY,
+    GaitRotY[LegIndex], LegIndex);
+
+    LegIK (LegPosX[LegIndex]-g_InControlState.BodyPos.x+BodyFKPosX-(GaitPosX[LegIndex] - TotalTransX), 
+    LegPosY[LegIndex]+g_InControlState.BodyPos.y-BodyFKPosY+GaitPosY[LegIndex] - TotalTransY,
+    LegPosZ[LegIndex]+g_InControlState.BodyPos.z-BodyFKPosZ+GaitPosZ[LegIndex] - TotalTransZ, LegIndex);
+  }
+
+  //Do IK for all Left legs  
+  for (LegIndex = (CNT_LEGS/2); LegIndex < CNT_LEGS; LegIndex++) {
+#ifndef OPT_BG_JOBS
+    DoBackgroundProcess();
+#endif
+    BodyFK(LegPosX[LegIndex]-g_InControlState.BodyPos.x+GaitPosX[LegIndex] - TotalTransX,
+    LegPosZ[LegIndex]+g_InControlState.BodyPos.z+GaitPosZ[LegIndex] - TotalTransZ,
+    LegPosY[LegIndex]+g_InControlState.BodyPos.y+GaitPosY[LegIndex] - TotalTransY,
+    GaitRotY[LegIndex], LegIndex);
+    LegIK (LegPosX[LegIndex]+g_InControlState.BodyPos.x-BodyFKPosX+GaitPosX[LegIndex] - TotalTransX,
+    LegPosY[LegIndex]+g_InControlState.BodyPos.y-BodyFKPosY+GaitPosY[LegIndex] - TotalTransY,
+    LegPosZ[LegIndex]+g_InControlState.BodyPos.z-BodyFKPosZ+GaitPosZ[LegIndex] - TotalTransZ, LegIndex);
+  }
+}
+
 //--------------------------------------------------------------------
 //(BODY INVERSE KINEMATICS) 
 //BodyRotX         - Global Input pitch of the body 
@@ -1805,14 +4893,20 @@ void LegIK (short IKFeetPosX, short IKFeetPosY, short IKFeetPosZ, byte LegIKLegN
 #endif
 
   //Set the Solution quality    
-  if(IKSW2 < ((word)((byte)pgm_read_byte(&cFemurLength[LegIKLegNr])+(byte)pgm_read_byte(&cTibiaLength[LegIKLegNr])-30)*c2DEC))
+  if(IKSW2 < ((word)((byte)pgm_read_byte(&cFemurLength[LegIKLegNr])+(byte)pgm_read_byte(&cTibiaLength[LegIKLegNr])-30)*c2DEC)) {
     IKSolution = 1;
+    g_abLegIKFlags[LegIKLegNr] = 1;
+  }
   else
   {
-    if(IKSW2 < ((word)((byte)pgm_read_byte(&cFemurLength[LegIKLegNr])+(byte)pgm_read_byte(&cTibiaLength[LegIKLegNr]))*c2DEC)) 
+    if(IKSW2 < ((word)((byte)pgm_read_byte(&cFemurLength[LegIKLegNr])+(byte)pgm_read_byte(&cTibiaLength[LegIKLegNr]))*c2DEC)) {
       IKSolutionWarning = 1;
-    else
+      g_abLegIKFlags[LegIKLegNr] = 2;
+    }
+    else {
       IKSolutionError = 1    ;
+      g_abLegIKFlags[LegIKLegNr] = 4;
+    }
   }
 #ifdef DEBUG
     if (g_fDebugOutput && g_InControlState.fRobotOn) {
@@ -1881,17 +4975,28 @@ void CheckAngles(void)
 {
 #ifndef SERVOS_DO_MINMAX
   short s = 0;      // BUGBUG just some index so we can get a hint who errored out
+  g_bClampedLegs = 0;
   for (LegIndex = 0; LegIndex < CNT_LEGS; LegIndex++)
   {
+    short sCoxa1 = CoxaAngle1[LegIndex];
+    short sFemur1 = FemurAngle1[LegIndex];
+    short sTibia1 = TibiaAngle1[LegIndex];
     CoxaAngle1[LegIndex]  = CheckServoAngleBounds(s++, CoxaAngle1[LegIndex], &cCoxaMin1[LegIndex], &cCoxaMax1[LegIndex]);
     FemurAngle1[LegIndex] = CheckServoAngleBounds(s++, FemurAngle1[LegIndex], &cFemurMin1[LegIndex], &cFemurMax1[LegIndex]);
     TibiaAngle1[LegIndex] = CheckServoAngleBounds(s++, TibiaAngle1[LegIndex], &cTibiaMin1[LegIndex], &cTibiaMax1[LegIndex]);
+    if ((sCoxa1 != CoxaAngle1[LegIndex]) || (sFemur1 != FemurAngle1[LegIndex]) || (sTibia1 != TibiaAngle1[LegIndex]))
+      g_bClampedLegs |= (1 << LegIndex);
 #ifdef c4DOF
     if ((byte)pgm_read_byte(&cTarsLength[LegIndex])) {    // We allow mix of 3 and 4 DOF legs...
+      short sTars1 = TarsAngle1[LegIndex];
       TarsAngle1[LegIndex] = CheckServoAngleBounds(s++, TarsAngle1[LegIndex], &cTarsMin1[LegIndex], &cTarsMax1[LegIndex]);
+      if (sTars1 != TarsAngle1[LegIndex])
+        g_bClampedLegs |= (1 << LegIndex);
     }
 #endif
   }
+#else
+  g_bClampedLegs = 0;
 #endif  
 }
 
@@ -2078,12 +5183,135 @@ void AdjustLegPositionsToBodyHeight()
 
 }
 
+#ifdef SOUND_PIN
+#ifdef OPT_TONE_ENGINE
+//==============================================================================
+//[TONE ENGINE] MSound only queues its notes.  The LEDC makes the tone on
+//      SOUND_PIN and a one shot esp_timer starts the next note when one is
+//      done, so a sound costs the control loop just the time to queue it.
+//==============================================================================
+#include <esp_timer.h>
+
+#ifndef TONE_LEDC_CHANNEL
+#define TONE_LEDC_CHANNEL   7       // LEDC channel used for the buzzer
+#endif
+#define TONE_QUEUE_SIZE     16      // Notes we can have waiting, a power of 2
+
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && (ESP_ARDUINO_VERSION_MAJOR >= 3)
+#define ToneWrite(wFreq)    ledcWriteTone(SOUND_PIN, (wFreq))
+#else
+#define ToneWrite(wFreq)    ledcWriteTone(TONE_LEDC_CHANNEL, (wFreq))
+#endif
+
+typedef struct _TONENOTE {
+  word        wDur;                 // ms
+  word        wFreq;                // Hz, 0 is a rest
+} TONENOTE;
+
+TONENOTE            g_aToneQueue[TONE_QUEUE_SIZE];
+byte                g_iToneHead;    // Where MSound adds the next note
+byte                g_iToneTail;    // Next note to play
+boolean             g_fTonePlaying; // Set while a note plays, whoever sets it starts the player
+esp_timer_handle_t  g_hToneTimer;
+portMUX_TYPE        g_muxTone = portMUX_INITIALIZER_UNLOCKED;
+
+//--------------------------------------------------------------------
+// ToneNextNote - Plays the next queued note or goes quiet when there is
+//      none.  Only called by whoever owns the player: MSound when it
+//      started it, else the timer at the end of a note.
+//--------------------------------------------------------------------
+void ToneNextNote(void)
+{
+  TONENOTE note;
+  boolean fNote;
+
+  for (;;) {
+    portENTER_CRITICAL(&g_muxTone);
+    fNote = (g_iToneTail != g_iToneHead);
+    if (fNote) {
+      note = g_aToneQueue[g_iToneTail];
+      g_iToneTail = (g_iToneTail + 1) & (TONE_QUEUE_SIZE - 1);
+    }
+    portEXIT_CRITICAL(&g_muxTone);
+
+    if (fNote) {
+      ToneWrite(note.wFreq);
+      esp_timer_start_once(g_hToneTimer, (uint64_t)max(note.wDur, 1) * 1000);
+      return;
+    }
+
+    // Go quiet first, then give up the player unless a note came in meanwhile
+    ToneWrite(0);
+    portENTER_CRITICAL(&g_muxTone);
+    fNote = (g_iToneTail != g_iToneHead);
+    if (!fNote)
+      g_fTonePlaying = false;
+    portEXIT_CRITICAL(&g_muxTone);
+    if (!fNote)
+      return;
+  }
+}
+
+void ToneTimerCallback(void *)
+{
+  ToneNextNote();
+}
+
+void ToneInit(void)
+{
+  esp_timer_create_args_t targs = {};
+  targs.callback = ToneTimerCallback;
+  targs.name = "tone";
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && (ESP_ARDUINO_VERSION_MAJOR >= 3)
+  ledcAttachChannel(SOUND_PIN, 2000, 8, TONE_LEDC_CHANNEL);
+#else
+  ledcSetup(TONE_LEDC_CHANNEL, 2000, 8);
+  ledcAttachPin(SOUND_PIN, TONE_LEDC_CHANNEL);
+#endif
+  ToneWrite(0);
+  esp_timer_create(&targs, &g_hToneTimer);
+}
+
+//--------------------------------------------------------------------
+// MSound - Same calls as before: cNotes pairs of duration (ms) and
+//      frequency.  Notes that do not fit in the queue are dropped.
+//--------------------------------------------------------------------
+void MSound(byte cNotes, ...)
+{
+  va_list ap;
+  byte iNext;
+  boolean fStart;
+
+  if (!g_hToneTimer)
+    ToneInit();
+
+  va_start(ap, cNotes);
+  portENTER_CRITICAL(&g_muxTone);
+  while (cNotes > 0) {
+    TONENOTE note;
+    note.wDur = va_arg(ap, unsigned int);
+    note.wFreq = va_arg(ap, unsigned int);
+    iNext = (g_iToneHead + 1) & (TONE_QUEUE_SIZE - 1);
+    if (iNext != g_iToneTail) {
+      g_aToneQueue[g_iToneHead] = note;
+      g_iToneHead = iNext;
+    }
+    cNotes--;
+  }
+  fStart = !g_fTonePlaying;
+  g_fTonePlaying = true;
+  portEXIT_CRITICAL(&g_muxTone);
+  va_end(ap);
+
+  if (fStart)
+    ToneNextNote();
+}
+#else
 // BUGBUG:: Move to some library...
 //==============================================================================
 //    SoundNoTimer - Quick and dirty tone function to try to output a frequency
 //            to a speaker for some simple sounds.
 //==============================================================================
-#ifdef SOUND_PIN
 void SoundNoTimer(unsigned long duration,  unsigned int frequency)
 {
 #ifndef __MK20DX256__
@@ -2112,7 +5340,7 @@ void SoundNoTimer(unsigned long duration,  unsigned int frequency)
     *pin_port ^= pin_mask;
 
     // delay a half cycle
-    delayMicroseconds(lusDelayPerHalfCycle);
+    ClockDelayUs(lusDelayPerHalfCycle);
   }    
   *pin_port &= ~(pin_mask);  // keep pin low after stop
 #else
@@ -2135,7 +5363,7 @@ void SoundNoTimer(unsigned long duration,  unsigned int frequency)
     fHigh  = !fHigh;
     digitalWrite(SOUND_PIN, fHigh? LOW : HIGH);
     // delay a half cycle
-    delayMicroseconds(lusDelayPerHalfCycle);
+    ClockDelayUs(lusDelayPerHalfCycle);
   }    
   digitalWrite(SOUND_PIN, LOW);
 
@@ -2157,6 +5385,7 @@ void MSound(byte cNotes, ...)
   }
   va_end(ap);
 }
+#endif // OPT_TONE_ENGINE
 #else
 void MSound(byte cNotes, ...)
 {
@@ -2173,6 +5402,12 @@ extern void UpdateGaitCmd(byte *pszCmdLine);
 #ifdef OPT_DYNAMIC_ADJUST_LEGS
 extern void UpdateInitialPosAndAngCmd(byte *pszCmdLine);
 #endif
+#ifdef OPT_GAIT_STORE
+extern void GaitStoreCmd(byte *pszCmdLine);
+#endif
+#ifdef OPT_GAIT_TRACE
+extern void TraceCmd(byte *pszCmdLine);
+#endif
 
 //==============================================================================
 // TerminalMonitor - Simple background task checks to see if the user is asking
@@ -2180,7 +5415,7 @@ extern void UpdateInitialPosAndAngCmd(byte *pszCmdLine);
 //==============================================================================
 boolean TerminalMonitor(void)
 {
-  byte szCmdLine[20];  // currently pretty simple command lines...
+  byte szCmdLine[64];  // currently pretty simple command lines, gait edits are the longest...
   byte ich;
   int ch;
   // See if we need to output a prompt.
@@ -2197,6 +5432,49 @@ boolean TerminalMonitor(void)
 #ifdef OPT_DYNAMIC_ADJUST_LEGS
     DBGSerial.println(F("I pos ang"));
 #endif
+#ifdef OPT_GAIT_STORE
+#ifdef OPT_TRAVEL_BLEND
+    DBGSerial.println(F("N [L|S|X slot] [E Sp St NL FD LD TL HH legs... [BL]] - Stored gaits"));
+#else
+    DBGSerial.println(F("N [L|S|X slot] [E Sp St NL FD LD TL HH legs...] - Stored gaits"));
+#endif
+#endif
+#ifdef OPT_STRIDE_LIMIT
+    DBGSerial.println(F("L - Show stride envelope"));
+#endif
+#ifdef OPT_STABILITY_MARGIN
+    DBGSerial.println(F("M - Show stability margin"));
+#endif
+#ifdef OPT_FREE_GAIT
+    DBGSerial.println(F("F - Toggle free gait"));
+#endif
+#ifdef OPT_GAIT_CACHE
+    DBGSerial.println(F("C - Show gait cache"));
+#endif
+#ifdef OPT_ODOMETRY
+    DBGSerial.println(F("P [R] - Show odometry position, R resets it"));
+#endif
+#ifdef OPT_GAIT_TRACE
+    DBGSerial.println(F("R [S|X|D] - Gait trace start, stop, dump"));
+#endif
+#ifdef OPT_CTRL_TICK
+    DBGSerial.println(F("J - Show control tick jitter and reset it"));
+#endif
+#ifdef OPT_PIPELINE
+    DBGSerial.println(F("T - Show pipeline stage times and reset them"));
+#endif
+#ifdef OPT_BG_JOBS
+    DBGSerial.println(F("K - Show background job times and reset them"));
+#endif
+#ifdef OPT_FRAME_DEADLINE
+    DBGSerial.println(F("W - Show frame deadline misses and reset them"));
+#endif
+#ifdef OPT_ESTOP
+    DBGSerial.println(F("X [S] - Show emergency stop latency and reset it, S fires a test stop"));
+#endif
+#ifdef OPT_CPU_GOVERNOR
+    DBGSerial.println(F("V [L] - Show CPU governor and reset it, L toggles a load line per window"));
+#endif
 #ifdef OPT_TERMINAL_MONITOR_IC    // Allow the input controller to define stuff as well
     g_InputController.ShowTerminalCommandList(); 
 #endif      
@@ -2211,7 +5489,7 @@ boolean TerminalMonitor(void)
     ich = 0;
     // For now assume we receive a packet of data from serial monitor, as the user has
     // to click the send button...
-    for (ich=0; ich < sizeof(szCmdLine); ich++) {
+    for (ich=0; ich < (sizeof(szCmdLine)-1); ich++) {
       ch = DBGSerial.read();        // get the next character
       if ((ch == -1) || ((ch >= 10) && (ch <= 15)))
         break;
@@ -2258,6 +5536,139 @@ boolean TerminalMonitor(void)
       UpdateInitialPosAndAngCmd(szCmdLine);
     } 
 #endif
+#ifdef OPT_GAIT_STORE
+    else if (((szCmdLine[0] == 'n') || (szCmdLine[0] == 'N'))) {
+      GaitStoreCmd(szCmdLine);
+    } 
+#endif
+#ifdef OPT_STRIDE_LIMIT
+    else if ((ich == 1) && ((szCmdLine[0] == 'l') || (szCmdLine[0] == 'L'))) {
+      g_fStrideKeyValid = false;    // Force it to be recalculated
+      StrideEnvelopeUpdate();
+      DBGSerial.print(F("Stride max (mm) 0-180 deg:"));
+      for (byte iDir = 0; iDir < STRIDE_DIRS; iDir++) {
+        DBGSerial.print(" ");
+        DBGSerial.print(g_asStrideMax[iDir], DEC);
+      }
+      DBGSerial.print(F(" Rot: "));
+      DBGSerial.print(g_sStrideRotMax, DEC);
+      DBGSerial.print(F(" Excursion%: "));
+      DBGSerial.print(g_bStrideExcursion, DEC);
+      DBGSerial.print(F(" Last scale%: "));
+      DBGSerial.println(g_bStridePct, DEC);
+    } 
+#endif
+#ifdef OPT_STABILITY_MARGIN
+    else if ((ich == 1) && ((szCmdLine[0] == 'm') || (szCmdLine[0] == 'M'))) {
+      CalcStabilityMargin();
+      DBGSerial.print(F("Stability margin: "));
+      DBGSerial.print(g_sStabilityMargin, DEC);
+      DBGSerial.print(F(" Grounded: "));
+      DBGSerial.println(g_bGroundedLegs, HEX);
+      for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++) {
+        DBGSerial.print(F("  "));
+        DBGSerial.print(g_asFootX[LegNr], DEC);
+        DBGSerial.print(",");
+        DBGSerial.println(g_asFootZ[LegNr], DEC);
+      }
+    } 
+#endif
+#ifdef OPT_FREE_GAIT
+    else if ((ich == 1) && ((szCmdLine[0] == 'f') || (szCmdLine[0] == 'F'))) {
+      g_InControlState.fFreeGait = !g_InControlState.fFreeGait;
+      FreeGaitReset();
+      if (g_InControlState.fFreeGait) 
+        DBGSerial.print(F("Free gait is on"));
+      else
+        DBGSerial.print(F("Free gait is off"));
+      DBGSerial.print(F(" Lifts: "));
+      DBGSerial.print(g_wFreeGaitLifts, DEC);
+      DBGSerial.print(F(" Holds: "));
+      DBGSerial.println(g_wFreeGaitHolds, DEC);
+    } 
+#endif
+#ifdef OPT_GAIT_CACHE
+    else if ((ich == 1) && ((szCmdLine[0] == 'c') || (szCmdLine[0] == 'C'))) {
+      byte cSteps = 0;
+      for (byte iStep = 0; iStep < MAX_STEPS_IN_GAIT; iStep++)
+        if (g_ullGaitCacheFilled & (1ULL << iStep))
+          cSteps++;
+      DBGSerial.print(F("Gait cache: "));
+      DBGSerial.print(cSteps, DEC);
+      DBGSerial.print(F(" of "));
+      DBGSerial.print(g_InControlState.gaitCur.StepsInGait, DEC);
+      DBGSerial.print(F(" steps, "));
+      DBGSerial.print((unsigned long)(sizeof(g_aGaitKeyFrames) + sizeof(g_GaitCacheKey)), DEC);
+      DBGSerial.print(F(" bytes Hits: "));
+      DBGSerial.print(g_ulGaitCacheHits, DEC);
+      DBGSerial.print(F(" Misses: "));
+      DBGSerial.print(g_ulGaitCacheMisses, DEC);
+      if (g_ulGaitCacheHits + g_ulGaitCacheMisses) {
+        DBGSerial.print(F(" ("));
+        DBGSerial.print((g_ulGaitCacheHits * 100) / (g_ulGaitCacheHits + g_ulGaitCacheMisses), DEC);
+        DBGSerial.print(F("%)"));
+      }
+      DBGSerial.print(F(" Flushes: "));
+      DBGSerial.println(g_ulGaitCacheFlushes, DEC);
+      g_ulGaitCacheHits = 0;
+      g_ulGaitCacheMisses = 0;
+      g_ulGaitCacheFlushes = 0;
+    } 
+#endif
+#ifdef OPT_ODOMETRY
+    else if (((szCmdLine[0] == 'p') || (szCmdLine[0] == 'P')) && ((ich == 1) || (szCmdLine[1] == ' '))) {
+      if ((ich > 2) && ((szCmdLine[2] == 'r') || (szCmdLine[2] == 'R')))
+        OdometryReset();
+      PrintOdometry();
+    } 
+#endif
+#ifdef OPT_GAIT_TRACE
+    else if (((szCmdLine[0] == 'r') || (szCmdLine[0] == 'R')) && ((ich == 1) || (szCmdLine[1] == ' '))) {
+      TraceCmd(szCmdLine);
+    } 
+#endif
+#ifdef OPT_CTRL_TICK
+    else if ((ich == 1) && ((szCmdLine[0] == 'j') || (szCmdLine[0] == 'J'))) {
+      PrintCtrlTick();
+      CtrlTickResetStats();
+    } 
+#endif
+#ifdef OPT_PIPELINE
+    else if ((ich == 1) && ((szCmdLine[0] == 't') || (szCmdLine[0] == 'T'))) {
+      PrintPipeline();
+      PipelineResetStats();
+    } 
+#endif
+#ifdef OPT_BG_JOBS
+    else if ((ich == 1) && ((szCmdLine[0] == 'k') || (szCmdLine[0] == 'K'))) {
+      PrintBGJobs();
+      BGJobsResetStats();
+    } 
+#endif
+#ifdef OPT_FRAME_DEADLINE
+    else if ((ich == 1) && ((szCmdLine[0] == 'w') || (szCmdLine[0] == 'W'))) {
+      PrintFrameDeadline();
+      FrameDeadlineResetStats();
+    } 
+#endif
+#ifdef OPT_ESTOP
+    else if (((szCmdLine[0] == 'x') || (szCmdLine[0] == 'X')) && ((ich == 1) || (szCmdLine[1] == ' '))) {
+      if ((ich > 2) && ((szCmdLine[2] == 's') || (szCmdLine[2] == 'S'))) {
+        EStopTrigger();
+        ClockDelayMs(50);   // Let the e-stop task send it
+      }
+      PrintEStop();
+      EStopResetStats();
+    } 
+#endif
+#ifdef OPT_CPU_GOVERNOR
+    else if (((szCmdLine[0] == 'v') || (szCmdLine[0] == 'V')) && ((ich == 1) || (szCmdLine[1] == ' '))) {
+      if ((ich > 2) && ((szCmdLine[2] == 'l') || (szCmdLine[2] == 'L')))
+        g_fGovLog = !g_fGovLog;
+      PrintGovernor();
+      GovernorResetStats();
+    } 
+#endif
 #ifdef OPT_TERMINAL_MONITOR_IC    // Allow the input controller to define stuff as well
     else if (g_InputController.ProcessTerminalCommand(szCmdLine, ich)) 
       ;  // See if the Input controller has added commands...
@@ -2317,7 +5728,11 @@ void DumpEEPROM() {
 
 //--------------------------------------------------------------------
 // GetCmdLineNum - passed pointer to pointer so we can update...
+//      A number that does not fit stops growing at CMD_LINE_NUM_MAX
+//      instead of overflowing the long.
 //--------------------------------------------------------------------
+#define CMD_LINE_NUM_MAX    0x8000000L
+
 long GetCmdLineNum(byte **ppszCmdLine) {
   byte *psz = *ppszCmdLine;
   long iVal = 0;
@@ -2332,7 +5747,13 @@ long GetCmdLineNum(byte **ppszCmdLine) {
     // Hex mode
     psz += 2;  // get over 0x
     for (;;) {
-      if ((*psz >= '0') && (*psz <= '9'))
+      if (iVal >= CMD_LINE_NUM_MAX) {
+        if (isxdigit(*psz))
+          psz++;          // Too big already, it stays out of range of any field
+        else
+          break;
+      }
+      else if ((*psz >= '0') && (*psz <= '9'))
         iVal = iVal * 16 + *psz++ - '0';
       else if ((*psz >= 'a') && (*psz <= 'f'))
         iVal = iVal * 16 + *psz++ - 'a' + 10;
@@ -2350,8 +5771,11 @@ long GetCmdLineNum(byte **ppszCmdLine) {
         psz++;
     }    
         
-    while ((*psz >= '0') && (*psz <= '9'))
-      iVal = iVal * 10 + *psz++ - '0';
+    while ((*psz >= '0') && (*psz <= '9')) {
+      if (iVal < CMD_LINE_NUM_MAX)
+        iVal = iVal * 10 + *psz - '0';
+      psz++;
+    }
   }
   *ppszCmdLine = psz;    // update command line pointer
   return iSign * iVal;
@@ -2488,4 +5912,226 @@ void UpdateInitialPosAndAngCmd(byte *pszCmdLine) {
 }
 #endif
 
+#ifdef OPT_GAIT_STORE
+//--------------------------------------------------------------------
+// GetCmdLineByte, GetCmdLineShort - GetCmdLineNum for a gait field, clear
+//      *pfOk if the number does not fit in it instead of storing the low bits.
+//--------------------------------------------------------------------
+byte GetCmdLineByte(byte **ppszCmdLine, boolean *pfOk) {
+  long lVal = GetCmdLineNum(ppszCmdLine);
+  if ((lVal < 0) || (lVal > 255)) {
+    *pfOk = false;
+    return 0;
+  }
+  return (byte)lVal;
+}
+
+short GetCmdLineShort(byte **ppszCmdLine, boolean *pfOk) {
+  long lVal = GetCmdLineNum(ppszCmdLine);
+  if ((lVal < -32768L) || (lVal > 32767L)) {
+    *pfOk = false;
+    return 0;
+  }
+  return (short)lVal;
+}
+
+//--------------------------------------------------------------------
+// GaitStoreCmd - Terminal access to the gait store
+//    N                 - List the built in and stored gaits
+//    N L <slot>        - Load a stored gait and make it current
+//    N E <fields>      - Edit the current gait, same order as APG entries,
+//                        the travel blend steps can be left off
+//    N S <slot>        - Save the current gait into a slot
+//    N X <slot>        - Delete a slot
+//--------------------------------------------------------------------
+void GaitStoreCmd(byte *pszCmdLine) {
+  byte bCmd;
+  byte iSlot;
+  long lSlot;
+  boolean fOk = true;
+  PHOENIXGAIT gait;
+
+  pszCmdLine++;   // Get past the command letter
+  while (*pszCmdLine == ' ')
+    pszCmdLine++;
+  bCmd = *pszCmdLine;
+  if (bCmd)
+    pszCmdLine++;
+
+  if (!bCmd) {
+    for (byte iGait = 0; iGait < NUM_GAITS; iGait++) {
+      DBGSerial.print((iGait == g_InControlState.GaitType)? "*" : " ");
+      DBGSerial.print(iGait, DEC);
+      if (iGait < CNT_BUILTIN_GAITS) {
+        PHOENIXGAIT *pgait;
+        DBGSerial.print(F("    "));
+#ifdef ADD_GAITS
+        if (iGait < (sizeof(APG_EXTRA)/sizeof(APG_EXTRA[0])))
+          pgait = &APG_EXTRA[iGait];
+        else
+          pgait = &APG[iGait - (sizeof(APG_EXTRA)/sizeof(APG_EXTRA[0]))];
+#else
+        pgait = &APG[iGait];
+#endif
+        PrintGait(pgait);
+      }
+      else {
+        iSlot = GaitStoreSlotFromIndex(iGait - CNT_BUILTIN_GAITS);
+        DBGSerial.print(F(" S"));
+        DBGSerial.print(iSlot, DEC);
+        DBGSerial.print(F(" "));
+        PrintGait(&g_aStoredGaits[iSlot]);
+      }
+    }
+    DBGSerial.print(F("Current: "));
+    PrintGait(&g_InControlState.gaitCur);
+    return;
+  }
+
+  if ((bCmd == 'e') || (bCmd == 'E')) {
+    if (fWalking) {
+      DBGSerial.println(F("Stop walking first"));
+      return;
+    }
+    gait = g_InControlState.gaitCur;
+    gait.NomGaitSpeed = GetCmdLineShort(&pszCmdLine, &fOk);
+    gait.StepsInGait = GetCmdLineByte(&pszCmdLine, &fOk);
+    gait.NrLiftedPos = GetCmdLineByte(&pszCmdLine, &fOk);
+    gait.FrontDownPos = GetCmdLineByte(&pszCmdLine, &fOk);
+    gait.LiftDivFactor = GetCmdLineByte(&pszCmdLine, &fOk);
+    gait.TLDivFactor = GetCmdLineByte(&pszCmdLine, &fOk);
+    gait.HalfLiftHeight = GetCmdLineByte(&pszCmdLine, &fOk);
+    for (byte il = 0; il < CNT_LEGS; il++)
+      gait.GaitLegNr[il] = GetCmdLineByte(&pszCmdLine, &fOk);
+#ifdef OPT_TRAVEL_BLEND
+    while (*pszCmdLine == ' ')
+      pszCmdLine++;
+    if (*pszCmdLine)
+      gait.TravelBlendDiv = GetCmdLineByte(&pszCmdLine, &fOk);   // Optional, keep the current one
+#endif
+    if (!fOk)
+      DBGSerial.println(F("Number out of range"));
+    else if (ValidateGait(&gait, true)) {
+      g_InControlState.gaitCur = gait;
+      g_InControlState.GaitStep = 1;
+      PrintGait(&g_InControlState.gaitCur);
+    }
+    return;
+  }
+
+  lSlot = GetCmdLineNum(&pszCmdLine);
+  if ((lSlot < 0) || (lSlot >= MAX_STORED_GAITS)) {
+    DBGSerial.println(F("Invalid slot"));
+    return;
+  }
+  iSlot = (byte)lSlot;
+
+  if ((bCmd == 'l') || (bCmd == 'L')) {
+    if (fWalking) 
+      DBGSerial.println(F("Stop walking first"));
+    else if (!(g_bStoredGaitMask & (1 << iSlot)))
+      DBGSerial.println(F("Slot empty"));
+    else {
+      g_InControlState.GaitType = GaitStoreIndexFromSlot(iSlot);
+      g_InControlState.GaitStep = 1;
+      GaitSelect();
+      PrintGait(&g_InControlState.gaitCur);
+    }
+  }
+  else if ((bCmd == 's') || (bCmd == 'S')) {
+    if (GaitStoreSave(iSlot, &g_InControlState.gaitCur)) {
+      DBGSerial.print(F("Saved to slot "));
+      DBGSerial.println(iSlot, DEC);
+    }
+    else
+      DBGSerial.println(F("Save failed"));
+  }
+  else if ((bCmd == 'x') || (bCmd == 'X')) {
+    GaitStoreDelete(iSlot);
+    DBGSerial.println(F("Deleted"));
+  }
+}
+#endif // OPT_GAIT_STORE
+
+#ifdef OPT_GAIT_TRACE
+//--------------------------------------------------------------------
+// TraceCmd - Terminal access to the gait trace
+//    R                 - Show the state of the recorder
+//    R S               - Clear the ring and start recording
+//    R X               - Stop recording
+//    R D               - Dump the ring, oldest record first
+//    The dump starts with a header line with the layout, then one line per
+//    record with all fields as big endian hex in the order of TRACEREC.
+//--------------------------------------------------------------------
+void TraceHex(unsigned long ul, byte cDigits)
+{
+  while (cDigits--) {
+    byte b = (ul >> (cDigits * 4)) & 0xf;
+    DBGSerial.print((char)((b < 10)? ('0' + b) : ('A' + b - 10)));
+  }
+}
+
+void TraceCmd(byte *pszCmdLine) {
+  byte bCmd;
+
+  pszCmdLine++;   // Get past the command letter
+  while (*pszCmdLine == ' ')
+    pszCmdLine++;
+  bCmd = *pszCmdLine;
+
+  if ((bCmd == 's') || (bCmd == 'S')) {
+    g_wTraceHead = 0;
+    g_wTraceCount = 0;
+    g_fTraceOn = true;
+  }
+  else if ((bCmd == 'x') || (bCmd == 'X')) 
+    g_fTraceOn = false;
+  else if ((bCmd == 'd') || (bCmd == 'D')) {
+    word iRec = (g_wTraceCount < TRACE_RECORDS)? 0 : g_wTraceHead;
+    DBGSerial.print(F("#TRACE "));
+    DBGSerial.print(TRACE_VERSION, DEC);
+    DBGSerial.print(F(" legs="));
+    DBGSerial.print(CNT_LEGS, DEC);
+    DBGSerial.print(F(" dof="));
+    DBGSerial.print(TRACE_DOF, DEC);
+    DBGSerial.print(F(" n="));
+    DBGSerial.println(g_wTraceCount, DEC);
+    for (word i = 0; i < g_wTraceCount; i++) {
+      TRACEREC *ptr = &g_aTrace[iRec];
+      DBGSerial.print(F("T "));
+      TraceHex(ptr->lTime, 8);
+      TraceHex(ptr->wMoveTime, 4);
+      TraceHex(ptr->bGaitType, 2);
+      TraceHex(ptr->bGaitStep, 2);
+      TraceHex(ptr->bClampedLegs, 2);
+      for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++)
+        TraceHex(ptr->abIKFlags[LegNr], 2);
+      for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++)
+        for (byte j = 0; j < 4; j++)
+          TraceHex((word)ptr->asGaitPos[LegNr][j], 4);
+      for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++)
+        for (byte j = 0; j < 3; j++)
+          TraceHex((word)ptr->asLegPos[LegNr][j], 4);
+      for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++)
+        for (byte j = 0; j < TRACE_DOF; j++)
+          TraceHex((word)ptr->asAngle1[LegNr][j], 4);
+      DBGSerial.println();
+      if (++iRec >= TRACE_RECORDS)
+        iRec = 0;
+    }
+    DBGSerial.println(F("#END"));
+    return;
+  }
+
+  DBGSerial.print(F("Trace "));
+  DBGSerial.print(g_fTraceOn? F("on ") : F("off "));
+  DBGSerial.print(g_wTraceCount, DEC);
+  DBGSerial.print(F(" of "));
+  DBGSerial.print(TRACE_RECORDS, DEC);
+  DBGSerial.print(F(" records, "));
+  DBGSerial.print((unsigned long)sizeof(g_aTrace), DEC);
+  DBGSerial.println(F(" bytes"));
+}
+#endif // OPT_GAIT_TRACE
+
 #endif
@@ -51,21 +51,16 @@ const byte cTarsPin[] PROGMEM = {
 // definition of some helper functions
 extern int SSCRead (byte* pb, int cb, word wTimeout, word wEOL);
 
+#if defined(OPT_GPPLAYER) && defined(OPT_FAST_BOOT)
+int64_t g_llSSCQPLTime;     // When Init asked QPL0, InitFinish reads the answer
+#endif
+
 
 //--------------------------------------------------------------------
 //Init
 //--------------------------------------------------------------------
 void ServoDriver::Init(void) {
 
-
-  // Lets do the check for GP Enabled here...
-#ifdef OPT_GPPLAYER
-  char abT[4];        // give a nice large buffer.
-  byte cbRead;
-
-  _fGPEnabled = false;  // starts off assuming that it is not enabled...
-  _fGPActive = false;
-
 // START SERIAL COMMUNICATION
 #ifdef ESP32
   // We initialize Serial2 here inside the function scope
@@ -82,6 +77,12 @@ void ServoDriver::Init(void) {
 #endif    
 #endif    
 #endif
+
+  // Lets do the check for GP Enabled here...
+#ifdef OPT_GPPLAYER
+  _fGPEnabled = false;  // starts off assuming that it is not enabled...
+  _fGPActive = false;
+
   // Instead of hard checking version numbers instead ask it for
   // status of one of the players.  If we do not get a response...
   // probably does not support 
@@ -90,7 +91,30 @@ void ServoDriver::Init(void) {
 #else
   SSCSerial.println(F("QPL0"));
 #endif
-  cbRead = SSCRead((byte*)abT, 4, 25000, (word)-1);
+#ifdef OPT_FAST_BOOT
+  g_llSSCQPLTime = ClockUs();   // The rest of setup runs while it answers
+#else
+  InitGPCheck(25000);
+#endif
+#endif
+#ifdef cVoltagePin
+  // Prime the voltage values...
+  for (byte i=0; i < 8; i++)
+	GetBatteryVoltage();
+	
+#endif
+}
+
+#ifdef OPT_GPPLAYER
+//--------------------------------------------------------------------
+//InitGPCheck - Reads the answer to the QPL0 Init sent, a GP player
+// sends 4 bytes.
+//--------------------------------------------------------------------
+void ServoDriver::InitGPCheck(word wTimeout) {
+  char abT[4];        // give a nice large buffer.
+  byte cbRead;
+
+  cbRead = SSCRead((byte*)abT, 4, wTimeout, (word)-1);
 
 #ifdef DBGSerial
   DBGSerial.print(F("Check GP Enable: "));
@@ -100,14 +124,21 @@ void ServoDriver::Init(void) {
     _fGPEnabled = true;  // starts off assuming that it is not enabled...
   else
     MSound (2, 40, 2500, 40, 2500);
+}
 #endif
-#ifdef cVoltagePin
-  // Prime the voltage values...
-  for (byte i=0; i < 8; i++)
-	GetBatteryVoltage();
-	
+
+#ifdef OPT_FAST_BOOT
+//--------------------------------------------------------------------
+//InitFinish - Called at the end of setup, the part of Init that had to
+// wait on the SSC-32 gets what is left of its 25ms.
+//--------------------------------------------------------------------
+void ServoDriver::InitFinish(void) {
+#ifdef OPT_GPPLAYER
+  long lLeft = 25000 - (long)(ClockUs() - g_llSSCQPLTime);
+  InitGPCheck((word)max(lLeft, 1L));
 #endif
 }
+#endif
 //--------------------------------------------------------------------
 //GetBatteryVoltage - Maybe should try to minimize when this is called
 // as it uses the serial port... Maybe only when we are not interpolating 
@@ -148,11 +179,11 @@ int SSCRead (byte* pb, int cb, word wTimeout, word wEOL)
 {
   int ich;
   byte* pbIn = pb;
-  unsigned long ulTimeLastChar = micros();
+  int64_t llTimeLastChar = ClockUs();
   while (cb) {
     while (!SSCSerial.available()) {
       // check for timeout
-      if ((word)(micros()-ulTimeLastChar) > wTimeout) {
+      if ((ClockUs() - llTimeLastChar) > wTimeout) {
         return (int)(pb-pbIn);
       }    
     }
@@ -162,7 +193,7 @@ int SSCRead (byte* pb, int cb, word wTimeout, word wEOL)
 
     if ((word)ich == wEOL)
       break;    // we matched so get out of here.
-    ulTimeLastChar = micros();    // update to say we received something
+    llTimeLastChar = ClockUs();    // update to say we received something
   }
 
   return (int)(pb-pbIn);
@@ -233,7 +264,7 @@ void ServoDriver::GPPlayer(void)
         // Since we are monitoring GP Sequence we no longer tell it to only run once...
         SSCSerial.print(F("PL0SQ"));
         SSCSerial.println(_iSeq, DEC);
-        delay(20);
+        ClockDelayMs(20);
         while (SSCSerial.read() != -1)    // remove anything that was queued up.
           ;
         g_InputController.AllowControllerInterrupts(true);    
@@ -313,11 +344,153 @@ void ServoDriver::GPSetSpeedMultiplyer(short sm)      // Set the Speed multiplie
 
 #endif // OPT_GPPLAYER
 
+//------------------------------------------------------------------------------------------
+// With OPT_PIPELINE the servo commands of a frame and its commit are collected
+// in the frame buffer g_pServoFrame, the transport task writes them out at the
+// right time.
+//------------------------------------------------------------------------------------------
+#ifdef OPT_PIPELINE
+class ServoFramePrint : public Print {
+public:
+  size_t write(uint8_t b) {
+    if (g_pServoFrame->cb >= SERVO_FRAME_MAX)
+      return 0;
+    g_pServoFrame->ab[g_pServoFrame->cb++] = b;
+    return 1;
+  }
+  using Print::write;
+};
+ServoFramePrint g_ServoFramePrint;
+#define SSCFrameOut   g_ServoFramePrint
+#else
+#define SSCFrameOut   Serial2
+#endif
+
+#ifdef OPT_SSC_FRAME_ASM
+//------------------------------------------------------------------------------------------
+//[FRAME ASSEMBLER] The servo commands of a frame and the commit are encoded
+// straight into one buffer, the pipeline frame or our own.  The pipeline sends
+// it in one write, else the legs go out before the wait and the commit after.
+// The A command shows the bytes per frame and the encode time.
+//------------------------------------------------------------------------------------------
+#ifdef OPT_PIPELINE
+#define SSCAsmBuf           (g_pServoFrame->ab)
+#define SSCAsmCb            (g_pServoFrame->cb)
+#else
+byte    g_abSSCFrame[SERVO_FRAME_MAX];
+word    g_cbSSCFrame;
+word    g_cbSSCFrameSent;       // The legs, written by EndServoUpdate before the wait
+#define SSCAsmBuf           g_abSSCFrame
+#define SSCAsmCb            g_cbSSCFrame
+#endif
+
+long            g_lSSCAsmUs;        // Encode time of the frame so far
+unsigned long   g_ulSSCAsmFrames;   // Statistics since the last A command
+unsigned long   g_ulSSCAsmBytes;
+word            g_wSSCAsmBytesMax;
+unsigned long   g_ulSSCAsmUsSum;
+long            g_lSSCAsmUsMax;
+
+#ifndef cSSC_BINARYMODE
+const char c_achSSCDec2[] PROGMEM =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+//--------------------------------------------------------------------
+// SSCAsmDec - Decimal without leading zeros, two digits per table look up
+//--------------------------------------------------------------------
+byte *SSCAsmDec(byte *pb, word w)
+{
+  if (w >= 10000) {
+    *pb++ = '0' + w / 10000;
+    w %= 10000;
+  }
+  else if (w < 100) {
+    if (w >= 10)
+      *pb++ = pgm_read_byte(&c_achSSCDec2[w * 2]);
+    *pb++ = pgm_read_byte(&c_achSSCDec2[w * 2 + 1]);
+    return pb;
+  }
+  else if (w < 1000) {
+    *pb++ = '0' + w / 100;
+    w %= 100;
+    *pb++ = pgm_read_byte(&c_achSSCDec2[w * 2]);
+    *pb++ = pgm_read_byte(&c_achSSCDec2[w * 2 + 1]);
+    return pb;
+  }
+  *pb++ = pgm_read_byte(&c_achSSCDec2[(w / 100) * 2]);
+  *pb++ = pgm_read_byte(&c_achSSCDec2[(w / 100) * 2 + 1]);
+  *pb++ = pgm_read_byte(&c_achSSCDec2[(w % 100) * 2]);
+  *pb++ = pgm_read_byte(&c_achSSCDec2[(w % 100) * 2 + 1]);
+  return pb;
+}
+#endif
+
+//--------------------------------------------------------------------
+// SSCAsmServo - One servo, #<pin>P<pulse> or the binary 3 bytes
+//--------------------------------------------------------------------
+byte *SSCAsmServo(byte *pb, byte bPin, word wPulse)
+{
+#ifdef cSSC_BINARYMODE
+  *pb++ = bPin + 0x80;
+  *pb++ = wPulse >> 8;
+  *pb++ = wPulse & 0xff;
+#else
+  *pb++ = '#';
+  pb = SSCAsmDec(pb, bPin);
+  *pb++ = 'P';
+  pb = SSCAsmDec(pb, wPulse);
+#endif
+  return pb;
+}
+
+void SSCAsmResetStats(void)
+{
+  g_ulSSCAsmFrames = 0;
+  g_ulSSCAsmBytes = 0;
+  g_wSSCAsmBytesMax = 0;
+  g_ulSSCAsmUsSum = 0;
+  g_lSSCAsmUsMax = 0;
+}
+
+void PrintSSCAsm(void)
+{
+  DBGSerial.print(F("Frames: "));
+  DBGSerial.print(g_ulSSCAsmFrames, DEC);
+  DBGSerial.print(F(" Bytes avg/max: "));
+  DBGSerial.print(g_ulSSCAsmFrames? g_ulSSCAsmBytes / g_ulSSCAsmFrames : 0, DEC);
+  DBGSerial.print(F("/"));
+  DBGSerial.print(g_wSSCAsmBytesMax, DEC);
+  DBGSerial.print(F(" Encode us avg/max: "));
+  DBGSerial.print(g_ulSSCAsmFrames? g_ulSSCAsmUsSum / g_ulSSCAsmFrames : 0, DEC);
+  DBGSerial.print(F("/"));
+  DBGSerial.println(g_lSSCAsmUsMax, DEC);
+}
+#endif // OPT_SSC_FRAME_ASM
+
 //------------------------------------------------------------------------------------------
 //[BeginServoUpdate] Does whatever preperation that is needed to starrt a move of our servos
 //------------------------------------------------------------------------------------------
 void ServoDriver::BeginServoUpdate(void)    // Start the update 
 {
+#ifdef OPT_PIPELINE
+  g_pServoFrame->cb = 0;
+#endif
+#ifdef OPT_SSC_FRAME_ASM
+  SSCAsmCb = 0;
+  g_lSSCAsmUs = 0;
+#ifndef OPT_PIPELINE
+  g_cbSSCFrameSent = 0;
+#endif
+#endif
 }
 
 //------------------------------------------------------------------------------------------
@@ -349,22 +522,36 @@ void ServoDriver::OutputServoInfoForLeg(byte LegIndex, short sCoxaAngle1, short
   wTarsSSCV = ((long)(sTarsAngle1+900))*1000/cPwmDiv+cPFConst;
 #endif
 
-#ifdef cSSC_BINARYMODE
+#if defined(OPT_SSC_FRAME_ASM)
+  int64_t llStart = ClockUs();
+  if (SSCAsmCb <= (SERVO_FRAME_MAX - SERVO_FRAME_COMMIT_MAX - SERVO_FRAME_LEG_MAX)) {
+    byte *pb = SSCAsmBuf + SSCAsmCb;
+    pb = SSCAsmServo(pb, pgm_read_byte(&cCoxaPin[LegIndex]), wCoxaSSCV);
+    pb = SSCAsmServo(pb, pgm_read_byte(&cFemurPin[LegIndex]), wFemurSSCV);
+    pb = SSCAsmServo(pb, pgm_read_byte(&cTibiaPin[LegIndex]), wTibiaSSCV);
+#ifdef c4DOF
+    if ((byte)pgm_read_byte(&cTarsLength[LegIndex]))
+      pb = SSCAsmServo(pb, pgm_read_byte(&cTarsPin[LegIndex]), wTarsSSCV);
+#endif
+    SSCAsmCb = pb - SSCAsmBuf;
+  }
+  g_lSSCAsmUs += (long)(ClockUs() - llStart);
+#elif defined(cSSC_BINARYMODE)
 #ifdef ESP32
-  Serial2.write(pgm_read_byte(&cCoxaPin[LegIndex])  + 0x80);
-  Serial2.write(wCoxaSSCV >> 8);
-  Serial2.write(wCoxaSSCV & 0xff);
-  Serial2.write(pgm_read_byte(&cFemurPin[LegIndex]) + 0x80);
-  Serial2.write(wFemurSSCV >> 8);
-  Serial2.write(wFemurSSCV & 0xff);
-  Serial2.write(pgm_read_byte(&cTibiaPin[LegIndex]) + 0x80);
-  Serial2.write(wTibiaSSCV >> 8);
-  Serial2.write(wTibiaSSCV & 0xff);
+  SSCFrameOut.write(pgm_read_byte(&cCoxaPin[LegIndex])  + 0x80);
+  SSCFrameOut.write(wCoxaSSCV >> 8);
+  SSCFrameOut.write(wCoxaSSCV & 0xff);
+  SSCFrameOut.write(pgm_read_byte(&cFemurPin[LegIndex]) + 0x80);
+  SSCFrameOut.write(wFemurSSCV >> 8);
+  SSCFrameOut.write(wFemurSSCV & 0xff);
+  SSCFrameOut.write(pgm_read_byte(&cTibiaPin[LegIndex]) + 0x80);
+  SSCFrameOut.write(wTibiaSSCV >> 8);
+  SSCFrameOut.write(wTibiaSSCV & 0xff);
 #ifdef c4DOF
   if ((byte)pgm_read_byte(&cTarsLength[LegIndex])) {    // We allow mix of 3 and 4 DOF legs...
-    Serial2.write(pgm_read_byte(&cTarsPin[LegIndex]) + 0x80);
-    Serial2.write(wTarsSSCV >> 8);
-    Serial2.write(wTarsSSCV & 0xff);
+    SSCFrameOut.write(pgm_read_byte(&cTarsPin[LegIndex]) + 0x80);
+    SSCFrameOut.write(wTarsSSCV >> 8);
+    SSCFrameOut.write(wTarsSSCV & 0xff);
   }
 #endif
 #else
@@ -387,24 +574,24 @@ void ServoDriver::OutputServoInfoForLeg(byte LegIndex, short sCoxaAngle1, short
 #endif
 #else
 #ifdef ESP32
-  Serial2.print("#");
-  Serial2.print(pgm_read_byte(&cCoxaPin[LegIndex]), DEC);
-  Serial2.print("P");
-  Serial2.print(wCoxaSSCV, DEC);
-  Serial2.print("#");
-  Serial2.print(pgm_read_byte(&cFemurPin[LegIndex]), DEC);
-  Serial2.print("P");
-  Serial2.print(wFemurSSCV, DEC);
-  Serial2.print("#");
-  Serial2.print(pgm_read_byte(&cTibiaPin[LegIndex]), DEC);
-  Serial2.print("P");
-  Serial2.print(wTibiaSSCV, DEC);
+  SSCFrameOut.print("#");
+  SSCFrameOut.print(pgm_read_byte(&cCoxaPin[LegIndex]), DEC);
+  SSCFrameOut.print("P");
+  SSCFrameOut.print(wCoxaSSCV, DEC);
+  SSCFrameOut.print("#");
+  SSCFrameOut.print(pgm_read_byte(&cFemurPin[LegIndex]), DEC);
+  SSCFrameOut.print("P");
+  SSCFrameOut.print(wFemurSSCV, DEC);
+  SSCFrameOut.print("#");
+  SSCFrameOut.print(pgm_read_byte(&cTibiaPin[LegIndex]), DEC);
+  SSCFrameOut.print("P");
+  SSCFrameOut.print(wTibiaSSCV, DEC);
 #ifdef c4DOF
   if ((byte)pgm_read_byte(&cTarsLength[LegIndex])) {
-    Serial2.print("#");
-    Serial2.print(pgm_read_byte(&cTarsPin[LegIndex]), DEC);
-    Serial2.print("P");
-    Serial2.print(wTarsSSCV, DEC);
+    SSCFrameOut.print("#");
+    SSCFrameOut.print(pgm_read_byte(&cTarsPin[LegIndex]), DEC);
+    SSCFrameOut.print("P");
+    SSCFrameOut.print(wTarsSSCV, DEC);
   }
 #endif
 #else
@@ -433,6 +620,20 @@ void ServoDriver::OutputServoInfoForLeg(byte LegIndex, short sCoxaAngle1, short
   g_InputController.AllowControllerInterrupts(true);    // Ok for hserial again...
 }
 
+#ifdef OPT_SSC_FRAME_ASM
+//--------------------------------------------------------------------
+//[EndServoUpdate] All the legs are in the frame.  Without the pipeline
+//         they go to the UART now, before the wait for the last move,
+//         so only the commit is left to write after it.
+//--------------------------------------------------------------------
+void ServoDriver::EndServoUpdate(void)
+{
+#ifndef OPT_PIPELINE
+  SSCSerial.write(SSCAsmBuf, SSCAsmCb);
+  g_cbSSCFrameSent = SSCAsmCb;
+#endif
+}
+#endif
 
 //--------------------------------------------------------------------
 //[CommitServoDriver Updates the positions of the servos - This outputs
@@ -442,36 +643,90 @@ void ServoDriver::OutputServoInfoForLeg(byte LegIndex, short sCoxaAngle1, short
 //--------------------------------------------------------------------
 void ServoDriver::CommitServoDriver(word wMoveTime)
 {
-#ifdef cSSC_BINARYMODE
+#if defined(cSSC_BINARYMODE) && !defined(OPT_SSC_FRAME_ASM)
   byte    abOut[3];
 #endif
 
   g_InputController.AllowControllerInterrupts(false);    // If on xbee on hserial tell hserial to not processess...
 
+#ifdef OPT_ESTOP
+  EStopLock();            // Until the commit is written, so a stop can not come in between
+  if (g_fEStopped) {
+#if defined(OPT_SSC_FRAME_ASM) && defined(OPT_PIPELINE)
+    SSCAsmCb = 0;         // Nothing went out yet, just drop it
+#else
+    // Stopped while we sent the servo info, cancel it instead of starting the move
+    SSCFrameOut.write((uint8_t)0x1b);
+#endif
+    EStopUnlock();
+    g_InputController.AllowControllerInterrupts(true);    
+    return;
+  }
+#endif
+#if defined(OPT_SSC_FRAME_ASM)
+  int64_t llStart = ClockUs();
+  byte *pb = SSCAsmBuf + SSCAsmCb;
 #ifdef cSSC_BINARYMODE
+  *pb++ = 0xA1;
+  *pb++ = wMoveTime >> 8;
+  *pb++ = wMoveTime & 0xff;
+#else
+  *pb++ = 'T';
+  pb = SSCAsmDec(pb, wMoveTime);
+  *pb++ = '\r';
+  *pb++ = '\n';
+#endif
+  SSCAsmCb = pb - SSCAsmBuf;
+  g_lSSCAsmUs += (long)(ClockUs() - llStart);
+
+  g_ulSSCAsmFrames++;
+  g_ulSSCAsmBytes += SSCAsmCb;
+  if (SSCAsmCb > g_wSSCAsmBytesMax)
+    g_wSSCAsmBytesMax = SSCAsmCb;
+  g_ulSSCAsmUsSum += g_lSSCAsmUs;
+  if (g_lSSCAsmUs > g_lSSCAsmUsMax)
+    g_lSSCAsmUsMax = g_lSSCAsmUs;
+#ifndef OPT_PIPELINE
+  // The legs went out in EndServoUpdate, else the transport task writes it all on its tick
+  SSCSerial.write(SSCAsmBuf + g_cbSSCFrameSent, SSCAsmCb - g_cbSSCFrameSent);
+#endif
+#elif defined(cSSC_BINARYMODE)
   abOut[0] = 0xA1;
   abOut[1] = wMoveTime >> 8;
   abOut[2] = wMoveTime & 0xff;
 #ifdef ESP32
-  Serial2.write(abOut, 3);
+  SSCFrameOut.write(abOut, 3);
 #else
   SSCSerial.write(abOut, 3);
 #endif
 #else
   //Send <CR>
 #ifdef ESP32
-  Serial2.print("T");
-  Serial2.println(wMoveTime, DEC);
+  SSCFrameOut.print("T");
+  SSCFrameOut.println(wMoveTime, DEC);
 #else
   SSCSerial.print("T");
   SSCSerial.println(wMoveTime, DEC);
 #endif
 #endif
 
+#ifdef OPT_ESTOP
+  EStopUnlock();
+#endif
   g_InputController.AllowControllerInterrupts(true);    
 
 }
 
+#ifdef OPT_PIPELINE
+//--------------------------------------------------------------------
+//[WriteFrame] Called by the transport task when a frame is due.
+//--------------------------------------------------------------------
+void ServoDriver::WriteFrame(SERVOFRAME *pframe)
+{
+  SSCSerial.write(pframe->ab, pframe->cb);
+}
+#endif
+
 //--------------------------------------------------------------------
 //[FREE SERVOS] Frees all the servos
 //--------------------------------------------------------------------
@@ -496,6 +751,36 @@ void ServoDriver::FreeServos(void)
   g_InputController.AllowControllerInterrupts(true);
 }
 
+#ifdef OPT_ESTOP
+//--------------------------------------------------------------------
+//[EStop] Called from the e-stop task.  An <esc> makes the SSC-32 drop any
+//     half sent command, then the pulses of the leg servos go off.  The
+//     command is built the first time, after that it is one write.
+//--------------------------------------------------------------------
+char g_szSSCEStop[CNT_LEGS * 4 * 6 + 4];
+byte g_cbSSCEStop;
+
+void ServoDriver::EStop(void)
+{
+  if (!g_cbSSCEStop) {
+    char *psz = g_szSSCEStop;
+    *psz++ = 0x1b;
+    for (byte LegIndex = 0; LegIndex < CNT_LEGS; LegIndex++) {
+      psz += sprintf(psz, "#%dP0", pgm_read_byte(&cCoxaPin[LegIndex]));
+      psz += sprintf(psz, "#%dP0", pgm_read_byte(&cFemurPin[LegIndex]));
+      psz += sprintf(psz, "#%dP0", pgm_read_byte(&cTibiaPin[LegIndex]));
+#ifdef c4DOF
+      psz += sprintf(psz, "#%dP0", pgm_read_byte(&cTarsPin[LegIndex]));
+#endif
+    }
+    *psz++ = '\r';
+    g_cbSSCEStop = psz - g_szSSCEStop;
+  }
+  SSCSerial.write((const uint8_t *)g_szSSCEStop, g_cbSSCEStop);
+  SSCSerial.flush();      // The stop is on the wire when we return
+}
+#endif
+
 //--------------------------------------------------------------------
 //Function that gets called from the main loop if the robot is not logically
 //     on.  Gives us a chance to play some...
@@ -520,6 +805,9 @@ void ServoDriver::ShowTerminalCommandList(void)
 #ifdef OPT_SSC_FORWARDER
   DBGSerial.println(F("S - SSC Forwarder"));
 #endif        
+#ifdef OPT_SSC_FRAME_ASM
+  DBGSerial.println(F("A - Show servo frame bytes and encode time and reset them"));
+#endif
 }
 
 //==============================================================================
@@ -537,6 +825,12 @@ boolean ServoDriver::ProcessTerminalCommand(byte *psz, byte bLen)
   if ((bLen == 1) && ((*psz == 's') || (*psz == 'S'))) {
     SSCForwarder();
   }
+#endif
+#ifdef OPT_SSC_FRAME_ASM
+  if ((bLen == 1) && ((*psz == 'a') || (*psz == 'A'))) {
+    PrintSSCAsm();
+    SSCAsmResetStats();
+  }
 #endif
   return true;	// Currently not using the return value
 
@@ -657,21 +951,21 @@ void FindServoOffsets()
       SSCSerial.print("P");
       SSCSerial.print(1500+asOffsets[sSN]+250, DEC);
       SSCSerial.println("T250");
-      delay(250);
+      ClockDelayMs(250);
 
       SSCSerial.print("#");
       SSCSerial.print(abSSCServoNum[sSN], DEC);
       SSCSerial.print("P");
       SSCSerial.print(1500+asOffsets[sSN]-250, DEC);
       SSCSerial.println("T500");
-      delay(500);
+      ClockDelayMs(500);
 
       SSCSerial.print("#");
       SSCSerial.print(abSSCServoNum[sSN], DEC);
       SSCSerial.print("P");
       SSCSerial.print(1500+asOffsets[sSN], DEC);
       SSCSerial.println("T250");
-      delay(250);
+      ClockDelayMs(250);
 
       fNew = false;
     }
@@ -752,15 +1046,15 @@ void FindServoOffsets()
       SSCSerial.print(32+abSSCServoNum[sSN], DEC);
       SSCSerial.print("=");
       SSCSerial.println(asOffsetsRead[sSN]+asOffsets[sSN], DEC);
-      delay(10);
+      ClockDelayMs(10);
     }
 
     // Then I need to have the SSC-32 reboot in order to use the new values.
-    delay(10);    // give it some time to write stuff out.
+    ClockDelayMs(10);    // give it some time to write stuff out.
     SSCSerial.println("GOBOOT");
-    delay(5);        // Give it a little time
+    ClockDelayMs(5);        // Give it a little time
     SSCSerial.println("g0000");    // tell it that we are done in the boot section so go run the normall SSC stuff...
-    delay(500);                // Give it some time to boot up...
+    ClockDelayMs(500);                // Give it some time to boot up...
 
   } 
   else {
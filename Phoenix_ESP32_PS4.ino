@@ -52,7 +52,9 @@
 void SketchSetup(void) {
 #ifdef DBGSerial
   DBGSerial.begin(DBG_SERIAL_BAUD);
+#ifndef OPT_FAST_BOOT                     // Time to open the serial monitor
   delay(2000);
+#endif
   
   DBGSerial.println(F("===================================="));
   DBGSerial.println(F("Phoenix Hexapod Robot - ESP32"));
@@ -69,7 +71,9 @@ void SketchSetup(void) {
 #endif
 
   // Initialize PS4 Controller
-#ifdef PS4_MAC_ADDRESS
+#if defined(OPT_FAST_BOOT)
+  // The input controller starts it in a task, with PS4_MAC_ADDRESS if set
+#elif defined(PS4_MAC_ADDRESS)
   PS4.begin(PS4_MAC_ADDRESS);
 #else
   DBGSerial.println(F("PS4.begin"));
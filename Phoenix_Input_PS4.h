@@ -27,6 +27,7 @@
 //- D-Pad down: Body down 10 mm
 //- D-Pad left: Decrease speed with 50mS
 //- D-Pad right: Increase speed with 50mS
+//- PS: Emergency stop, the servos go limp (OPT_ESTOP)
 //
 //[Walk Controls]
 //- Left Stick (Walk mode): (Walk mode)
@@ -97,6 +98,44 @@ static byte       g_l2Val, g_r2Val;
 // Speed control
 static short      g_sGPSMController = 32767;  // What GPSM value have we calculated
 
+#ifdef OPT_PIPELINE
+// The input task copies the controller state, ControlInput works on the copy
+typedef struct {
+  ps4_t       data;
+  boolean     fConnected;
+  int64_t     llTime;           // esp_timer time it was taken
+} PS4INPUT;
+
+static QueueHandle_t  g_qPS4Input;      // One deep mailbox from the input task
+static PS4INPUT       g_PS4In;          // What ControlInput looks at
+#define PS4Data           g_PS4In.data
+#define PS4IsConnected()  g_PS4In.fConnected
+#else
+#define PS4Data           PS4.data
+#define PS4IsConnected()  PS4.isConnected()
+#endif
+
+#ifdef OPT_INPUT_FEEDBACK
+// Rumble and light bar effects are lists of steps, each held for wMs.
+// UpdateFeedback starts the next step when the current one is done.
+typedef struct {
+  byte        bSmall, bLarge;   // Rumble motors
+  byte        bR, bG, bB;       // Light bar
+  word        wMs;              // How long the step lasts
+} PS4FXSTEP;
+
+#define PS4FX_QUEUE_SIZE  8     // Steps we can have waiting, a power of 2
+static PS4FXSTEP      g_aPS4FX[PS4FX_QUEUE_SIZE];
+static byte           g_iPS4FXHead;     // Where the next step is added
+static byte           g_iPS4FXTail;     // Next step to start
+static boolean        g_fPS4FXActive;   // A step is running
+static int64_t        g_llPS4FXEnd;     // ClockMs() it is done
+
+static const PS4FXSTEP c_afxRobotOn[] = {{200, 200, 0, 255, 0, 100}, {0, 0, 0, 255, 0, 0}};
+static const PS4FXSTEP c_afxRobotOff[] = {{100, 100, 255, 0, 0, 200}, {0, 0, 255, 0, 0, 0}};
+#define PS4Feedback(afx)  PS4QueueFeedback(afx, sizeof(afx)/sizeof(afx[0]))
+#endif
+
 // Forward function references
 extern void PS4TurnRobotOff(void);
 
@@ -111,22 +150,22 @@ boolean ButtonPressed(byte button) {
   boolean current = false;
   
   switch(button) {
-    case 0: current = PS4.data.button.cross; break;
-    case 1: current = PS4.data.button.circle; break;
-    case 2: current = PS4.data.button.square; break;
-    case 3: current = PS4.data.button.triangle; break;
-    case 4: current = PS4.data.button.l1; break;
-    case 5: current = PS4.data.button.r1; break;
-    case 6: current = PS4.data.button.l2; break;
-    case 7: current = PS4.data.button.r2; break;
-    case 8: current = PS4.data.button.options; break;
-    case 9: current = PS4.data.button.share; break;
-    case 10: current = PS4.data.button.up; break;
-    case 11: current = PS4.data.button.down; break;
-    case 12: current = PS4.data.button.left; break;
-    case 13: current = PS4.data.button.right; break;
-    case 14: current = PS4.data.button.ps; break;
-    case 15: current = PS4.data.button.touchpad; break;
+    case 0: current = PS4Data.button.cross; break;
+    case 1: current = PS4Data.button.circle; break;
+    case 2: current = PS4Data.button.square; break;
+    case 3: current = PS4Data.button.triangle; break;
+    case 4: current = PS4Data.button.l1; break;
+    case 5: current = PS4Data.button.r1; break;
+    case 6: current = PS4Data.button.l2; break;
+    case 7: current = PS4Data.button.r2; break;
+    case 8: current = PS4Data.button.options; break;
+    case 9: current = PS4Data.button.share; break;
+    case 10: current = PS4Data.button.up; break;
+    case 11: current = PS4Data.button.down; break;
+    case 12: current = PS4Data.button.left; break;
+    case 13: current = PS4Data.button.right; break;
+    case 14: current = PS4Data.button.ps; break;
+    case 15: current = PS4Data.button.touchpad; break;
   }
   
   boolean pressed = current && !g_buttonsPrev[button];
@@ -139,19 +178,19 @@ boolean ButtonPressed(byte button) {
 //-----------------------------------------------------------------------------
 boolean ButtonHeld(byte button) {
   switch(button) {
-    case 0: return PS4.data.button.cross;
-    case 1: return PS4.data.button.circle;
-    case 2: return PS4.data.button.square;
-    case 3: return PS4.data.button.triangle;
-    case 4: return PS4.data.button.l1;
-    case 5: return PS4.data.button.r1;
-    case 6: return PS4.data.button.l2;
-    case 7: return PS4.data.button.r2;
-    case 8: return PS4.data.button.options;
-    case 10: return PS4.data.button.up;
-    case 11: return PS4.data.button.down;
-    case 12: return PS4.data.button.left;
-    case 13: return PS4.data.button.right;
+    case 0: return PS4Data.button.cross;
+    case 1: return PS4Data.button.circle;
+    case 2: return PS4Data.button.square;
+    case 3: return PS4Data.button.triangle;
+    case 4: return PS4Data.button.l1;
+    case 5: return PS4Data.button.r1;
+    case 6: return PS4Data.button.l2;
+    case 7: return PS4Data.button.r2;
+    case 8: return PS4Data.button.options;
+    case 10: return PS4Data.button.up;
+    case 11: return PS4Data.button.down;
+    case 12: return PS4Data.button.left;
+    case 13: return PS4Data.button.right;
   }
   return false;
 }
@@ -164,6 +203,47 @@ byte GetAnalog(byte value) {
   return (byte)(value + 128);
 }
 
+#ifdef OPT_ESTOP
+//-----------------------------------------------------------------------------
+// PS4EStopNotify: Runs in the Bluetooth task for every report, so the PS
+//      button stops the robot without waiting for ControlInput.  A dropped
+//      connection is no stop, ControlInput lowers the body with
+//      PS4TurnRobotOff as before instead of dropping it on its belly.
+//-----------------------------------------------------------------------------
+void PS4EStopNotify(void) {
+  if (PS4.data.button.ps && g_InControlState.fRobotOn)
+    EStopTrigger();
+}
+#endif
+
+#ifdef OPT_FAST_BOOT
+//=============================================================================
+// PS4BeginTask - Brings up the Bluetooth stack, which takes longer than all
+//      of the rest of setup, on the Bluetooth core while setup goes on.
+//      Until it is done the controller just reads as not connected.
+//=============================================================================
+void PS4BeginTask(void *pv) {
+#ifdef PS4_MAC_ADDRESS
+  PS4.begin(PS4_MAC_ADDRESS);
+#else
+  PS4.begin();  // Use default pairing
+#endif
+#ifdef OPT_ESTOP
+  PS4.attach(PS4EStopNotify);
+#endif
+  g_llBootBTReady = ClockUs();
+  vTaskDelete(NULL);
+}
+
+//=============================================================================
+// InputController::BeginAsync - Called early in setup, before Init
+//=============================================================================
+void InputController::BeginAsync(void) {
+  if (xTaskCreatePinnedToCore(PS4BeginTask, "ps4begin", 4096, NULL, 1, NULL, BOOT_BT_CORE) != pdPASS)
+    PS4BeginTask(NULL);     // Can not happen this early, but then in line
+}
+#endif
+
 //=============================================================================
 // InputController::Init
 //=============================================================================
@@ -187,20 +267,106 @@ void InputController::Init(void) {
   g_l2Val = g_r2Val = 0;
   
   // Initialize PS4 controller
+#ifndef OPT_FAST_BOOT                     // Else BeginAsync started it
   PS4.begin();
+#ifdef OPT_ESTOP
+  PS4.attach(PS4EStopNotify);
+#endif
+#endif
+#ifdef OPT_PIPELINE
+  g_qPS4Input = xQueueCreate(1, sizeof(PS4INPUT));
+#endif
   
   DBGSerial.println("PS4 Controller Input Initialized");
   DBGSerial.println("Press PS button to connect controller");
   
-  delay(100);
+#ifndef OPT_FAST_BOOT
+  ClockDelayMs(100);
+#endif
+}
+
+#ifdef OPT_PIPELINE
+//=============================================================================
+// InputController::AcquireInput - Runs in the input task.  Copies the
+//      controller state into the mailbox, buttons pressed since ControlInput
+//      last took a copy stay pressed so a short press is not lost.
+//=============================================================================
+void InputController::AcquireInput(void) {
+  PS4INPUT in;
+  PS4INPUT prev;
+
+  in.data = PS4.data;
+  in.fConnected = PS4.isConnected();
+  in.llTime = ClockUs();
+  if (xQueueReceive(g_qPS4Input, &prev, 0) == pdTRUE) {
+    byte *pbIn = (byte*)&in.data.button;
+    byte *pbPrev = (byte*)&prev.data.button;
+    for (byte i = 0; i < sizeof(in.data.button); i++)
+      pbIn[i] |= pbPrev[i];
+  }
+  xQueueOverwrite(g_qPS4Input, &in);
 }
+#endif
+
+#ifdef OPT_INPUT_FEEDBACK
+//=============================================================================
+// PS4QueueFeedback - Adds the steps of an effect after whatever is already
+//      queued, steps that do not fit are dropped.
+//=============================================================================
+void PS4QueueFeedback(const PS4FXSTEP *pfx, byte cSteps) {
+  while (cSteps--) {
+    byte iNext = (g_iPS4FXHead + 1) & (PS4FX_QUEUE_SIZE - 1);
+    if (iNext == g_iPS4FXTail)
+      break;
+    g_aPS4FX[g_iPS4FXHead] = *pfx++;
+    g_iPS4FXHead = iNext;
+  }
+}
+
+//=============================================================================
+// InputController::UpdateFeedback - Called every frame, even when the input
+//      is not looked at.  Starts the next queued step once the current one
+//      has run its time.
+//=============================================================================
+void InputController::UpdateFeedback(void) {
+  if (g_fPS4FXActive && (ClockMs() < g_llPS4FXEnd))
+    return;
+  g_fPS4FXActive = false;
+  if (g_iPS4FXTail == g_iPS4FXHead)
+    return;
+
+  PS4FXSTEP *pfx = &g_aPS4FX[g_iPS4FXTail];
+  g_iPS4FXTail = (g_iPS4FXTail + 1) & (PS4FX_QUEUE_SIZE - 1);
+  if (PS4.isConnected()) {       // After a disconnect the steps just run out
+    PS4.setRumble(pfx->bSmall, pfx->bLarge);
+    PS4.setLed(pfx->bR, pfx->bG, pfx->bB);
+    PS4.sendToController();
+  }
+  g_llPS4FXEnd = ClockMs() + pfx->wMs;
+  g_fPS4FXActive = true;
+}
+#endif
+
+#ifdef OPT_JITTER_BENCH
+boolean InputController::FIsConnected(void) {
+  return PS4IsConnected();
+}
+#endif
 
 //=============================================================================
 // InputController::ControlInput
 //=============================================================================
 void InputController::ControlInput(void) {
   // Check if PS4 controller is connected
-  g_fPS4Connected = PS4.isConnected();
+#ifdef OPT_PIPELINE
+  // Use the newest copy the input task took, if there is a new one
+  PS4INPUT in;
+  if (xQueueReceive(g_qPS4Input, &in, 0) == pdTRUE) {
+    g_PS4In = in;
+    PipelineInputTaken(in.llTime);
+  }
+#endif
+  g_fPS4Connected = PS4IsConnected();
   
   if(!g_fPS4Connected) {
     // Controller disconnected
@@ -214,12 +380,12 @@ void InputController::ControlInput(void) {
   }
   
   // Read analog values
-  g_lx = GetAnalog(PS4.data.analog.stick.lx);
-  g_ly = GetAnalog(PS4.data.analog.stick.ly);
-  g_rx = GetAnalog(PS4.data.analog.stick.rx);
-  g_ry = GetAnalog(PS4.data.analog.stick.ry);
-  g_l2Val = PS4.data.analog.button.l2;
-  g_r2Val = PS4.data.analog.button.r2;
+  g_lx = GetAnalog(PS4Data.analog.stick.lx);
+  g_ly = GetAnalog(PS4Data.analog.stick.ly);
+  g_rx = GetAnalog(PS4Data.analog.stick.rx);
+  g_ry = GetAnalog(PS4Data.analog.stick.ry);
+  g_l2Val = PS4Data.analog.button.l2;
+  g_r2Val = PS4Data.analog.button.r2;
   
   //==================================================================
   // [OPTIONS BUTTON] - Turn on/off robot
@@ -231,9 +397,13 @@ void InputController::ControlInput(void) {
       // Turn on
       g_InControlState.fRobotOn = true;
       
+#ifdef OPT_INPUT_FEEDBACK
+      PS4Feedback(c_afxRobotOn);
+#else
       PS4.setRumble(200, 200);
-      delay(100);
+      ClockDelayMs(100);
       PS4.setRumble(0, 0);
+#endif
       
 #ifdef DBGSerial      
       DBGSerial.println("Robot ON");
@@ -369,6 +539,7 @@ void InputController::ControlInput(void) {
         g_InControlState.GaitType = 0;
       }
       g_InControlState.GaitStep = 0;
+      GaitSelect();
     }
   }
   
@@ -435,6 +606,14 @@ void InputController::ControlInput(void) {
   
   // Commit our body offset
   g_InControlState.BodyPos.y = g_BodyYOffset + g_BodyYShift;
+
+#ifdef OPT_BODY_POSE_LIMIT
+  // Keep the pose inside what the legs can reach
+  if ((ControlMode == TRANSLATEMODE) || (ControlMode == ROTATEMODE)) {
+    BodyPoseLimit(ControlMode == ROTATEMODE, g_BodyYOffset);
+    g_BodyYShift = g_InControlState.BodyPos.y - g_BodyYOffset;
+  }
+#endif
 }
 
 //=============================================================================
@@ -459,7 +638,7 @@ boolean InputController::ProcessTerminalCommand(byte *psz, byte bLen) {
     // Show battery level
     if(g_fPS4Connected) {
       DBGSerial.print(F("Battery: "));
-      DBGSerial.println(PS4.data.status.battery);
+      DBGSerial.println(PS4Data.status.battery);
     } else {
       DBGSerial.println(F("Controller not connected"));
     }
@@ -508,9 +687,13 @@ void PS4TurnRobotOff(void)
   g_InControlState.fRobotOn = false;
   
   // Give haptic feedback
+#ifdef OPT_INPUT_FEEDBACK
+  PS4Feedback(c_afxRobotOff);
+#else
   PS4.setRumble(100, 100);
-  delay(200);
+  ClockDelayMs(200);
   PS4.setRumble(0, 0);
+#endif
 }
 
 #endif // PHOENIX_INPUT_PS4_H
\ No newline at end of file
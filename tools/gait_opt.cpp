@@ -0,0 +1,698 @@
+//====================================================================
+// gait_opt - Host side search for faster gaits for the leg geometry in
+//      Hex_Cfg.h.  It builds the real Phoenix code (GaitSeq, Gait, BodyFK,
+//      LegIK, CheckAngles, the stability margin and the odometry) against
+//      the stand in Arduino headers in tools/host and walks every candidate
+//      gait through it.
+//
+//   g++ -std=gnu++17 -O2 -I tools/host -I . -o gait_opt tools/gait_opt.cpp
+//   ./gait_opt [options]          (-h lists them)
+//
+// Candidates are all combinations of StepsInGait, NrLiftedPos,
+// LiftDivFactor, TLDivFactor and HalfLiftHeight in the given ranges, with
+// the legs put in every order into a set of phase patterns (wave, tripod,
+// tetrapod, and the staggered versions of the last two) for GaitLegNr.
+// FrontDownPos follows from NrLiftedPos.
+//
+// For each one the largest travel length is found by bisection where,
+// after one cycle to settle, two full gait cycles have:
+//   - no leg with an IK error and no angle clamped by CheckAngles (legs
+//     that are clamped standing still are reported and not held against
+//     any gait)
+//   - no joint asked to move faster than the servos can (-r)
+//   - at least three feet on the ground, and a stability margin of at
+//     least -m mm (0, the body center inside the support polygon) on
+//     every frame.  The margin is taken with the feet where the servos
+//     put them: a coxa CheckAngles clamped turns the foot around the
+//     coxa to the clamped angle.  With the legs in Hex_Cfg.h the IK asks
+//     the corner coxas for more than their limits even standing still,
+//     the commanded corner feet are only 16 mm from the body center in Z
+//     while the servos hold them well outside that.
+//   - the body moves at all
+// The gaits are then ranked on speed, as measured by the odometry, then on
+// that travel and then on the worst stability margin, and printed as APG
+// entries and as N E terminal lines.
+//
+// The built in gaits are walked the same way first.  They are known to
+// walk, so if one of them fails the model is off and the tool exits with
+// 1.  -c only does that check.
+//
+// The firmware keeps its state in globals, so the work is spread over the
+// host cores as forked worker processes (-j) that share the results
+// through an anonymous shared mapping.
+//====================================================================
+#include <Arduino.h>
+#include <math.h>
+#include <set>
+#include <array>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "Hex_Cfg.h"
+// The tool commands the travel itself and looks at every frame, so none of
+// the code that changes or skips that is wanted here.
+#undef OPT_STRIDE_LIMIT
+#undef OPT_GAIT_CACHE
+#undef OPT_GAIT_STORE
+#undef OPT_GAIT_TRACE
+// And these are what it measures with
+#ifndef OPT_STABILITY_MARGIN
+#define OPT_STABILITY_MARGIN
+#endif
+#ifndef OPT_ODOMETRY
+#define OPT_ODOMETRY
+#endif
+#include "Phoenix_ESP32_PS4.ino"
+
+#ifdef QUADMODE
+#error gait_opt only knows the hexapod gait layout
+#endif
+
+enum { FAIL_NONE = 0, FAIL_IK, FAIL_CLAMP, FAIL_SERVO, FAIL_MARGIN, FAIL_STILL, FAIL_COUNT };
+static const char *s_apszFail[FAIL_COUNT] = {"ok", "IK error", "clamped", "servo speed", "margin", "no motion"};
+
+struct SimResult {
+  byte    bFail;
+  short   sMargin;            // Worst stability margin, mm
+  float   fSpeed;             // mm/s, or deg/s when turning
+};
+
+struct Candidate {
+  PHOENIXGAIT gait;
+  int     iParamSet;          // Candidates with the same fields but GaitLegNr
+};
+
+struct Result {
+  byte    bDone;
+  byte    bFail;              // Why the smallest travel already failed
+  short   sTravel;            // Largest travel that passed
+  short   sMargin;
+  float   fSpeed;
+};
+
+// Settings
+static int  s_iNomSpeed = DEFAULT_GAIT_SPEED;
+static int  s_iBodyY = 35;
+static int  s_iLift = 50;
+static int  s_iMinMargin = 0;        // Body center inside the feet on the ground
+static int  s_iServoDPS = 375;      // deg/s, about 0.16 s/60 deg
+static char s_chDir = 'f';
+static int  s_iMaxTravel = 0;
+static int  s_aiSteps[2] = {6, 24};
+static int  s_aiLiftDiv[2] = {2, 4};
+static int  s_aiHalfLift[2] = {1, 3};
+static int  s_iTLSpan = 1;
+static int  s_cTop = 10;
+static int  s_cWorkers = 0;
+static bool s_fCheckOnly = false;
+
+static int  s_iFrameMs;             // ServoMoveTime while walking
+static byte s_bRestClamped;         // Legs CheckAngles clamps even standing still
+
+//--------------------------------------------------------------------
+// ResetRobot - Put the firmware state back to standing still with the
+//      gait selected, the parts of setup() and the input that matter.
+//--------------------------------------------------------------------
+static void ResetRobot(const PHOENIXGAIT &gait)
+{
+  for (LegIndex = 0; LegIndex < CNT_LEGS; LegIndex++) {
+    LegPosX[LegIndex] = (short)pgm_read_word(&cInitPosX[LegIndex]);
+    LegPosY[LegIndex] = (short)pgm_read_word(&cInitPosY[LegIndex]);
+    LegPosZ[LegIndex] = (short)pgm_read_word(&cInitPosZ[LegIndex]);
+    GaitPosX[LegIndex] = 0;
+    GaitPosY[LegIndex] = 0;
+    GaitPosZ[LegIndex] = 0;
+    GaitRotY[LegIndex] = 0;
+  }
+  g_InControlState.BodyPos.x = 0;
+  g_InControlState.BodyPos.y = s_iBodyY;
+  g_InControlState.BodyPos.z = 0;
+  g_InControlState.BodyRot1.x = 0;
+  g_InControlState.BodyRot1.y = 0;
+  g_InControlState.BodyRot1.z = 0;
+  g_InControlState.TravelLength.x = 0;
+  g_InControlState.TravelLength.y = 0;
+  g_InControlState.TravelLength.z = 0;
+  g_InControlState.BalanceMode = 0;
+  g_InControlState.LegLiftHeight = s_iLift;
+  g_InControlState.ForceGaitStepCnt = 0;
+  g_InControlState.GaitStep = 1;
+  g_InControlState.gaitCur = gait;
+#ifdef OPT_FREE_GAIT
+  g_InControlState.fFreeGait = false;
+  FreeGaitReset();
+#endif
+  g_InControlState.fRobotOn = 1;
+  fWalking = false;
+  bExtraCycle = 0;
+  TotalTransX = TotalTransY = TotalTransZ = 0;
+  OdometryReset();
+}
+
+static void SetTravel(short sTravel)
+{
+  switch (s_chDir) {
+    case 'f': g_InControlState.TravelLength.z = sTravel; break;
+    case 'b': g_InControlState.TravelLength.z = -sTravel; break;
+    case 's': g_InControlState.TravelLength.x = sTravel; break;
+    case 't': g_InControlState.TravelLength.y = sTravel; break;
+  }
+}
+
+//--------------------------------------------------------------------
+// ServoFeetMargin - CalcStabilityMargin takes the feet where the gait
+//      asks for them.  Turn each one around its coxa to the angle the
+//      servo got after CheckAngles, at the same reach, and take the
+//      margin of those feet.
+//--------------------------------------------------------------------
+static short ServoFeetMargin(void)
+{
+  for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++) {
+    double dblOffX = (short)pgm_read_word(&cOffsetX[LegNr]);
+    double dblOffZ = (short)pgm_read_word(&cOffsetZ[LegNr]);
+    double dblSign = (LegNr < (CNT_LEGS/2)) ? -1 : 1;     // Right legs are mirrored in X
+    double dblReach = hypot(g_asFootX[LegNr] - dblOffX, g_asFootZ[LegNr] - dblOffZ);
+    double dblAngle = (CoxaAngle1[LegNr] - (short)pgm_read_word(&cCoxaAngle1[LegNr])) * M_PI / 1800;
+    g_asFootX[LegNr] = (short)lround(dblOffX + dblSign * dblReach * cos(dblAngle));
+    g_asFootZ[LegNr] = (short)lround(dblOffZ + dblReach * sin(dblAngle));
+  }
+  return SupportMargin(g_bGroundedLegs);
+}
+
+//--------------------------------------------------------------------
+// SimWalk - Walk the gait with a fixed travel the way loop() does, without
+//      balance, and check the frames after the first cycle.
+//--------------------------------------------------------------------
+static void SimWalk(const PHOENIXGAIT &gait, short sTravel, int iMinMargin, SimResult &sr)
+{
+  int     cSteps = gait.StepsInGait;
+  int     cFrames = 3 * cSteps;
+  short   asAnglePrev[CNT_LEGS][3];
+  short   sMaxDelta = (short)(((long)s_iServoDPS * s_iFrameMs) / 100);   // decimals = 1
+  long    lOdoStart = 0;
+  long    lTurn = 0;
+  long    lHeadingPrev = 0;
+
+  ResetRobot(gait);
+  sr.bFail = FAIL_NONE;
+  sr.sMargin = 32767;
+  sr.fSpeed = 0;
+
+  for (int iFrame = 0; iFrame < cFrames; iFrame++) {
+    SetTravel(sTravel);
+    GaitSeq();
+    fWalking = true;    // loop() sets it once the feet are off home, else GaitSeq starts the gait over every frame
+    TotalTransX = TotalTransY = TotalTransZ = 0;
+    CalcStabilityMargin();
+    IKSolution = 0;
+    IKSolutionWarning = 0;
+    IKSolutionError = 0;
+    CalcLegsIK();
+    CheckAngles();
+    g_sStabilityMargin = ServoFeetMargin();
+    OdometryUpdate();
+
+    if (iFrame < cSteps) {
+      if (iFrame == (cSteps - 1)) {
+        lOdoStart = g_lOdoDist;
+        lHeadingPrev = g_lOdoHeading;
+      }
+    }
+    else {
+      for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++) {
+        if (g_abLegIKFlags[LegNr] & 4) {
+          sr.bFail = FAIL_IK;
+          return;
+        }
+        short sDelta = max(abs(CoxaAngle1[LegNr] - asAnglePrev[LegNr][0]),
+            max(abs(FemurAngle1[LegNr] - asAnglePrev[LegNr][1]), abs(TibiaAngle1[LegNr] - asAnglePrev[LegNr][2])));
+        if (sDelta > sMaxDelta) {
+          sr.bFail = FAIL_SERVO;
+          return;
+        }
+      }
+      if (g_bClampedLegs & ~s_bRestClamped) {
+        sr.bFail = FAIL_CLAMP;
+        return;
+      }
+      if (g_sStabilityMargin < sr.sMargin)
+        sr.sMargin = g_sStabilityMargin;
+      if (g_sStabilityMargin < iMinMargin) {
+        sr.bFail = FAIL_MARGIN;
+        return;
+      }
+      long lDHeading = g_lOdoHeading - lHeadingPrev;
+      if (lDHeading > 18000)
+        lDHeading -= 36000;
+      else if (lDHeading < -18000)
+        lDHeading += 36000;
+      lTurn += lDHeading;
+      lHeadingPrev = g_lOdoHeading;
+    }
+    for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++) {
+      asAnglePrev[LegNr][0] = CoxaAngle1[LegNr];
+      asAnglePrev[LegNr][1] = FemurAngle1[LegNr];
+      asAnglePrev[LegNr][2] = TibiaAngle1[LegNr];
+    }
+  }
+
+  float fSeconds = (float)((cFrames - cSteps) * s_iFrameMs) / 1000.0f;
+  if (s_chDir == 't')
+    sr.fSpeed = (float)labs(lTurn) / c2DEC / fSeconds;
+  else
+    sr.fSpeed = (float)(g_lOdoDist - lOdoStart) / c2DEC / fSeconds;
+}
+
+//--------------------------------------------------------------------
+// CheckMoves - A travel under TLDivFactor moves the feet on the ground
+//      by nothing, so a gait that only passes with such a travel does
+//      not walk.
+//--------------------------------------------------------------------
+static void CheckMoves(Result &r)
+{
+  if ((r.sTravel > 0) && ((int)(r.fSpeed * 10) <= 0)) {
+    r.sTravel = 0;
+    r.bFail = FAIL_STILL;
+  }
+}
+
+//--------------------------------------------------------------------
+// MaxTravel - Largest travel in [cTravelDeadZone+1, sHigh] that passes,
+//      by bisection.  Assumes that a gait that fails at some travel also
+//      fails at any larger one.  Returns 0 if even the smallest fails.
+//--------------------------------------------------------------------
+static short MaxTravel(const PHOENIXGAIT &gait, short sHigh, int iMinMargin, SimResult &srBest)
+{
+  SimResult sr;
+  short   sLow = cTravelDeadZone + 1;
+
+  SimWalk(gait, sHigh, iMinMargin, sr);
+  if (sr.bFail == FAIL_NONE) {
+    srBest = sr;
+    return sHigh;
+  }
+  SimWalk(gait, sLow, iMinMargin, srBest);
+  if (srBest.bFail != FAIL_NONE)
+    return 0;
+  while ((sHigh - sLow) > 1) {
+    short sMid = (sLow + sHigh) / 2;
+    SimWalk(gait, sMid, iMinMargin, sr);
+    if (sr.bFail == FAIL_NONE) {
+      sLow = sMid;
+      srBest = sr;
+    }
+    else
+      sHigh = sMid;
+  }
+  return sLow;
+}
+
+//--------------------------------------------------------------------
+// Candidate generation
+//--------------------------------------------------------------------
+static byte FrontDownFor(byte bNrLifted)
+{
+  return (bNrLifted + 1) / 2;
+}
+
+// Steps a leg is on the ground and pushing in one cycle
+static int StanceSteps(int cSteps, int bNrLifted)
+{
+  return cSteps - bNrLifted - (bNrLifted & 1);
+}
+
+typedef std::array<byte, CNT_LEGS> LegNrs;
+
+// Phases for the slots, cGroups groups of legs evenly spread over the cycle,
+// the legs in a group together or one step apart.  Empty if it doesn't fit.
+static std::vector<int> SlotPhases(int cSteps, int cGroups, bool fStagger)
+{
+  std::vector<int> aiPhase;
+  int cPerGroup = CNT_LEGS / cGroups;
+  if (fStagger && ((cPerGroup == 1) || (cPerGroup - 1) >= (cSteps / cGroups)))
+    return aiPhase;
+  if (!fStagger && (cGroups == CNT_LEGS) && (cSteps < CNT_LEGS))
+    return aiPhase;
+  for (int iSlot = 0; iSlot < CNT_LEGS; iSlot++)
+    aiPhase.push_back(((iSlot / cPerGroup) * cSteps) / cGroups + (fStagger ? (iSlot % cPerGroup) : 0));
+  return aiPhase;
+}
+
+static void LegOrders(int cSteps, std::set<LegNrs> &setOrders)
+{
+  std::vector<std::vector<int> > aaiPhases;
+  for (int cGroups = 2; cGroups <= CNT_LEGS; cGroups++) {
+    if (CNT_LEGS % cGroups)
+      continue;
+    for (int iStagger = 0; iStagger < 2; iStagger++) {
+      std::vector<int> aiPhase = SlotPhases(cSteps, cGroups, iStagger != 0);
+      if (!aiPhase.empty())
+        aaiPhases.push_back(aiPhase);
+    }
+  }
+
+  std::array<int, CNT_LEGS> aiLegs;
+  for (int i = 0; i < CNT_LEGS; i++)
+    aiLegs[i] = i;
+  do {
+    for (const auto &aiPhase : aaiPhases) {
+      LegNrs legnrs;
+      int iMin = cSteps;
+      for (int iSlot = 0; iSlot < CNT_LEGS; iSlot++)
+        iMin = min(iMin, aiPhase[iSlot]);
+      // Shifting all legs by the same steps is the same gait, start at 1
+      for (int iSlot = 0; iSlot < CNT_LEGS; iSlot++)
+        legnrs[aiLegs[iSlot]] = (byte)(aiPhase[iSlot] - iMin + 1);
+      setOrders.insert(legnrs);
+    }
+  } while (std::next_permutation(aiLegs.begin(), aiLegs.end()));
+}
+
+static void BuildCandidates(std::vector<Candidate> &acand, std::vector<PHOENIXGAIT> &aParamSets)
+{
+  static const byte abNrLifted[] = {1, 2, 3, 5};
+
+  for (int cSteps = s_aiSteps[0]; cSteps <= s_aiSteps[1]; cSteps++) {
+    std::set<LegNrs> setOrders;
+    LegOrders(cSteps, setOrders);
+    for (byte bNrLifted : abNrLifted) {
+      int iStance = StanceSteps(cSteps, bNrLifted);
+      // One lifted position doesn't use the lift factors, don't try them all
+      int iLiftDivLow = (bNrLifted == 1) ? 2 : s_aiLiftDiv[0];
+      int iLiftDivHigh = (bNrLifted == 1) ? 2 : s_aiLiftDiv[1];
+      int iHalfLow = (bNrLifted == 1) ? 3 : s_aiHalfLift[0];
+      int iHalfHigh = (bNrLifted == 1) ? 3 : s_aiHalfLift[1];
+      for (int iTL = iStance - s_iTLSpan; iTL <= iStance; iTL++) {
+        for (int iLiftDiv = iLiftDivLow; iLiftDiv <= iLiftDivHigh; iLiftDiv++) {
+          for (int iHalf = iHalfLow; iHalf <= iHalfHigh; iHalf++) {
+            PHOENIXGAIT gait;
+            memset(&gait, 0, sizeof(gait));
+            gait.NomGaitSpeed = s_iNomSpeed;
+            gait.StepsInGait = cSteps;
+            gait.NrLiftedPos = bNrLifted;
+            gait.FrontDownPos = FrontDownFor(bNrLifted);
+            gait.LiftDivFactor = iLiftDiv;
+            gait.TLDivFactor = (iTL > 0) ? iTL : 0;
+            gait.HalfLiftHeight = iHalf;
+            for (byte LegNr = 0; LegNr < CNT_LEGS; LegNr++)
+              gait.GaitLegNr[LegNr] = 1;
+            if (!ValidateGait(&gait, false))
+              continue;
+            aParamSets.push_back(gait);
+            for (const LegNrs &legnrs : setOrders) {
+              Candidate cand;
+              cand.gait = gait;
+              memcpy(cand.gait.GaitLegNr, legnrs.data(), CNT_LEGS);
+              cand.iParamSet = (int)aParamSets.size() - 1;
+              acand.push_back(cand);
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+//--------------------------------------------------------------------
+// Worker - Take candidates off the shared counter until there are none.
+//      The travel where the legs run out of reach or servo speed does not
+//      depend on the leg order, so it is searched once per set of fields
+//      without the margin and only the margin is searched per candidate.
+//--------------------------------------------------------------------
+static void Worker(const std::vector<Candidate> &acand, int cParamSets, Result *presults, volatile int *piNext)
+{
+  std::vector<short> asReach(cParamSets, -1);
+  std::vector<byte> abReachFail(cParamSets, FAIL_NONE);
+
+  for (;;) {
+    int i = __atomic_fetch_add(piNext, 1, __ATOMIC_RELAXED);
+    if (i >= (int)acand.size())
+      break;
+    const Candidate &cand = acand[i];
+    Result &r = presults[i];
+    SimResult sr;
+
+    if (asReach[cand.iParamSet] < 0) {
+      asReach[cand.iParamSet] = MaxTravel(cand.gait, s_iMaxTravel, -32768, sr);
+      abReachFail[cand.iParamSet] = sr.bFail;
+    }
+    r.sTravel = 0;
+    r.bFail = abReachFail[cand.iParamSet];
+    if (asReach[cand.iParamSet] > 0) {
+      r.sTravel = MaxTravel(cand.gait, asReach[cand.iParamSet], s_iMinMargin, sr);
+      r.bFail = sr.bFail;
+      r.sMargin = sr.sMargin;
+      r.fSpeed = sr.fSpeed;
+      CheckMoves(r);
+    }
+    r.bDone = 1;
+  }
+}
+
+static bool BetterResult(const Result &r1, const Result &r2)
+{
+  if ((int)(r1.fSpeed * 10) != (int)(r2.fSpeed * 10))
+    return r1.fSpeed > r2.fSpeed;
+  if (r1.sTravel != r2.sTravel)
+    return r1.sTravel > r2.sTravel;
+  return r1.sMargin > r2.sMargin;
+}
+
+static bool SameGait(const PHOENIXGAIT &gait1, const Result &r1, const PHOENIXGAIT &gait2, const Result &r2)
+{
+  if ((r1.sTravel != r2.sTravel) || (r1.sMargin != r2.sMargin) || ((int)(r1.fSpeed * 10) != (int)(r2.fSpeed * 10))
+      || (gait1.StepsInGait != gait2.StepsInGait) || (gait1.TLDivFactor != gait2.TLDivFactor))
+    return false;
+  bool fSame = true;
+  bool fMirror = true;
+  for (int LegNr = 0; LegNr < CNT_LEGS; LegNr++) {
+    fSame &= (gait1.GaitLegNr[LegNr] == gait2.GaitLegNr[LegNr]);
+    fMirror &= (gait1.GaitLegNr[LegNr] == gait2.GaitLegNr[(LegNr + CNT_LEGS/2) % CNT_LEGS]);
+  }
+  return fSame || fMirror;
+}
+
+static void PrintEntry(const PHOENIXGAIT &gait, const Result &r, const char *pszComment)
+{
+  printf("    {%d, %d, %d, %d, %d, %d, %d, {", gait.NomGaitSpeed, gait.StepsInGait, gait.NrLiftedPos,
+      gait.FrontDownPos, gait.LiftDivFactor, gait.TLDivFactor, gait.HalfLiftHeight);
+  for (int LegNr = 0; LegNr < CNT_LEGS; LegNr++)
+    printf("%d%s", gait.GaitLegNr[LegNr], (LegNr < (CNT_LEGS - 1)) ? ", " : "");
+  printf("}},  // %s%.1f %s, travel %d, margin %d\n", pszComment, r.fSpeed,
+      (s_chDir == 't') ? "deg/s" : "mm/s", r.sTravel, r.sMargin);
+}
+
+static void PrintTerminalLine(const PHOENIXGAIT &gait)
+{
+  printf("    N E %d %d %d %d %d %d %d", gait.NomGaitSpeed, gait.StepsInGait, gait.NrLiftedPos,
+      gait.FrontDownPos, gait.LiftDivFactor, gait.TLDivFactor, gait.HalfLiftHeight);
+  for (int LegNr = 0; LegNr < CNT_LEGS; LegNr++)
+    printf(" %d", gait.GaitLegNr[LegNr]);
+  printf("\n");
+}
+
+static bool ParseRange(const char *psz, int *pai)
+{
+  if (sscanf(psz, "%d-%d", &pai[0], &pai[1]) == 2)
+    return pai[0] <= pai[1];
+  if (sscanf(psz, "%d", &pai[0]) == 1) {
+    pai[1] = pai[0];
+    return true;
+  }
+  return false;
+}
+
+static void Usage(void)
+{
+  printf("gait_opt [options]\n"
+      "  -d f|b|s|t   travel direction: forward, back, sideways, turn (f)\n"
+      "  -y mm        body height, BodyPos.y (%d)\n"
+      "  -l mm        leg lift height (%d)\n"
+      "  -n ms        NomGaitSpeed of the gaits (%d)\n"
+      "  -r deg/s     fastest a servo may turn (%d)\n"
+      "  -m mm        smallest stability margin allowed (%d), below 0 may tip over\n"
+      "  -T travel    largest travel length to try (254, 32 for turning)\n"
+      "  -s lo-hi     StepsInGait (%d-%d)\n"
+      "  -f lo-hi     LiftDivFactor (%d-%d)\n"
+      "  -H lo-hi     HalfLiftHeight (%d-%d)\n"
+      "  -t n         TLDivFactor from the stance steps - n up to the stance steps (%d)\n"
+      "  -k n         how many gaits to print (%d)\n"
+      "  -j n         worker processes (one per core)\n"
+      "  -c           only check that the built in gaits walk\n",
+      s_iBodyY, s_iLift, s_iNomSpeed, s_iServoDPS, s_iMinMargin, s_aiSteps[0], s_aiSteps[1],
+      s_aiLiftDiv[0], s_aiLiftDiv[1], s_aiHalfLift[0], s_aiHalfLift[1], s_iTLSpan, s_cTop);
+}
+
+int main(int argc, char **argv)
+{
+  int ch;
+  while ((ch = getopt(argc, argv, "d:y:l:n:r:m:T:s:f:H:t:k:j:ch")) != -1) {
+    bool fOK = true;
+    switch (ch) {
+      case 'd': s_chDir = optarg[0]; fOK = (strchr("fbst", s_chDir) != NULL); break;
+      case 'y': s_iBodyY = atoi(optarg); break;
+      case 'l': s_iLift = atoi(optarg); break;
+      case 'n': s_iNomSpeed = atoi(optarg); break;
+      case 'r': s_iServoDPS = atoi(optarg); break;
+      case 'm': s_iMinMargin = atoi(optarg); break;
+      case 'T': s_iMaxTravel = atoi(optarg); break;
+      case 's': fOK = ParseRange(optarg, s_aiSteps); break;
+      case 'f': fOK = ParseRange(optarg, s_aiLiftDiv); break;
+      case 'H': fOK = ParseRange(optarg, s_aiHalfLift); break;
+      case 't': s_iTLSpan = atoi(optarg); break;
+      case 'k': s_cTop = atoi(optarg); break;
+      case 'j': s_cWorkers = atoi(optarg); break;
+      case 'c': s_fCheckOnly = true; break;
+      default: fOK = false; break;
+    }
+    if (!fOK) {
+      Usage();
+      return 1;
+    }
+  }
+  if (!s_iMaxTravel)
+    s_iMaxTravel = (s_chDir == 't') ? 32 : 254;
+  if (s_cWorkers <= 0)
+    s_cWorkers = max(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+
+  setup();      // Same start as the robot, quietly
+  s_iFrameMs = s_iNomSpeed + g_InControlState.SpeedControl;    // ServoMoveTime with the stick all the way
+
+  ResetRobot(APG[0]);
+  CalcLegsIK();
+  CheckAngles();
+  s_bRestClamped = g_bClampedLegs;
+  if (s_bRestClamped)
+    printf("Warning: legs %02X are clamped by CheckAngles standing still, check the limits in Hex_Cfg.h\n", s_bRestClamped);
+
+  printf("Body height %d, lift %d, direction %c, %d ms per step, servos %d deg/s, margin >= %d\n",
+      s_iBodyY, s_iLift, s_chDir, s_iFrameMs, s_iServoDPS, s_iMinMargin);
+  printf("Built in gaits:\n");
+  int cBuiltinFail = 0;
+  for (byte iGait = 0; iGait < (sizeof(APG)/sizeof(APG[0])); iGait++) {
+    SimResult sr;
+    Result r;
+    PHOENIXGAIT gait = APG[iGait];
+    gait.NomGaitSpeed = s_iNomSpeed;     // Compare at the same step time
+    r.sTravel = MaxTravel(gait, s_iMaxTravel, s_iMinMargin, sr);
+    r.sMargin = sr.sMargin;
+    r.fSpeed = sr.fSpeed;
+    r.bFail = sr.bFail;
+    CheckMoves(r);
+    if (r.sTravel)
+      PrintEntry(gait, r, "");
+    else {
+      printf("    %-40s  // %d fails on %s\n", "", iGait, s_apszFail[r.bFail]);
+      cBuiltinFail++;
+    }
+  }
+  if (cBuiltinFail)
+    printf("%d built in gaits do not walk, the settings or the model are off\n", cBuiltinFail);
+  if (s_fCheckOnly)
+    return cBuiltinFail ? 1 : 0;
+  fflush(stdout);
+
+  std::vector<Candidate> acand;
+  std::vector<PHOENIXGAIT> aParamSets;
+  BuildCandidates(acand, aParamSets);
+  if (acand.empty()) {
+    fprintf(stderr, "No candidates in the given ranges\n");
+    return 1;
+  }
+  printf("\n%zu candidates from %zu field sets, %d workers\n", acand.size(), aParamSets.size(), s_cWorkers);
+  fflush(stdout);
+
+  // Results and the work counter are shared with the workers
+  size_t cbShared = sizeof(int) + acand.size() * sizeof(Result);
+  void *pvShared = mmap(NULL, cbShared, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (pvShared == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+  memset(pvShared, 0, cbShared);
+  volatile int *piNext = (volatile int *)pvShared;
+  Result *presults = (Result *)((char *)pvShared + sizeof(int));
+
+  struct timespec tsStart, tsEnd;
+  clock_gettime(CLOCK_MONOTONIC, &tsStart);
+  std::vector<pid_t> apid;
+  for (int iWorker = 0; iWorker < s_cWorkers; iWorker++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      Worker(acand, (int)aParamSets.size(), presults, piNext);
+      _exit(0);
+    }
+    if (pid < 0) {
+      perror("fork");
+      break;
+    }
+    apid.push_back(pid);
+  }
+  if (apid.empty())
+    Worker(acand, (int)aParamSets.size(), presults, piNext);
+  for (pid_t pid : apid) {
+    int iStatus;
+    waitpid(pid, &iStatus, 0);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &tsEnd);
+
+  // Rank what passed
+  long acFail[FAIL_COUNT] = {0};
+  std::vector<int> aiPassed;
+  for (size_t i = 0; i < acand.size(); i++) {
+    const Result &r = presults[i];
+    if (!r.bDone) {
+      fprintf(stderr, "Candidate %zu was not evaluated, a worker died?\n", i);
+      return 1;
+    }
+    if (r.sTravel > 0)
+      aiPassed.push_back((int)i);
+    else
+      acFail[r.bFail]++;
+  }
+  std::sort(aiPassed.begin(), aiPassed.end(),
+      [presults](int i1, int i2) { return BetterResult(presults[i1], presults[i2]); });
+
+  printf("%.1f s, %zu gaits walk", (tsEnd.tv_sec - tsStart.tv_sec) + (tsEnd.tv_nsec - tsStart.tv_nsec) / 1e9,
+      aiPassed.size());
+  for (int iFail = 1; iFail < FAIL_COUNT; iFail++) {
+    if (acFail[iFail])
+      printf(", %ld fail on %s", acFail[iFail], s_apszFail[iFail]);
+  }
+  printf("\n");
+
+  // Gaits that differ only in fields that made no difference, or in
+  // swapping the left and right legs, are shown once
+  std::vector<int> aiBest;
+  for (size_t i = 0; (i < aiPassed.size()) && ((int)aiBest.size() < s_cTop); i++) {
+    bool fSeen = false;
+    for (int iBest : aiBest) {
+      if (SameGait(acand[aiPassed[i]].gait, presults[aiPassed[i]], acand[iBest].gait, presults[iBest])) {
+        fSeen = true;
+        break;
+      }
+    }
+    if (!fSeen)
+      aiBest.push_back(aiPassed[i]);
+  }
+
+  if (aiBest.empty()) {
+    printf("\nNo gait walks with a stability margin of at least %d mm, -m sets it\n", s_iMinMargin);
+    munmap(pvShared, cbShared);
+    return cBuiltinFail ? 1 : 0;
+  }
+  printf("\nBest gaits, APG entries:\n");
+  for (int i = 0; i < (int)aiBest.size(); i++) {
+    char szRank[16];
+    snprintf(szRank, sizeof(szRank), "%d: ", i + 1);
+    PrintEntry(acand[aiBest[i]].gait, presults[aiBest[i]], szRank);
+  }
+  printf("\nSame, as terminal commands (then N S <slot> to keep one):\n");
+  for (int iBest : aiBest)
+    PrintTerminalLine(acand[iBest].gait);
+  munmap(pvShared, cbShared);
+  return cBuiltinFail ? 1 : 0;
+}
@@ -0,0 +1,282 @@
+//====================================================================
+// gait_trace - Host side decoder for the gait trace of the Phoenix code
+//
+// Capture the output of the R D terminal command (everything from the
+// #TRACE line to #END, other lines are skipped) into a file and run:
+//
+//   g++ -std=c++17 -O2 -o gait_trace tools/gait_trace.cpp
+//   ./gait_trace capture.txt        (or read from stdin)
+//
+// For each gait in the capture it prints per leg:
+//   duty    - part of the frames the foot is on the ground (GaitPosY == 0)
+//   stride  - average distance the foot moves over a complete stance, mm
+//   slip    - average difference per stance frame between what the foot
+//             did and what the other feet on the ground did, mm.  Feet
+//             on the ground should all move together with the body.
+//   clamp   - stance frames where CheckAngles clamped the leg or LegIK had
+//             no solution, so the foot was not where the gait wanted it
+//   lift    - average GaitPosY over the frames of a swing
+//====================================================================
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+struct TraceRec {
+  unsigned long lTime;
+  unsigned wMoveTime;
+  int bGaitType;
+  int bGaitStep;
+  int bClampedLegs;
+  std::vector<int> abIKFlags;
+  std::vector<short> asGaitPos;     // legs * 4: X, Y, Z, RotY
+  std::vector<short> asLegPos;      // legs * 3
+  std::vector<short> asAngle1;      // legs * dof
+};
+
+struct LegStats {
+  long cFrames = 0;
+  long cStance = 0;
+  long cStrides = 0;
+  double dStride = 0;
+  long cSlipFrames = 0;
+  double dSlip = 0;
+  long cClamped = 0;
+  std::vector<double> adLift;       // sum of GaitPosY per swing frame
+  std::vector<long> acLift;
+};
+
+struct GaitStats {
+  long cFrames = 0;
+  double dFrameMs = 0;
+  long cFrameTimes = 0;
+  std::vector<LegStats> legs;
+};
+
+static int g_cLegs = 6;
+static int g_cDOF = 3;
+
+//--------------------------------------------------------------------
+// Hex field reader, the firmware writes every field big endian
+//--------------------------------------------------------------------
+class HexReader {
+public:
+  explicit HexReader(const char *psz) : _psz(psz), _fOK(true) {}
+  unsigned long Get(int cDigits) {
+    unsigned long ul = 0;
+    while (cDigits--) {
+      int ch = *_psz;
+      int v;
+      if ((ch >= '0') && (ch <= '9')) v = ch - '0';
+      else if ((ch >= 'A') && (ch <= 'F')) v = ch - 'A' + 10;
+      else if ((ch >= 'a') && (ch <= 'f')) v = ch - 'a' + 10;
+      else { _fOK = false; return 0; }
+      ul = (ul << 4) | v;
+      _psz++;
+    }
+    return ul;
+  }
+  short GetShort() { return (short)(unsigned short)Get(4); }
+  bool OK() const { return _fOK; }
+private:
+  const char *_psz;
+  bool _fOK;
+};
+
+static bool ParseRecord(const char *psz, TraceRec &rec)
+{
+  HexReader hr(psz);
+  rec.lTime = hr.Get(8);
+  rec.wMoveTime = hr.Get(4);
+  rec.bGaitType = hr.Get(2);
+  rec.bGaitStep = hr.Get(2);
+  rec.bClampedLegs = hr.Get(2);
+  rec.abIKFlags.resize(g_cLegs);
+  for (int i = 0; i < g_cLegs; i++)
+    rec.abIKFlags[i] = hr.Get(2);
+  rec.asGaitPos.resize(g_cLegs * 4);
+  for (int i = 0; i < g_cLegs * 4; i++)
+    rec.asGaitPos[i] = hr.GetShort();
+  rec.asLegPos.resize(g_cLegs * 3);
+  for (int i = 0; i < g_cLegs * 3; i++)
+    rec.asLegPos[i] = hr.GetShort();
+  rec.asAngle1.resize(g_cLegs * g_cDOF);
+  for (int i = 0; i < g_cLegs * g_cDOF; i++)
+    rec.asAngle1[i] = hr.GetShort();
+  return hr.OK();
+}
+
+static inline short GX(const TraceRec &r, int leg) { return r.asGaitPos[leg * 4 + 0]; }
+static inline short GY(const TraceRec &r, int leg) { return r.asGaitPos[leg * 4 + 1]; }
+static inline short GZ(const TraceRec &r, int leg) { return r.asGaitPos[leg * 4 + 2]; }
+
+//--------------------------------------------------------------------
+// Analyze - Walk through the records of one gait.  A stance is a run of
+//      frames with the foot down, a swing a run with it up.  Only complete
+//      ones (with a change on both ends) count for stride and lift.
+//--------------------------------------------------------------------
+static void Analyze(const std::vector<TraceRec> &recs, std::map<int, GaitStats> &gaits)
+{
+  std::vector<int> aiStanceStart(g_cLegs, -1);
+  std::vector<int> aiSwingStart(g_cLegs, -1);
+  int iPrevGait = -1;
+
+  for (size_t i = 0; i < recs.size(); i++) {
+    const TraceRec &r = recs[i];
+    GaitStats &gs = gaits[r.bGaitType];
+    if (gs.legs.empty())
+      gs.legs.resize(g_cLegs);
+    gs.cFrames++;
+
+    if (r.bGaitType != iPrevGait) {
+      // Gait changed, phases in flight don't belong to either gait
+      std::fill(aiStanceStart.begin(), aiStanceStart.end(), -1);
+      std::fill(aiSwingStart.begin(), aiSwingStart.end(), -1);
+      iPrevGait = r.bGaitType;
+      continue;
+    }
+    const TraceRec &p = recs[i - 1];
+    gs.dFrameMs += (double)(r.lTime - p.lTime);
+    gs.cFrameTimes++;
+
+    // What the feet on the ground did this frame, on average
+    double dX = 0, dZ = 0;
+    int cDown = 0;
+    for (int leg = 0; leg < g_cLegs; leg++) {
+      if ((GY(r, leg) == 0) && (GY(p, leg) == 0)) {
+        dX += GX(r, leg) - GX(p, leg);
+        dZ += GZ(r, leg) - GZ(p, leg);
+        cDown++;
+      }
+    }
+
+    for (int leg = 0; leg < g_cLegs; leg++) {
+      LegStats &ls = gs.legs[leg];
+      bool fDown = (GY(r, leg) == 0);
+      bool fWasDown = (GY(p, leg) == 0);
+      ls.cFrames++;
+
+      if (fDown) {
+        ls.cStance++;
+        if ((r.bClampedLegs & (1 << leg)) || (r.abIKFlags[leg] & 4))
+          ls.cClamped++;
+        if (fWasDown && (cDown > 1)) {
+          // Compare against the other feet on the ground
+          double dOX = (dX - (GX(r, leg) - GX(p, leg))) / (cDown - 1);
+          double dOZ = (dZ - (GZ(r, leg) - GZ(p, leg))) / (cDown - 1);
+          ls.dSlip += std::hypot((GX(r, leg) - GX(p, leg)) - dOX, (GZ(r, leg) - GZ(p, leg)) - dOZ);
+          ls.cSlipFrames++;
+        }
+      }
+
+      if (fDown && !fWasDown) {
+        // Touch down: a swing ended, a stance starts
+        if (aiSwingStart[leg] >= 0) {
+          int cSwing = (int)i - aiSwingStart[leg];
+          if ((int)ls.adLift.size() < cSwing) {
+            ls.adLift.resize(cSwing, 0);
+            ls.acLift.resize(cSwing, 0);
+          }
+          for (int j = 0; j < cSwing; j++) {
+            ls.adLift[j] += GY(recs[aiSwingStart[leg] + j], leg);
+            ls.acLift[j]++;
+          }
+        }
+        aiSwingStart[leg] = -1;
+        aiStanceStart[leg] = (int)i;
+      }
+      else if (!fDown && fWasDown) {
+        // Lift off: a stance ended, measure it
+        if (aiStanceStart[leg] >= 0) {
+          const TraceRec &s = recs[aiStanceStart[leg]];
+          ls.dStride += std::hypot(GX(p, leg) - GX(s, leg), GZ(p, leg) - GZ(s, leg));
+          ls.cStrides++;
+        }
+        aiStanceStart[leg] = -1;
+        aiSwingStart[leg] = (int)i;
+      }
+    }
+  }
+}
+
+static void Report(const std::map<int, GaitStats> &gaits)
+{
+  for (const auto &it : gaits) {
+    const GaitStats &gs = it.second;
+    printf("Gait %d: %ld frames", it.first, gs.cFrames);
+    if (gs.cFrameTimes)
+      printf(", %.1f ms/frame", gs.dFrameMs / gs.cFrameTimes);
+    printf("\n  leg  duty  stride   slip  clamp  lift\n");
+    for (int leg = 0; leg < (int)gs.legs.size(); leg++) {
+      const LegStats &ls = gs.legs[leg];
+      printf("  %3d  %3.0f%%  %6.1f  %5.2f  %4ld  ", leg,
+          ls.cFrames ? (100.0 * ls.cStance) / ls.cFrames : 0.0,
+          ls.cStrides ? ls.dStride / ls.cStrides : 0.0,
+          ls.cSlipFrames ? ls.dSlip / ls.cSlipFrames : 0.0,
+          ls.cClamped);
+      for (size_t j = 0; j < ls.adLift.size(); j++)
+        printf(" %.0f", ls.adLift[j] / ls.acLift[j]);
+      printf("\n");
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  FILE *pf = stdin;
+  char szLine[2048];
+  std::vector<TraceRec> recs;
+  bool fInTrace = false;
+  long cBad = 0;
+
+  if (argc > 1) {
+    pf = fopen(argv[1], "r");
+    if (!pf) {
+      fprintf(stderr, "Can't open %s\n", argv[1]);
+      return 1;
+    }
+  }
+
+  while (fgets(szLine, sizeof(szLine), pf)) {
+    char *psz = szLine;
+    while ((*psz == ' ') || (*psz == '\t'))
+      psz++;
+    if (!strncmp(psz, "#TRACE", 6)) {
+      int iVersion = 0;
+      if ((sscanf(psz, "#TRACE %d legs=%d dof=%d", &iVersion, &g_cLegs, &g_cDOF) != 3) || (iVersion != 1)) {
+        fprintf(stderr, "Unknown trace header: %s", psz);
+        return 1;
+      }
+      fInTrace = true;
+      recs.clear();
+    }
+    else if (!strncmp(psz, "#END", 4))
+      fInTrace = false;
+    else if (fInTrace && (psz[0] == 'T') && (psz[1] == ' ')) {
+      TraceRec rec;
+      if (ParseRecord(psz + 2, rec))
+        recs.push_back(rec);
+      else
+        cBad++;
+    }
+  }
+  if (pf != stdin)
+    fclose(pf);
+
+  if (recs.empty()) {
+    fprintf(stderr, "No trace records found\n");
+    return 1;
+  }
+  printf("%zu records, %d legs, %d DOF", recs.size(), g_cLegs, g_cDOF);
+  if (cBad)
+    printf(", %ld bad lines skipped", cBad);
+  printf("\n");
+
+  std::map<int, GaitStats> gaits;
+  Analyze(recs, gaits);
+  Report(gaits);
+  return 0;
+}
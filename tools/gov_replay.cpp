@@ -0,0 +1,100 @@
+//====================================================================
+// gov_replay - Host side replay of the CPU governor of the Phoenix code.
+//      It builds the real GovernorDecide against the stand in Arduino
+//      headers in tools/host, so a change to the governor settings in
+//      Hex_Cfg.h can be tried on recorded loads before it goes on the
+//      robot.
+//
+// Turn on the load lines with the V L terminal command, capture the
+// serial output (other lines are skipped) into a file and run:
+//
+//   g++ -std=gnu++17 -O2 -I tools/host -I . -o gov_replay tools/gov_replay.cpp
+//   ./gov_replay [-v] capture.txt   (or read from stdin)
+//
+// Each "GOV <load%> <mode> <MHz>" line is one window.  The load was
+// measured at that MHz, the replay scales it to the clock its own
+// governor is at, so the decisions do not have to match the recorded
+// ones.  It prints the part of the windows at each clock, how often the
+// clock changed, and the windows where the scaled load was over
+// GOV_UP_PCT and over 100%, where the loop could not have kept up.
+// -v prints every decision.
+//====================================================================
+#include <Arduino.h>
+
+#include "Hex_Cfg.h"
+#ifndef OPT_CPU_GOVERNOR
+#define OPT_CPU_GOVERNOR
+#endif
+#undef OPT_PIPELINE
+#include "Phoenix_ESP32_PS4.ino"
+
+static const char *s_apszMode[] = {"off", "pose", "walk", "balance"};
+
+int main(int argc, char **argv)
+{
+  FILE *pf = stdin;
+  char szLine[256];
+  bool fVerbose = false;
+  GOVSTATE gs = {GOV_LEVELS - 1, 0};
+  long alWindows[GOV_LEVELS] = {};
+  long cWindows = 0;
+  long cChanges = 0;
+  long cOverUp = 0;
+  long cOverFull = 0;
+  long cBad = 0;
+
+  for (int iArg = 1; iArg < argc; iArg++) {
+    if (!strcmp(argv[iArg], "-v"))
+      fVerbose = true;
+    else if (!strcmp(argv[iArg], "-h")) {
+      fprintf(stderr, "usage: gov_replay [-v] [capture]\n");
+      return 0;
+    }
+    else if (!(pf = fopen(argv[iArg], "r"))) {
+      fprintf(stderr, "Can't open %s\n", argv[iArg]);
+      return 1;
+    }
+  }
+
+  while (fgets(szLine, sizeof(szLine), pf)) {
+    int iLoad, iMode, iMhz;
+    const char *psz = strstr(szLine, "GOV ");
+    if (!psz)
+      continue;
+    if ((sscanf(psz, "GOV %d %d %d", &iLoad, &iMode, &iMhz) != 3) || (iMode < GOV_MODE_OFF) ||
+        (iMode > GOV_MODE_BALANCE) || (iMhz <= 0)) {
+      cBad++;
+      continue;
+    }
+
+    // What the load would have been at the clock we are at
+    long lLoad = ((long)iLoad * iMhz + c_awGovMhz[gs.iLevel] / 2) / c_awGovMhz[gs.iLevel];
+    byte iLevel = gs.iLevel;
+    alWindows[iLevel]++;
+    cWindows++;
+    if (lLoad > GOV_UP_PCT)
+      cOverUp++;
+    if (lLoad > 100)
+      cOverFull++;
+
+    word wMhz = GovernorDecide(&gs, (byte)min(lLoad, 255L), (byte)iMode);
+    if (gs.iLevel != iLevel)
+      cChanges++;
+    if (fVerbose)
+      printf("%6ld %-7s load %3ld%% at %3d MHz -> %3d MHz\n", cWindows, s_apszMode[iMode], lLoad,
+          c_awGovMhz[iLevel], wMhz);
+  }
+
+  if (!cWindows) {
+    fprintf(stderr, "No GOV lines found\n");
+    return 1;
+  }
+  printf("Windows: %ld (%.1fs)", cWindows, cWindows * (GOV_WINDOW_FRAMES * (CTRL_TICK_US / 1000.0)) / 1000.0);
+  for (byte i = 0; i < GOV_LEVELS; i++)
+    printf("  %dMHz: %.1f%%", c_awGovMhz[i], 100.0 * alWindows[i] / cWindows);
+  printf("\nChanges: %ld  Load over %d%%: %ld  Over 100%%: %ld", cChanges, GOV_UP_PCT, cOverUp, cOverFull);
+  if (cBad)
+    printf("  Bad lines: %ld", cBad);
+  printf("\n");
+  return 0;
+}
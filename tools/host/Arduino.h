@@ -0,0 +1,218 @@
+//====================================================================
+// Arduino.h - Minimal host (Linux) stand in for the parts of the Arduino
+//      ESP32 core that the Phoenix code uses, so the real gait and IK code
+//      can be built into host tools.  Everything is inline, a tool is one
+//      source file that includes the sketch.
+//
+//      Time only moves when the code calls delay() or delayMicroseconds(),
+//      or by 1us for each look at micros() so that polling loops with a
+//      timeout still end.  yield() jumps to the next esp_timer, if any.
+//      By default that runs as fast as the host can go; a tool that sets
+//      g_dblHostClockRate (say 100 for 100x real time) has each jump held
+//      back to that rate against the wall clock.  Serial output goes to
+//      stdout when g_fHostEcho is set and serial input comes from
+//      HostSerialInput().
+//====================================================================
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+typedef uint8_t     byte;
+typedef uint16_t    word;
+typedef bool        boolean;
+
+#define ESP32       1
+#define F(x)        (x)
+#define PROGMEM
+#define PGM_P       const char *
+#define IRAM_ATTR
+#define pgm_read_byte(p)    (*(const uint8_t *)(p))
+#define pgm_read_word(p)    (*(const uint16_t *)(p))
+
+#ifndef min
+#define min(a,b)    ((a)<(b)?(a):(b))
+#define max(a,b)    ((a)>(b)?(a):(b))
+#endif
+#define constrain(v,l,h)    ((v)<(l)?(l):((v)>(h)?(h):(v)))
+
+#define DEC         10
+#define HEX         16
+#define INPUT       0
+#define OUTPUT      1
+#define INPUT_PULLUP 5
+#define FALLING     2
+#define LOW         0
+#define HIGH        1
+#define SERIAL_8N1  0x800001c
+#define A0          36
+#define A1          37
+#define A2          38
+#define A3          39
+#define A4          32
+#define digitalPinToPort(p)     (p)
+#define digitalPinToBitMask(p)  ((uint16_t)1)
+#define portOutputRegister(p)   (&g_ulHostPortReg)
+
+inline volatile uint32_t g_ulHostPortReg;
+inline unsigned long long g_ullHostMicros;
+inline bool g_fHostEcho;
+inline std::string g_strHostInput;
+
+inline double g_dblHostClockRate;          // Simulated us per real us, 0 is flat out
+
+// Hold the simulated clock back to g_dblHostClockRate.  Only sleeps once it
+// is a ms ahead, so the cost of the sleeps stays small.
+inline void HostClockPace(void)
+{
+  static std::chrono::steady_clock::time_point s_tpStart;
+  static unsigned long long s_ullStart;
+  static double s_dblRate;
+
+  if (g_dblHostClockRate <= 0)
+    return;
+  if (s_dblRate != g_dblHostClockRate) {
+    s_tpStart = std::chrono::steady_clock::now();
+    s_ullStart = g_ullHostMicros;
+    s_dblRate = g_dblHostClockRate;
+  }
+  auto tpDue = s_tpStart + std::chrono::microseconds((long long)((g_ullHostMicros - s_ullStart) / s_dblRate));
+  if (tpDue - std::chrono::steady_clock::now() > std::chrono::milliseconds(1))
+    std::this_thread::sleep_until(tpDue);
+}
+
+inline unsigned long micros(void) { return (unsigned long)++g_ullHostMicros; }
+inline unsigned long millis(void) { return (unsigned long)(g_ullHostMicros / 1000); }
+inline void delay(unsigned long ms) { g_ullHostMicros += (unsigned long long)ms * 1000; HostClockPace(); }
+inline void delayMicroseconds(unsigned int us) { g_ullHostMicros += us; HostClockPace(); }
+inline void (*g_pfnHostYield)(void);     // Set by the esp_timer.h stand in
+inline void yield(void) { if (g_pfnHostYield) g_pfnHostYield(); }
+inline void pinMode(int, int) {}
+inline void digitalWrite(int, int) {}
+inline int digitalRead(int) { return LOW; }
+inline int analogRead(int) { return 0; }
+#define digitalPinToInterrupt(p)    (p)
+inline void attachInterrupt(uint8_t, void (*)(void), int) {}
+
+inline uint32_t g_ulHostCpuMhz = 240;
+inline bool setCpuFrequencyMhz(uint32_t ulMhz) { g_ulHostCpuMhz = ulMhz; return true; }
+inline uint32_t getCpuFrequencyMhz(void) { return g_ulHostCpuMhz; }
+
+// LEDC, the ESP32 core 2.x calls.  g_dblHostTone is the last tone written
+inline double g_dblHostTone;
+inline double ledcSetup(uint8_t, double dblFreq, uint8_t) { return dblFreq; }
+inline void ledcAttachPin(uint8_t, uint8_t) {}
+inline double ledcWriteTone(uint8_t, double dblFreq) { return g_dblHostTone = dblFreq; }
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t b) {
+    if (g_fHostEcho)
+      putchar(b);
+    return 1;
+  }
+  size_t write(const uint8_t *pb, size_t cb) {
+    for (size_t i = 0; i < cb; i++)
+      write(pb[i]);
+    return cb;
+  }
+  size_t write(const char *pb, size_t cb) { return write((const uint8_t *)pb, cb); }
+
+  size_t print(const char *psz) { return write(psz, strlen(psz)); }
+  size_t print(const std::string &str) { return print(str.c_str()); }
+  size_t print(char ch) { return write((uint8_t)ch); }
+  size_t print(unsigned char b, int base = DEC) { return printNumber(b, base, false); }
+  size_t print(int i, int base = DEC) { return printNumber(i, base, true); }
+  size_t print(unsigned int u, int base = DEC) { return printNumber(u, base, false); }
+  size_t print(long l, int base = DEC) { return printNumber(l, base, true); }
+  size_t print(unsigned long ul, int base = DEC) { return printNumber(ul, base, false); }
+  size_t print(long long ll, int base = DEC) { return printNumber(ll, base, true); }
+  size_t print(unsigned long long ull, int base = DEC) { return printNumber((long long)ull, base, false); }
+  size_t print(double d, int digits = 2) {
+    char sz[40];
+    snprintf(sz, sizeof(sz), "%.*f", digits, d);
+    return print(sz);
+  }
+
+  size_t println(void) { return print("\r\n"); }
+  template <typename T> size_t println(T v) { size_t cb = print(v); return cb + println(); }
+  template <typename T> size_t println(T v, int base) { size_t cb = print(v, base); return cb + println(); }
+
+  size_t printf(const char *pszFmt, ...) {
+    char sz[256];
+    va_list ap;
+    va_start(ap, pszFmt);
+    vsnprintf(sz, sizeof(sz), pszFmt, ap);
+    va_end(ap);
+    return print(sz);
+  }
+
+private:
+  size_t printNumber(long long ll, int base, bool fSigned) {
+    char sz[40];
+    if (base == HEX)
+      snprintf(sz, sizeof(sz), "%llX", (unsigned long long)ll);
+    else if (fSigned)
+      snprintf(sz, sizeof(sz), "%lld", ll);
+    else
+      snprintf(sz, sizeof(sz), "%llu", (unsigned long long)ll);
+    return print(sz);
+  }
+};
+
+class Stream : public Print {
+public:
+  virtual int available(void) { return 0; }
+  virtual int read(void) { return -1; }
+  virtual int peek(void) { return -1; }
+  void flush(void) {}
+  int availableForWrite(void) { return 128; }
+  void setTimeout(unsigned long) {}
+};
+
+class HardwareSerial : public Stream {
+public:
+  explicit HardwareSerial(bool fConsole = false) : _fConsole(fConsole) {}
+  void begin(unsigned long) {}
+  void begin(unsigned long, uint32_t, int8_t, int8_t) {}
+  void end(void) {}
+  operator bool() const { return true; }
+  size_t write(uint8_t b) override { return _fConsole ? Print::write(b) : 1; }
+  int available(void) override { return _fConsole ? (int)g_strHostInput.size() : 0; }
+  int peek(void) override { return available() ? (uint8_t)g_strHostInput[0] : -1; }
+  int read(void) override {
+    int ch = peek();
+    if (ch >= 0)
+      g_strHostInput.erase(0, 1);
+    return ch;
+  }
+  using Print::write;
+private:
+  bool _fConsole;
+};
+
+inline HardwareSerial Serial(true);
+inline HardwareSerial Serial1;
+inline HardwareSerial Serial2;
+
+// Queue text as if it was typed into the serial monitor
+inline void HostSerialInput(const char *psz) { g_strHostInput += psz; }
+
+// The ESP32 core brings in FreeRTOS with Arduino.h as well
+#include <freertos/FreeRTOS.h>
+
+#endif // HOST_ARDUINO_H
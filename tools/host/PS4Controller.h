@@ -0,0 +1,63 @@
+//====================================================================
+// PS4Controller.h - Host stand in for the ESP32 PS4 controller library.
+//      The controller is never connected unless a tool sets
+//      g_fHostPS4Connected and fills in PS4.data itself.
+//====================================================================
+#ifndef HOST_PS4CONTROLLER_H
+#define HOST_PS4CONTROLLER_H
+
+#include <Arduino.h>
+
+struct ps4_button_t {
+  bool right, down, up, left;
+  bool square, cross, circle, triangle;
+  bool l1, r1, l2, r2;
+  bool share, options, l3, r3;
+  bool ps, touchpad;
+};
+
+struct ps4_analog_stick_t {
+  int8_t lx, ly, rx, ry;
+};
+
+struct ps4_analog_button_t {
+  uint8_t l2, r2;
+};
+
+struct ps4_analog_t {
+  ps4_analog_stick_t stick;
+  ps4_analog_button_t button;
+};
+
+struct ps4_status_t {
+  uint8_t battery, charging, audio, mic;
+};
+
+struct ps4_t {
+  ps4_analog_t analog;
+  ps4_button_t button;
+  ps4_status_t status;
+};
+
+inline bool g_fHostPS4Connected;
+
+class PS4Controller {
+public:
+  bool begin(void) { return true; }
+  bool begin(const char *) { return true; }
+  void end(void) {}
+  bool isConnected(void) { return g_fHostPS4Connected; }
+  void setLed(uint8_t, uint8_t, uint8_t) {}
+  void setRumble(uint8_t, uint8_t) {}
+  void setFlashRate(uint8_t, uint8_t) {}
+  void sendToController(void) {}
+  void attach(void (*pfn)(void)) { pfnNotify = pfn; }
+  void attachOnDisconnect(void (*pfn)(void)) { pfnDisconnect = pfn; }
+  void (*pfnNotify)(void);          // A tool calls these to act like the Bluetooth task
+  void (*pfnDisconnect)(void);
+  ps4_t data;
+};
+
+inline PS4Controller PS4;
+
+#endif // HOST_PS4CONTROLLER_H
@@ -0,0 +1,63 @@
+//====================================================================
+// Preferences.h - Host stand in for the ESP32 NVS Preferences library,
+//      kept in RAM for the life of the process.
+//====================================================================
+#ifndef HOST_PREFERENCES_H
+#define HOST_PREFERENCES_H
+
+#include <Arduino.h>
+
+inline std::map<std::string, std::vector<uint8_t> > g_mapHostNVS;
+
+class Preferences {
+public:
+  bool begin(const char *pszNS, bool fReadOnly = false) {
+    _strNS = std::string(pszNS) + "/";
+    (void)fReadOnly;
+    return true;
+  }
+  void end(void) {}
+  bool clear(void) {
+    for (auto it = g_mapHostNVS.begin(); it != g_mapHostNVS.end(); ) {
+      if (!it->first.compare(0, _strNS.size(), _strNS))
+        it = g_mapHostNVS.erase(it);
+      else
+        ++it;
+    }
+    return true;
+  }
+  bool remove(const char *pszKey) { return g_mapHostNVS.erase(_strNS + pszKey) != 0; }
+  bool isKey(const char *pszKey) { return g_mapHostNVS.count(_strNS + pszKey) != 0; }
+  size_t putBytes(const char *pszKey, const void *pv, size_t cb) {
+    g_mapHostNVS[_strNS + pszKey].assign((const uint8_t *)pv, (const uint8_t *)pv + cb);
+    return cb;
+  }
+  size_t getBytesLength(const char *pszKey) {
+    auto it = g_mapHostNVS.find(_strNS + pszKey);
+    return (it == g_mapHostNVS.end()) ? 0 : it->second.size();
+  }
+  size_t getBytes(const char *pszKey, void *pv, size_t cbMax) {
+    auto it = g_mapHostNVS.find(_strNS + pszKey);
+    if (it == g_mapHostNVS.end())
+      return 0;
+    size_t cb = min(cbMax, it->second.size());
+    memcpy(pv, it->second.data(), cb);
+    return cb;
+  }
+  size_t putUChar(const char *pszKey, uint8_t b) { return putBytes(pszKey, &b, 1); }
+  uint8_t getUChar(const char *pszKey, uint8_t bDefault = 0) {
+    uint8_t b = bDefault;
+    getBytes(pszKey, &b, 1);
+    return b;
+  }
+  size_t putULong(const char *pszKey, uint32_t ul) { return putBytes(pszKey, &ul, 4); }
+  uint32_t getULong(const char *pszKey, uint32_t ulDefault = 0) {
+    uint32_t ul = ulDefault;
+    getBytes(pszKey, &ul, 4);
+    return ul;
+  }
+private:
+  std::string _strNS;
+};
+
+#endif // HOST_PREFERENCES_H
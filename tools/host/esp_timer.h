@@ -0,0 +1,94 @@
+//====================================================================
+// esp_timer.h - Host stand in for the ESP-IDF high resolution timer.
+//      Periodic and one shot timers fire from yield(): time jumps straight
+//      to the next one that is due, so a loop waiting on a timer runs as fast
+//      as the host can go (or at g_dblHostClockRate) while its times stay
+//      what they would be on the robot.  esp_timer_get_time() is the same
+//      simulated clock as micros(), it is what ClockUs() reads.
+//====================================================================
+#ifndef HOST_ESP_TIMER_H
+#define HOST_ESP_TIMER_H
+
+#include <Arduino.h>
+
+typedef int esp_err_t;
+#define ESP_OK      0
+
+typedef void (*esp_timer_cb_t)(void *arg);
+
+typedef struct {
+  esp_timer_cb_t  callback;
+  void            *arg;
+  int             dispatch_method;
+  const char      *name;
+  bool            skip_unhandled_events;
+} esp_timer_create_args_t;
+
+struct esp_timer {
+  esp_timer_cb_t      callback;
+  void                *arg;
+  unsigned long long  ullPeriod;
+  unsigned long long  ullNext;
+  bool                fActive;
+};
+typedef esp_timer *esp_timer_handle_t;
+
+inline std::vector<esp_timer *> g_vHostTimers;
+
+inline int64_t esp_timer_get_time(void) { return (int64_t)g_ullHostMicros; }
+
+// Jump to the next timer that is due and fire it
+inline void HostTimerYield(void)
+{
+  esp_timer *ptNext = nullptr;
+  for (esp_timer *pt : g_vHostTimers) {
+    if (pt->fActive && (!ptNext || (pt->ullNext < ptNext->ullNext)))
+      ptNext = pt;
+  }
+  if (!ptNext)
+    return;
+  if (g_ullHostMicros < ptNext->ullNext) {
+    g_ullHostMicros = ptNext->ullNext;
+    HostClockPace();
+  }
+  if (ptNext->ullPeriod)
+    ptNext->ullNext += ptNext->ullPeriod;
+  else
+    ptNext->fActive = false;
+  ptNext->callback(ptNext->arg);
+}
+
+inline esp_err_t esp_timer_create(const esp_timer_create_args_t *pargs, esp_timer_handle_t *phTimer)
+{
+  esp_timer *pt = new esp_timer();
+  pt->callback = pargs->callback;
+  pt->arg = pargs->arg;
+  g_vHostTimers.push_back(pt);
+  g_pfnHostYield = HostTimerYield;
+  *phTimer = pt;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_timer_start_periodic(esp_timer_handle_t hTimer, uint64_t ullPeriod)
+{
+  hTimer->ullPeriod = ullPeriod;
+  hTimer->ullNext = g_ullHostMicros + ullPeriod;
+  hTimer->fActive = true;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_timer_start_once(esp_timer_handle_t hTimer, uint64_t ullTimeout)
+{
+  hTimer->ullPeriod = 0;
+  hTimer->ullNext = g_ullHostMicros + ullTimeout;
+  hTimer->fActive = true;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_timer_stop(esp_timer_handle_t hTimer)
+{
+  hTimer->fActive = false;
+  return ESP_OK;
+}
+
+#endif // HOST_ESP_TIMER_H
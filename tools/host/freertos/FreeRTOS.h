@@ -0,0 +1,122 @@
+//====================================================================
+// freertos/FreeRTOS.h - Host stand in for the parts of FreeRTOS the
+//      Phoenix code uses.  There is only the one host thread: tasks are
+//      created but never run, queues and semaphores never block, a take
+//      or receive that would have to wait just fails.  A notification
+//      take runs the next esp_timer, as that is what wakes loop().  Host tools that run
+//      loop() should build with OPT_PIPELINE off.
+//====================================================================
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+#include <Arduino.h>
+#include <deque>
+
+typedef int             BaseType_t;
+typedef unsigned int    UBaseType_t;
+typedef uint32_t        TickType_t;
+
+#define pdFALSE         0
+#define pdTRUE          1
+#define pdPASS          pdTRUE
+#define pdFAIL          pdFALSE
+#define errQUEUE_FULL   0
+#define portMAX_DELAY   ((TickType_t)0xffffffff)
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms))
+#define configMAX_PRIORITIES    25
+#define portYIELD_FROM_ISR(f)   ((void)(f))
+
+typedef void (*TaskFunction_t)(void *);
+struct HostTask { TaskFunction_t pfn; void *pvArg; };
+typedef HostTask *TaskHandle_t;
+
+struct HostQueue {
+  UBaseType_t                       cItemsMax;
+  UBaseType_t                       cbItem;
+  std::deque<std::vector<uint8_t> > items;
+};
+typedef HostQueue *QueueHandle_t;
+typedef HostQueue *SemaphoreHandle_t;
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pfn, const char *, uint32_t, void *pvArg,
+    UBaseType_t, TaskHandle_t *phTask, BaseType_t)
+{
+  HostTask *pt = new HostTask{pfn, pvArg};
+  if (phTask)
+    *phTask = pt;
+  return pdPASS;
+}
+
+// Critical sections, nothing else can run on the host
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED    0
+#define portENTER_CRITICAL(pmux)        ((void)(pmux))
+#define portEXIT_CRITICAL(pmux)         ((void)(pmux))
+
+inline void vTaskDelete(TaskHandle_t) {}
+inline BaseType_t xPortGetCoreID(void) { return 1; }
+inline void vTaskPrioritySet(TaskHandle_t, UBaseType_t) {}
+inline UBaseType_t uxTaskPriorityGet(TaskHandle_t) { return 1; }
+
+inline TickType_t xTaskGetTickCount(void) { return (TickType_t)(g_ullHostMicros / 1000); }
+inline void vTaskDelay(TickType_t xTicks) { delay(xTicks); }
+inline void vTaskDelayUntil(TickType_t *pxLast, TickType_t xTicks)
+{
+  *pxLast += xTicks;
+  if (xTaskGetTickCount() < *pxLast)
+    delay(*pxLast - xTaskGetTickCount());
+}
+inline void xTaskNotifyGive(TaskHandle_t) {}
+inline void vTaskNotifyGiveFromISR(TaskHandle_t, BaseType_t *pfWoken) { if (pfWoken) *pfWoken = pdFALSE; }
+// Only the loop() task runs, waiting for its notification lets the timers fire
+inline uint32_t ulTaskNotifyTake(BaseType_t, TickType_t) { yield(); return 1; }
+inline TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+  static HostTask s_taskLoop = {nullptr, nullptr};
+  return &s_taskLoop;
+}
+
+inline QueueHandle_t xQueueCreate(UBaseType_t cItems, UBaseType_t cbItem)
+{
+  return new HostQueue{cItems, cbItem, {}};
+}
+
+inline BaseType_t xQueueSend(QueueHandle_t q, const void *pv, TickType_t)
+{
+  if (q->items.size() >= q->cItemsMax)
+    return errQUEUE_FULL;
+  q->items.emplace_back((const uint8_t *)pv, (const uint8_t *)pv + q->cbItem);
+  return pdPASS;
+}
+
+inline BaseType_t xQueueOverwrite(QueueHandle_t q, const void *pv)
+{
+  q->items.clear();
+  return xQueueSend(q, pv, 0);
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t q, void *pv, TickType_t)
+{
+  if (q->items.empty())
+    return pdFALSE;
+  memcpy(pv, q->items.front().data(), q->cbItem);
+  q->items.pop_front();
+  return pdTRUE;
+}
+
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) { return (UBaseType_t)q->items.size(); }
+
+// Semaphores are queues of empty items, the same as in FreeRTOS
+inline SemaphoreHandle_t xSemaphoreCreateBinary(void) { return xQueueCreate(1, 0); }
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t h) { return xQueueSend(h, NULL, 0); }
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t h, TickType_t)
+{
+  if (h->items.empty())
+    return pdFALSE;
+  h->items.pop_front();
+  return pdTRUE;
+}
+// A mutex starts out given
+inline SemaphoreHandle_t xSemaphoreCreateMutex(void) { SemaphoreHandle_t h = xSemaphoreCreateBinary(); xSemaphoreGive(h); return h; }
+
+#endif // HOST_FREERTOS_H
@@ -0,0 +1,2 @@
+// freertos/queue.h - Host stand in, all of it is in FreeRTOS.h
+#include "FreeRTOS.h"
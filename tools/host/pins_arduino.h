@@ -0,0 +1 @@
+// pins_arduino.h - Host stand in, the pin names are in Arduino.h
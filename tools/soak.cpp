@@ -0,0 +1,158 @@
+//====================================================================
+// soak - Host side soak run of the whole Phoenix controller.  It builds
+//      the real setup() and loop() against the stand in Arduino headers in
+//      tools/host and drives them with scripted PS4 input on the simulated
+//      clock, so an hour of walking takes well under a minute.
+//
+//   g++ -std=gnu++17 -O2 -I tools/host -I . -o soak tools/soak.cpp
+//   ./soak [options]
+//
+//   -t minutes   simulated time to run, default 60
+//   -r rate      simulated time per real time, default 100, 0 runs as fast
+//                as the host can go
+//   -s seed      seed for the input script, default 1
+//   -v           echo the serial output of the controller
+//
+// The script connects the controller, turns the robot on with Options
+// and then every few seconds moves the sticks somewhere new, now and then
+// presses one of the mode buttons (and later presses it again to go back
+// to walking) and once in a while drops the connection for a few
+// seconds.  Each frame it checks that ClockUs() did not go backwards.  At
+// the end it prints the frames run, the tick overruns, the frame deadline
+// misses, the frames with an IK error and the simulated against the wall
+// time.  It exits with 1 when the clock went backwards.
+//
+// The pipeline tasks do not run on the host, so it is built without
+// OPT_PIPELINE like the other tools.
+//====================================================================
+#include <Arduino.h>
+
+#include "Hex_Cfg.h"
+#undef OPT_PIPELINE
+#include "Phoenix_ESP32_PS4.ino"
+
+static unsigned long s_ulRand;
+
+static long SoakRand(long lMax)
+{
+  s_ulRand = s_ulRand * 1103515245UL + 12345UL;
+  return (long)((s_ulRand >> 16) & 0x7fff) % lMax;
+}
+
+// The buttons the script presses, not PS (the e-stop) or Options
+static bool *SoakButton(long i)
+{
+  ps4_button_t &b = PS4.data.button;
+  bool *apf[] = {&b.cross, &b.circle, &b.square, &b.triangle, &b.l1, &b.r1,
+      &b.up, &b.down, &b.left, &b.right, &b.share};
+  return apf[i % (long)(sizeof(apf) / sizeof(apf[0]))];
+}
+
+int main(int argc, char **argv)
+{
+  double dblMinutes = 60;
+  long lSeed = 1;
+  bool fVerbose = false;
+
+  g_dblHostClockRate = 100;
+  for (int iArg = 1; iArg < argc; iArg++) {
+    if (!strcmp(argv[iArg], "-t") && (iArg + 1 < argc))
+      dblMinutes = atof(argv[++iArg]);
+    else if (!strcmp(argv[iArg], "-r") && (iArg + 1 < argc))
+      g_dblHostClockRate = atof(argv[++iArg]);
+    else if (!strcmp(argv[iArg], "-s") && (iArg + 1 < argc))
+      lSeed = atol(argv[++iArg]);
+    else if (!strcmp(argv[iArg], "-v"))
+      fVerbose = true;
+    else {
+      fprintf(stderr, "usage: soak [-t minutes] [-r rate] [-s seed] [-v]\n");
+      return !!strcmp(argv[iArg], "-h");
+    }
+  }
+  s_ulRand = (unsigned long)lSeed;
+
+  auto tpStart = std::chrono::steady_clock::now();
+  g_fHostEcho = fVerbose;
+  setup();
+
+  int64_t llStart = ClockUs();
+  int64_t llEnd = llStart + (int64_t)(dblMinutes * 60e6);
+  int64_t llPrev = llStart;
+  int64_t llNextInput = llStart;
+  int64_t llReconnect = 0;
+  bool *pfHeld = nullptr;
+  bool *pfToggled = nullptr;
+  unsigned long ulLoops = 0;
+  unsigned long ulIKErrors = 0;
+  unsigned long ulBackwards = 0;
+  unsigned long ulDisconnects = 0;
+
+  g_fHostPS4Connected = true;
+  while (ClockUs() < llEnd) {
+    int64_t llNow = ClockUs();
+
+    // A button is only held for one frame, ButtonPressed looks for the edge
+    if (pfHeld) {
+      *pfHeld = false;
+      pfHeld = nullptr;
+    }
+    if (llReconnect && (llNow >= llReconnect)) {
+      g_fHostPS4Connected = true;
+      llReconnect = 0;
+    }
+    if (!llReconnect && (llNow >= llNextInput)) {
+      long lAction = SoakRand(100);
+      if (!g_InControlState.fRobotOn)
+        pfHeld = &PS4.data.button.options;
+      else if (lAction < 2) {
+        g_fHostPS4Connected = false;
+        if (PS4.pfnDisconnect)
+          PS4.pfnDisconnect();
+        llReconnect = llNow + 1000000 + SoakRand(4000) * 1000LL;
+        ulDisconnects++;
+      }
+      else if (lAction < 15) {
+        // Most buttons toggle a mode, the next press undoes the last one
+        if (pfToggled) {
+          pfHeld = pfToggled;
+          pfToggled = nullptr;
+        }
+        else
+          pfHeld = pfToggled = SoakButton(SoakRand(100));
+      }
+      else {
+        PS4.data.analog.stick.lx = (int8_t)(SoakRand(256) - 128);
+        PS4.data.analog.stick.ly = (int8_t)(SoakRand(256) - 128);
+        PS4.data.analog.stick.rx = (int8_t)(SoakRand(256) - 128);
+        PS4.data.analog.stick.ry = (int8_t)(SoakRand(256) - 128);
+      }
+      if (pfHeld)
+        *pfHeld = true;
+      llNextInput = llNow + 500000 + SoakRand(3000) * 1000LL;
+    }
+
+    loop();
+    ulLoops++;
+    if (IKSolutionError)
+      ulIKErrors++;
+
+    int64_t llAfter = ClockUs();
+    if (llAfter < llPrev)
+      ulBackwards++;
+    llPrev = llAfter;
+  }
+
+  double dblWall = std::chrono::duration<double>(std::chrono::steady_clock::now() - tpStart).count();
+  double dblSim = (ClockUs() - llStart) / 1e6;
+  g_fHostEcho = false;
+  printf("Loops: %lu  IK errors: %lu  Disconnects: %lu  Clock went back: %lu\n", ulLoops, ulIKErrors,
+      ulDisconnects, ulBackwards);
+#ifdef OPT_CTRL_TICK
+  printf("Tick frames: %lu  Overruns: %lu\n", g_ulCtrlFrames, g_ulCtrlOverruns);
+#endif
+#ifdef OPT_FRAME_DEADLINE
+  printf("Deadline checks: %lu  Misses: %lu\n", g_ulFrameChecks, g_ulFrameMisses);
+#endif
+  printf("Simulated %.1fs in %.1fs wall (%.0fx)\n", dblSim, dblWall, dblWall > 0 ? dblSim / dblWall : 0.0);
+  return ulBackwards ? 1 : 0;
+}